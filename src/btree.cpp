@@ -5,7 +5,11 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <cstdio>
+#include <vector>
 #include "btree.h"
+#include "btree_node.h"
 #include "filescan.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/bad_opcodes_exception.h"
@@ -14,7 +18,7 @@
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
-#include "exceptions/end_of_file_exception.h"
+#include "exceptions/badgerdb_exception.h"
 
 
 //#define DEBUG
@@ -22,6 +26,226 @@
 namespace badgerdb
 {
 
+namespace
+{
+
+// Number of key-rid pairs read back from a spilled run at a time during the merge
+const int RUNREADSIZE = 4096;
+
+// Order key-rid pairs by key and then by rid, using Compare for the keys
+template <class T, class Compare>
+struct RIDKeyPairLess{
+	bool operator()(const RIDKeyPair<T>& x, const RIDKeyPair<T>& y) const
+	{
+		Compare comp;
+		if(comp(x.key, y.key))
+			return true;
+		if(comp(y.key, x.key))
+			return false;
+		if(x.rid.page_number != y.rid.page_number)
+			return x.rid.page_number < y.rid.page_number;
+		return x.rid.slot_number < y.rid.slot_number;
+	}
+};
+
+// Write the pairs of a run to its temporary file, return false on a short write
+template <class T>
+bool writeRunPairs(std::FILE* runFile, const std::vector<RIDKeyPair<T> >& run)
+{
+	return std::fwrite(&run[0], sizeof(RIDKeyPair<T>), run.size(), runFile) == run.size();
+}
+
+// STRING keys are written as their length followed by their bytes
+bool writeRunPairs(std::FILE* runFile, const std::vector<RIDKeyPair<std::string> >& run)
+{
+	for(size_t i = 0; i < run.size(); i++){
+		unsigned short length = run[i].key.size();
+		if(std::fwrite(&run[i].rid, sizeof(RecordId), 1, runFile) != 1 ||
+		   std::fwrite(&length, sizeof(length), 1, runFile) != 1 ||
+		   std::fwrite(run[i].key.data(), 1, length, runFile) != length){
+			return false;
+		}
+	}
+	return true;
+}
+
+// Read up to maxPairs pairs of a run back into buffer
+template <class T>
+void readRunPairs(std::FILE* runFile, std::vector<RIDKeyPair<T> >& buffer, const size_t maxPairs)
+{
+	buffer.resize(maxPairs);
+	buffer.resize(std::fread(&buffer[0], sizeof(RIDKeyPair<T>), maxPairs, runFile));
+}
+
+void readRunPairs(std::FILE* runFile, std::vector<RIDKeyPair<std::string> >& buffer, const size_t maxPairs)
+{
+	buffer.clear();
+	RIDKeyPair<std::string> pair;
+	unsigned short length;
+	char key[ STRINGSIZE ];
+
+	while(buffer.size() < maxPairs &&
+	      std::fread(&pair.rid, sizeof(RecordId), 1, runFile) == 1 &&
+	      std::fread(&length, sizeof(length), 1, runFile) == 1 &&
+	      std::fread(key, 1, length, runFile) == length){
+		pair.key.assign(key, length);
+		buffer.push_back(pair);
+	}
+}
+
+// Sort the in-memory run and write it out to a temporary file
+template <class T, class Compare>
+void spillRun(std::vector<RIDKeyPair<T> >& run, std::vector<std::FILE*>& runFiles)
+{
+	std::sort(run.begin(), run.end(), RIDKeyPairLess<T, Compare>());
+
+	std::FILE* runFile = std::tmpfile();
+	if(runFile == NULL){
+		throw BadgerDbException("Could not create a temporary file for a bulk load run");
+	}
+	runFiles.push_back(runFile);
+
+	if(!writeRunPairs(runFile, run)){
+		throw BadgerDbException("Could not write a bulk load run to its temporary file");
+	}
+	std::rewind(runFile);
+	run.clear();
+}
+
+/**
+ * @brief Collects the key-rid pairs of the records one ParallelFileScan worker finds, spilling a sorted run
+ * whenever it holds runSize of them. The run files it still owns are closed when it is destroyed.
+ */
+template <class T, class Compare>
+class KeyExtractor : public ScanConsumer{
+public:
+	KeyExtractor(const int attrByteOffsetIn, const size_t runSizeIn)
+		: attrByteOffset(attrByteOffsetIn), runSize(runSizeIn)
+	{
+	}
+
+	~KeyExtractor()
+	{
+		for(size_t i = 0; i < runFiles.size(); i++){
+			std::fclose(runFiles[i]);
+		}
+	}
+
+	void consume(const RecordId& rid, const RecordView& record)
+	{
+		// A record too short for the attribute cannot be indexed on it
+		if(attrByteOffset < 0 || record.size() < (size_t)attrByteOffset + KeyTraits<T>::minKeySize){
+			std::ostringstream error;
+			error << std::endl << "Record {page=" << rid.page_number << ", slot=" << rid.slot_number << "} has " <<
+					record.size() << " bytes, too few for the key at AttributeByteOffset: " << attrByteOffset << std::endl;
+			throw BadIndexInfoException(error.str());
+		}
+
+		run.push_back(RIDKeyPair<T>(rid, KeyTraits<T>::readKey(record.data() + attrByteOffset, record.size() - attrByteOffset)));
+		if(run.size() >= runSize){
+			spillRun<T, Compare>(run, runFiles);
+		}
+	}
+
+	std::vector<RIDKeyPair<T> > run;
+	std::vector<std::FILE*> runFiles;
+
+private:
+	int attrByteOffset;
+	size_t runSize;
+};
+
+/**
+ * @brief Merges the sorted runs produced while scanning the relation and hands out the
+ * key-rid pairs in ascending order. The last run is kept in memory instead of being spilled.
+ */
+template <class T, class Compare>
+class RunMerger{
+public:
+	RunMerger(std::vector<RIDKeyPair<T> >& memoryRun, std::vector<std::FILE*>& runFiles)
+	{
+		std::sort(memoryRun.begin(), memoryRun.end(), RIDKeyPairLess<T, Compare>());
+
+		runs.resize(runFiles.size() + 1);
+		for(size_t i = 0; i < runFiles.size(); i++){
+			runs[i].file = runFiles[i];
+			runs[i].pos = 0;
+		}
+		runs[runFiles.size()].file = NULL;
+		runs[runFiles.size()].pos = 0;
+		runs[runFiles.size()].buffer.swap(memoryRun);
+
+		for(int i = 0; i < (int)runs.size(); i++){
+			if(refill(runs[i])){
+				heap.push(HeapEntry(runs[i].buffer[0], i));
+			}
+		}
+	}
+
+	~RunMerger()
+	{
+		for(size_t i = 0; i < runs.size(); i++){
+			if(runs[i].file != NULL){
+				std::fclose(runs[i].file);
+			}
+		}
+	}
+
+	// Get the next smallest pair, return false if every run is exhausted
+	bool next(RIDKeyPair<T>& out)
+	{
+		if(heap.empty()){
+			return false;
+		}
+
+		int i = heap.top().second;
+		out = heap.top().first;
+		heap.pop();
+
+		runs[i].pos++;
+		if(refill(runs[i])){
+			heap.push(HeapEntry(runs[i].buffer[runs[i].pos], i));
+		}
+		return true;
+	}
+
+private:
+	struct Run{
+		std::FILE* file;
+		std::vector<RIDKeyPair<T> > buffer;
+		size_t pos;
+	};
+
+	typedef std::pair<RIDKeyPair<T>, int> HeapEntry;
+
+	struct HeapEntryGreater{
+		bool operator()(const HeapEntry& x, const HeapEntry& y) const
+		{
+			return RIDKeyPairLess<T, Compare>()(y.first, x.first);
+		}
+	};
+
+	// Make sure the run has a pair at pos, reading more of the run file if needed
+	bool refill(Run& run)
+	{
+		if(run.pos < run.buffer.size()){
+			return true;
+		}
+		if(run.file == NULL){
+			return false;
+		}
+
+		readRunPairs(run.file, run.buffer, RUNREADSIZE);
+		run.pos = 0;
+		return !run.buffer.empty();
+	}
+
+	std::vector<Run> runs;
+	std::priority_queue<HeapEntry, std::vector<HeapEntry>, HeapEntryGreater> heap;
+};
+
+}
+
 // -----------------------------------------------------------------------------
 // BTreeIndex::BTreeIndex -- Constructor
 // -----------------------------------------------------------------------------
@@ -30,7 +254,10 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		std::string & outIndexName,
 		BufMgr *bufMgrIn,
 		const int attrByteOffset,
-		const Datatype attrType)
+		const Datatype attrType,
+		const double fillFactorIn,
+		const int sortRunSizeIn)
+	: scanCursor(this), mappedFile(NULL)
 {
 	// Generate index file name
 	std::ostringstream idxStr;
@@ -39,11 +266,20 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 	outIndexName = indexFileName;
 
 	// Set the variables
-	scanExecuting = false;
 	this->bufMgr = bufMgrIn;
 	this->attrByteOffset = attrByteOffset;
 	this->attributeType = attrType;
 	this->headerPageNum = 1;
+	this->fillFactor = fillFactorIn;
+	this->sortRunSize = sortRunSizeIn;
+
+	// Clamp the bulk load parameters
+	if(!(fillFactor > 0) || fillFactor > 1){
+		fillFactor = 1;
+	}
+	if(sortRunSize < 1){
+		sortRunSize = 1;
+	}
 
 	// Set attribute type
 	switch(attributeType){
@@ -81,10 +317,12 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 					"MetadataAttributeType: " << metadata->attrType <<  std::endl <<
 					"AttributeByteOffset: " << attrByteOffset << std::endl <<
 					"MetadataAttributeByteOffset: " << metadata->attrByteOffset << std::endl;
+			bufMgr->unPinPage(file, headerPageNum, false);
 			throw BadIndexInfoException(error.str());
 		}
 
 		this->rootPageNum = metadata->rootPageNo;
+		bufMgr->unPinPage(file, headerPageNum, false);
 	}
 	else{
 		// File does not exist, create a new file
@@ -98,24 +336,18 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		Page* rootPage;
 		bufMgr->allocPage(file, rootPageNum, rootPage);
 
-		// Initialize the root node, level is set to 0
+		// Initialize the root node, level is set to 0 and there is no leaf yet
 		switch(attributeType){
-			case INTEGER:{
-				NonLeafNodeInt* root = (NonLeafNodeInt*)rootPage;
-				root->level = 0;
+			case INTEGER:
+				NodeOps<int, std::less<int> >::initNonLeaf((NonLeafNodeInt*)rootPage, 0, 0);
 				break;
-			}
-			case DOUBLE:{
-				NonLeafNodeDouble* root = (NonLeafNodeDouble*)rootPage;
-				root->level = 0;
+			case DOUBLE:
+				NodeOps<double, std::less<double> >::initNonLeaf((NonLeafNodeDouble*)rootPage, 0, 0);
 				break;
-			}
-			case STRING:{
-				NonLeafNodeString* root = (NonLeafNodeString*)rootPage;
-				root->level = 0;
+			case STRING:
+				NodeOps<std::string, std::less<std::string> >::initNonLeaf((NonLeafNodeString*)rootPage, 0, 0);
 				break;
-			}
-		}	
+		}
 
 		// Create metadata for the index file
 		IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
@@ -123,46 +355,34 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 		metadata->attrByteOffset = attrByteOffset;
 		metadata->attrType = attrType;
 		metadata->rootPageNo = rootPageNum;
+		metadata->firstFreePageNo = 0;
 
 		// Write metadata and root to file
 		bufMgr->unPinPage(file, headerPageNum, true);
 		bufMgr->unPinPage(file, rootPageNum, true);
 
-		// Insert every tuple into the b+tree
-		{
-			FileScan* fsInsert = new FileScan(relationName, bufMgr);
-
-			RecordId currRid;
-			try{
-				while(1){
-					// Get the recordId and key
-					fsInsert->scanNext(currRid);
-					std::string recordStr = fsInsert->getRecord();
-					const char *record = recordStr.c_str();
-
-					// Insert the recordId and key based on it's type
-					switch(attributeType){
-						case INTEGER:{
-							int key = *((int *)(record + attrByteOffset));
-							this->insertEntry((void*)&key, currRid);
-							break;
-						}
-						case DOUBLE:{
-							double key = *((double *)(record + attrByteOffset));
-							this->insertEntry((void*)&key, currRid);
-							break;
-						}
-						case STRING:{
-							break;
-						}
-					}	
-				}
-			}
-			catch (EndOfFileException e){
-				std::cout << "All records are inserted" << std::endl;
+		// Bulk load every tuple into the b+tree
+		try{
+			switch(attributeType){
+				case INTEGER:
+					bulkLoad<int>(relationName);
+					break;
+				case DOUBLE:
+					bulkLoad<double>(relationName);
+					break;
+				case STRING:
+					bulkLoad<std::string>(relationName);
+					break;
 			}
-			delete fsInsert;
 		}
+		catch (...){
+			// Do not leave a partial index behind to be opened as a complete one
+			bufMgr->flushFile(file);
+			delete file;
+			File::remove(indexFileName);
+			throw;
+		}
+		std::cout << "All records are inserted" << std::endl;
 		// End of insert
 	}
 }
@@ -175,8 +395,8 @@ BTreeIndex::BTreeIndex(const std::string & relationName,
 BTreeIndex::~BTreeIndex()
 {
 	// If it is still scanning, end the scan
-	if(scanExecuting){
-		endScan();
+	if(scanCursor.isScanning()){
+		scanCursor.endScan();
 	}
 	
 	// Flush all dirty pages and close file
@@ -193,1435 +413,1149 @@ BTreeIndex::~BTreeIndex()
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::insertEntry
+// BTreeIndex::bulkLoad
 // -----------------------------------------------------------------------------
 
-const void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
+template <class T, class Compare>
+void BTreeIndex::bulkLoad(const std::string & relationName)
 {
-	// Get the root node
-	Page* rootPage;
-	bufMgr->readPage(file, rootPageNum, rootPage);	
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
+
+	// Extract every key-rid pair with a worker per core, as many as the buffer pool has frames for, each spilling
+	// sorted runs when it holds its share of sortRunSize pairs
+	ParallelFileScan* fsInsert = new ParallelFileScan(relationName, bufMgr, BUFRINGSIZE);
+	std::uint32_t workers = fsInsert->defaultWorkers();
+	std::vector<KeyExtractor<T, Compare>*> extractors;
+	std::vector<ScanConsumer*> consumers;
+	for(std::uint32_t i = 0; i < workers; i++){
+		extractors.push_back(new KeyExtractor<T, Compare>(attrByteOffset, std::max<size_t>(sortRunSize / workers, 1)));
+		consumers.push_back(extractors[i]);
+	}
 
-	switch(attributeType){
-		case INTEGER:{
-			// Initialize the variables
-			int keyInt = *(int*)key;
-			RIDKeyPair<int>* keyPair = new RIDKeyPair<int>(rid, keyInt);
-			NonLeafNodeInt* rootInt = (NonLeafNodeInt*)rootPage;
-			Page* leafPage;
+	std::vector<RIDKeyPair<T> > run;
+	std::vector<std::FILE*> runFiles;
+	try{
+		fsInsert->scan(consumers);
+		// The relation's pages are cached under the scan's file, which goes away with the scan
+		fsInsert->flush();
+	}
+	catch (...){
+		for(std::uint32_t i = 0; i < workers; i++){
+			delete extractors[i];
+		}
+		delete fsInsert;
+		throw;
+	}
+	delete fsInsert;
+
+	// The pairs left in memory make up one run, the merger takes over the spilled ones
+	for(std::uint32_t i = 0; i < workers; i++){
+		run.insert(run.end(), extractors[i]->run.begin(), extractors[i]->run.end());
+		runFiles.insert(runFiles.end(), extractors[i]->runFiles.begin(), extractors[i]->runFiles.end());
+		extractors[i]->runFiles.clear();
+		delete extractors[i];
+	}
 
-			if(rootInt->level == 0){
-				// If there is only one leaf node, then check if the leaf node exist
-				if(rootInt->pageNoArray[0] == 0){
-					// If the leaf node does not exist yet(first insert), create the first leaf node
-					bufMgr->allocPage(file, rootInt->pageNoArray[0], leafPage);	
-					LeafNodeInt* leafInt = (LeafNodeInt*)leafPage;
-
-					// Insert entry
-					leafInt->keyArray[0] = keyPair->key;
-					leafInt->ridArray[0] = keyPair->rid;
-					leafInt->numKeys = 1;
-					leafInt->rightSibPageNo = 0;
-
-					// Write page
-					bufMgr->unPinPage(file, rootInt->pageNoArray[0], true);
-					bufMgr->unPinPage(file, rootPageNum, true);
-				}
-				else{
-					// If the first leaf node exist 
-					bufMgr->readPage(file, rootInt->pageNoArray[0], leafPage);
-
-					// Get the leaf node
-					LeafNodeInt* leafNode = (LeafNodeInt*)leafPage;
-
-					// If the leaf node is full, split the root
-					if(leafNode->numKeys >= leafOccupancy){
-						// Remove the last item to be inserted later
-						RIDKeyPair<int>* endKeyPair = new RIDKeyPair<int>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-						leafNode->numKeys--;
-
-						// Insert the keyPair
-						insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-						// Compare the extra key Pair
-						RIDKeyPair<int>* currKeyPair = new RIDKeyPair<int>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-						swapRIDKeyPair(endKeyPair, currKeyPair);
-						leafNode->keyArray[leafOccupancy-1] = currKeyPair->key;
-						leafNode->ridArray[leafOccupancy-1] = currKeyPair->rid;
-						// The array is now sorted
-
-						// Split the node
-						Page* newLeafPage;
-						bufMgr->allocPage(file, rootInt->pageNoArray[1], newLeafPage);	
-						LeafNodeInt* newLeafNode = (LeafNodeInt*)newLeafPage;
-
-						// The position (k to end) in the array that is moved to another node
-						int k = (leafOccupancy+1)/2;
-
-						// Set the root node
-						rootInt->level++;
-						rootInt->keyArray[0] = leafNode->keyArray[k];
-						rootInt->numKeys++;
-
-						// Set the left leaf node
-						leafNode->numKeys = k;
-						leafNode->rightSibPageNo = rootInt->pageNoArray[1];
-
-						// Set the right leaf node
-						newLeafNode->rightSibPageNo = 0;
-						newLeafNode->numKeys = 0;
-
-						// Copy half of the array to the new array
-						int j = 0;
-						for(j = k; j < leafOccupancy; j++){
-							newLeafNode->keyArray[j-k] = leafNode->keyArray[j];
-							newLeafNode->ridArray[j-k] = leafNode->ridArray[j];
-							newLeafNode->numKeys++;
-						}
-
-						newLeafNode->keyArray[j-k] = endKeyPair->key;
-						newLeafNode->ridArray[j-k] = endKeyPair->rid;
-						newLeafNode->numKeys++;
-
-						// Write the changes
-						bufMgr->unPinPage(file, rootInt->pageNoArray[0], true);
-						bufMgr->unPinPage(file, rootInt->pageNoArray[1], true);
-						bufMgr->unPinPage(file, rootPageNum, true);
-					}
-					else{
-						// Insert the key
-						insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-						// Write the changes
-						bufMgr->unPinPage(file, rootInt->pageNoArray[0], true);
-						bufMgr->unPinPage(file, rootPageNum, false);
-					}
-				}
-			}
-			else{
-				// Traverse the non-leaf level
-				Page* currPage;
-				PageId currPageId;
-				PageId rightPageId; // For setting the right sibling of the leaf node		
-
-				// Stack to store pageId for reverse traversal
-				std::stack<PageId> pageStack;
-
-				scanTree(&keyInt, currPageId, rightPageId, &pageStack);
-
-				// Reach the leaf level
-				bufMgr->readPage(file, currPageId, currPage);
-				LeafNodeInt* leafNode = (LeafNodeInt*)currPage;
-
-				// Check if the leaf node is full
-				if(leafNode->numKeys >= leafOccupancy){
-					// Remove the last item
-					RIDKeyPair<int>* endKeyPair = new RIDKeyPair<int>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-					leafNode->numKeys--;
-
-					insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-					// Compare the extra key Pair
-					RIDKeyPair<int>* currKeyPair = new RIDKeyPair<int>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-					swapRIDKeyPair(endKeyPair, currKeyPair);
-					leafNode->keyArray[leafOccupancy-1] = currKeyPair->key;
-					leafNode->ridArray[leafOccupancy-1] = currKeyPair->rid;
-					// The array is now sorted
-
-					// Split the node
-					PageId newLeafNodeId;
-					Page* newLeafPage;
-					bufMgr->allocPage(file, newLeafNodeId, newLeafPage);	
-					LeafNodeInt* newLeafNode = (LeafNodeInt*)newLeafPage;
-
-					// The position (k to end) in the array that is moved to another node
-					int k = (leafOccupancy+1)/2;
-					PageKeyPair<int>* pagePair = new PageKeyPair<int>(newLeafNodeId, leafNode->keyArray[k]);
-
-					// Set the left leaf node
-					leafNode->numKeys = k;
-					leafNode->rightSibPageNo = newLeafNodeId;
-
-					// Set the right leaf node
-					newLeafNode->rightSibPageNo = rightPageId;
-					newLeafNode->numKeys = 0;
-
-					int j = 0;
-					for(j = k; j < leafOccupancy; j++){
-						newLeafNode->keyArray[j-k] = leafNode->keyArray[j];
-						newLeafNode->ridArray[j-k] = leafNode->ridArray[j];
-						newLeafNode->numKeys++;
-					}
-
-					newLeafNode->keyArray[j-k] = endKeyPair->key;
-					newLeafNode->ridArray[j-k] = endKeyPair->rid;
-					newLeafNode->numKeys++;
-
-					// Write the changes
-					bufMgr->unPinPage(file, currPageId, true);
-					bufMgr->unPinPage(file, newLeafNodeId, true);
-					bufMgr->unPinPage(file, rootPageNum, true);
-
-					// Reverse traversal up the tree
-					while(pageStack.size() > 0){
-						// Get the parent node pageId
-						currPageId = pageStack.top();
-						pageStack.pop();
-
-						bufMgr->readPage(file, currPageId, currPage);
-
-						NonLeafNodeInt* currNode = (NonLeafNodeInt*)currPage;
-
-						// Check if the parent node is full
-						if(currNode->numKeys >= nodeOccupancy){
-							// If the current node is full, split the node
-
-							// Remove the last item
-							PageKeyPair<int>* endPagePair = new PageKeyPair<int>(currNode->pageNoArray[nodeOccupancy], currNode->keyArray[nodeOccupancy-1]);
-								currNode->numKeys--;
-
-							// Insert the key and pageNo
-							insertNonLeafArray(currNode->keyArray, currNode->pageNoArray, currNode->numKeys, pagePair);
-
-							PageKeyPair<int>* currPagePair = new PageKeyPair<int>(currNode->pageNoArray[nodeOccupancy], currNode->keyArray[nodeOccupancy-1]);
-							swapPageKeyPair(endPagePair, currPagePair);
-							currNode->keyArray[nodeOccupancy-1] = currPagePair->key;
-							currNode->pageNoArray[nodeOccupancy] = currPagePair->pageNo;
-							// The array is now sorted
-
-							// Split the node
-							Page* newPage;
-							PageId newPageId;
-							bufMgr->allocPage(file, newPageId, newPage);	
-							NonLeafNodeInt* newCurrNode = (NonLeafNodeInt*)newPage;
-
-							// The position (k to end) in the array that is moved to another node
-							k = (nodeOccupancy+1)/2;
-							pagePair->set(newPageId, currNode->keyArray[k]);
-
-							// Set the left node
-							currNode->numKeys = k;
-
-							// Set the right node
-							newCurrNode->numKeys = 0;
-							newCurrNode->level = currNode->level;
-
-							for(j = k; j < nodeOccupancy-1; j++){
-								newCurrNode->keyArray[j-k] = currNode->keyArray[j+1];
-								newCurrNode->pageNoArray[j-k] = currNode->pageNoArray[j+1];
-								newCurrNode->numKeys++;
-							}
-
-							newCurrNode->keyArray[j-k] = endPagePair->key;
-							newCurrNode->pageNoArray[j-k] = currNode->pageNoArray[j+1];
-							newCurrNode->pageNoArray[j-k+1] = endPagePair->pageNo;
-							newCurrNode->numKeys++;
-
-							// If it is the root
-							if(pageStack.size() == 0){
-								Page* newRootPage;
-								bufMgr->allocPage(file, rootPageNum, newRootPage);
-
-								NonLeafNodeInt* newRootInt = (NonLeafNodeInt*)newRootPage;
-
-								newRootInt->level = currNode->level + 1;
-								newRootInt->pageNoArray[0] = currPageId;
-								newRootInt->pageNoArray[1] = pagePair->pageNo;
-								newRootInt->keyArray[0] = pagePair->key;
-								newRootInt->numKeys = 1;
-
-								bufMgr->unPinPage(file, rootPageNum, true);
-
-								// Read the metadata
-								Page* metadataPage;
-								bufMgr->readPage(file, headerPageNum, metadataPage);
-								IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
-								metadata->rootPageNo = rootPageNum;
-
-								bufMgr->unPinPage(file, headerPageNum, true);
-							}
-
-							// Write the changes
-							bufMgr->unPinPage(file, newPageId, true);
-							bufMgr->unPinPage(file, currPageId, true);
-						}
-						else{
-							// If the parent node is not full
-							insertNonLeafArray(currNode->keyArray, currNode->pageNoArray, currNode->numKeys, pagePair);
-
-							bufMgr->unPinPage(file, currPageId, true);
-							break;
-						}
-					}
-				}
-				else{
-					// If leafNode is not full
-					insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-					// Write the changes
-					bufMgr->unPinPage(file, currPageId, true);
-					bufMgr->unPinPage(file, rootPageNum, false);
-					return;
-				}
+	RunMerger<T, Compare> merger(run, runFiles);
+
+	// Fill the leaves left to right up to the fill factor
+	// First key and pageNo of every node in the level being built
+	std::vector<PageKeyPair<T> > children;
+	typename Ops::LeafBuilder leafBuilder(fillFactor);
+
+	PageId prevLeafNum = 0;
+	LeafNodeT* prevLeaf = NULL;
+	T prevLastKey = T();
+	RIDKeyPair<T> keyPair;
+	bool more = merger.next(keyPair);
+
+	while(more){
+		leafBuilder.add(keyPair.key, keyPair.rid);
+		while((more = merger.next(keyPair)) && leafBuilder.fits(keyPair.key)){
+			leafBuilder.add(keyPair.key, keyPair.rid);
+		}
+
+		PageId leafNum;
+		Page* leafPage;
+		bufMgr->allocPage(file, leafNum, leafPage);
+		LeafNodeT* leaf = (LeafNodeT*)leafPage;
+
+		T firstKey = leafBuilder.firstKey();
+		T lastKey = leafBuilder.lastKey();
+		leafBuilder.write(leaf);
+
+		// Link the previous leaf to this one
+		if(prevLeaf != NULL){
+			Ops::setRightSib(prevLeaf, leafNum);
+			bufMgr->unPinPage(file, prevLeafNum, true);
+			children.push_back(PageKeyPair<T>(leafNum, Ops::separator(prevLastKey, firstKey)));
+		}
+		else{
+			children.push_back(PageKeyPair<T>(leafNum, firstKey));
+		}
+
+		prevLeafNum = leafNum;
+		prevLeaf = leaf;
+		prevLastKey = lastKey;
+	}
+
+	if(prevLeaf != NULL){
+		bufMgr->unPinPage(file, prevLeafNum, true);
+	}
+
+	// Build the non-leaf levels until a single node is left, the last one is written to the root page
+	typename Ops::NonLeafBuilder nodeBuilder(fillFactor);
+	int level = 1;
+
+	while(children.size() > 1){
+		// Find the first child of every node in this level
+		std::vector<size_t> starts;
+		size_t c = 0;
+		while(c < children.size()){
+			starts.push_back(c);
+			nodeBuilder.start(children[c].pageNo);
+			c++;
+			while(c < children.size() && nodeBuilder.fits(children[c].key)){
+				nodeBuilder.add(children[c].key, children[c].pageNo);
+				c++;
 			}
-			break;
 		}
-		case DOUBLE:{
-			// Initialize the variables
-			double keyDouble = *(double*)key;
-			RIDKeyPair<double>* keyPair = new RIDKeyPair<double>(rid, keyDouble);
-			NonLeafNodeDouble* rootDouble = (NonLeafNodeDouble*)rootPage;
-			Page* leafPage;
 
-			if(rootDouble->level == 0){
-				// If there is only one leaf node, then check if the leaf node exist
-				if(rootDouble->pageNoArray[0] == 0){
-					// If the leaf node does not exist yet(first insert), create the first leaf node
-					bufMgr->allocPage(file, rootDouble->pageNoArray[0], leafPage);	
-					LeafNodeDouble* leafDouble = (LeafNodeDouble*)leafPage;
-
-					// Insert entry
-					leafDouble->keyArray[0] = keyPair->key;
-					leafDouble->ridArray[0] = keyPair->rid;
-					leafDouble->numKeys = 1;
-					leafDouble->rightSibPageNo = 0;
-
-					// Write page
-					bufMgr->unPinPage(file, rootDouble->pageNoArray[0], true);
-					bufMgr->unPinPage(file, rootPageNum, true);
-				}
-				else{
-					// If the first leaf node exist 
-					bufMgr->readPage(file, rootDouble->pageNoArray[0], leafPage);
-
-					// Get the leaf node
-					LeafNodeDouble* leafNode = (LeafNodeDouble*)leafPage;
-
-					// If the leaf node is full, split the root
-					if(leafNode->numKeys >= leafOccupancy){
-						// Remove the last item to be inserted later
-						RIDKeyPair<double>* endKeyPair = new RIDKeyPair<double>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-						leafNode->numKeys--;
-
-						// Insert the keyPair
-						insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-						// Compare the extra key Pair
-						RIDKeyPair<double>* currKeyPair = new RIDKeyPair<double>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-						swapRIDKeyPair(endKeyPair, currKeyPair);
-						leafNode->keyArray[leafOccupancy-1] = currKeyPair->key;
-						leafNode->ridArray[leafOccupancy-1] = currKeyPair->rid;
-						// The array is now sorted
-
-						// Split the node
-						Page* newLeafPage;
-						bufMgr->allocPage(file, rootDouble->pageNoArray[1], newLeafPage);	
-						LeafNodeDouble* newLeafNode = (LeafNodeDouble*)newLeafPage;
-
-						// The position (k to end) in the array that is moved to another node
-						int k = (leafOccupancy+1)/2;
-
-						// Set the root node
-						rootDouble->level++;
-						rootDouble->keyArray[0] = leafNode->keyArray[k];
-						rootDouble->numKeys++;
-
-						// Set the left leaf node
-						leafNode->numKeys = k;
-						leafNode->rightSibPageNo = rootDouble->pageNoArray[1];
-
-						// Set the right leaf node
-						newLeafNode->rightSibPageNo = 0;
-						newLeafNode->numKeys = 0;
-
-						// Copy half of the array to the new array
-						int j = 0;
-						for(j = k; j < leafOccupancy; j++){
-							newLeafNode->keyArray[j-k] = leafNode->keyArray[j];
-							newLeafNode->ridArray[j-k] = leafNode->ridArray[j];
-							newLeafNode->numKeys++;
-						}
-
-						newLeafNode->keyArray[j-k] = endKeyPair->key;
-						newLeafNode->ridArray[j-k] = endKeyPair->rid;
-						newLeafNode->numKeys++;
-
-						// Write the changes
-						bufMgr->unPinPage(file, rootDouble->pageNoArray[0], true);
-						bufMgr->unPinPage(file, rootDouble->pageNoArray[1], true);
-						bufMgr->unPinPage(file, rootPageNum, true);
-					}
-					else{
-						// Insert the key
-						insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-						// Write the changes
-						bufMgr->unPinPage(file, rootDouble->pageNoArray[0], true);
-						bufMgr->unPinPage(file, rootPageNum, false);
-					}
-				}
+		// Give the last node at least one key by moving the last child of the node before it over
+		if(starts.size() > 1 && starts.back() == children.size() - 1){
+			starts.back()--;
+		}
+
+		std::vector<PageKeyPair<T> > parents;
+		for(size_t n = 0; n < starts.size(); n++){
+			size_t begin = starts[n];
+			size_t end = n + 1 < starts.size() ? starts[n+1] : children.size();
+
+			nodeBuilder.start(children[begin].pageNo);
+			for(size_t j = begin + 1; j < end; j++){
+				nodeBuilder.add(children[j].key, children[j].pageNo);
+			}
+
+			PageId nodeNum;
+			Page* nodePage;
+			if(starts.size() == 1){
+				nodeNum = rootPageNum;
+				bufMgr->readPage(file, nodeNum, nodePage);
 			}
 			else{
-				// Traverse the non-leaf level
-				Page* currPage;
-				PageId currPageId;
-				PageId rightPageId; // For setting the right sibling of the leaf node		
-
-				// Stack to store pageId for reverse traversal
-				std::stack<PageId> pageStack;
-
-				scanTree(&keyDouble, currPageId, rightPageId, &pageStack);
-
-				// Reach the leaf level
-				bufMgr->readPage(file, currPageId, currPage);
-				LeafNodeDouble* leafNode = (LeafNodeDouble*)currPage;
-
-				// Check if the leaf node is full
-				if(leafNode->numKeys >= leafOccupancy){
-					// Remove the last item
-					RIDKeyPair<double>* endKeyPair = new RIDKeyPair<double>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-					leafNode->numKeys--;
-
-					insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-					// Compare the extra key Pair
-					RIDKeyPair<double>* currKeyPair = new RIDKeyPair<double>(leafNode->ridArray[leafOccupancy-1], leafNode->keyArray[leafOccupancy-1]);
-					swapRIDKeyPair(endKeyPair, currKeyPair);
-					leafNode->keyArray[leafOccupancy-1] = currKeyPair->key;
-					leafNode->ridArray[leafOccupancy-1] = currKeyPair->rid;
-					// The array is now sorted
-
-					// Split the node
-					PageId newLeafNodeId;
-					Page* newLeafPage;
-					bufMgr->allocPage(file, newLeafNodeId, newLeafPage);	
-					LeafNodeDouble* newLeafNode = (LeafNodeDouble*)newLeafPage;
-
-					// The position (k to end) in the array that is moved to another node
-					int k = (leafOccupancy+1)/2;
-					PageKeyPair<double>* pagePair = new PageKeyPair<double>(newLeafNodeId, leafNode->keyArray[k]);
-
-					// Set the left leaf node
-					leafNode->numKeys = k;
-					leafNode->rightSibPageNo = newLeafNodeId;
-
-					// Set the right leaf node
-					newLeafNode->rightSibPageNo = rightPageId;
-					newLeafNode->numKeys = 0;
-
-					int j = 0;
-					for(j = k; j < leafOccupancy; j++){
-						newLeafNode->keyArray[j-k] = leafNode->keyArray[j];
-						newLeafNode->ridArray[j-k] = leafNode->ridArray[j];
-						newLeafNode->numKeys++;
-					}
-
-					newLeafNode->keyArray[j-k] = endKeyPair->key;
-					newLeafNode->ridArray[j-k] = endKeyPair->rid;
-					newLeafNode->numKeys++;
-
-					// Write the changes
-					bufMgr->unPinPage(file, currPageId, true);
-					bufMgr->unPinPage(file, newLeafNodeId, true);
-					bufMgr->unPinPage(file, rootPageNum, true);
-
-					// Reverse traversal up the tree
-					while(pageStack.size() > 0){
-						// Get the parent node pageId
-						currPageId = pageStack.top();
-						pageStack.pop();
-
-						bufMgr->readPage(file, currPageId, currPage);
-
-						NonLeafNodeDouble* currNode = (NonLeafNodeDouble*)currPage;
-
-						// Check if the parent node is full
-						if(currNode->numKeys >= nodeOccupancy){
-							// If the current node is full, split the node
-
-							// Remove the last item
-							PageKeyPair<double>* endPagePair = new PageKeyPair<double>(currNode->pageNoArray[nodeOccupancy], currNode->keyArray[nodeOccupancy-1]);
-								currNode->numKeys--;
-
-							// Insert the key and pageNo
-							insertNonLeafArray(currNode->keyArray, currNode->pageNoArray, currNode->numKeys, pagePair);
-
-							PageKeyPair<double>* currPagePair = new PageKeyPair<double>(currNode->pageNoArray[nodeOccupancy], currNode->keyArray[nodeOccupancy-1]);
-							swapPageKeyPair(endPagePair, currPagePair);
-							currNode->keyArray[nodeOccupancy-1] = currPagePair->key;
-							currNode->pageNoArray[nodeOccupancy] = currPagePair->pageNo;
-							// The array is now sorted
-
-							// Split the node
-							Page* newPage;
-							PageId newPageId;
-							bufMgr->allocPage(file, newPageId, newPage);	
-							NonLeafNodeDouble* newCurrNode = (NonLeafNodeDouble*)newPage;
-
-							// The position (k to end) in the array that is moved to another node
-							k = (nodeOccupancy+1)/2;
-							pagePair->set(newPageId, currNode->keyArray[k]);
-
-							// Set the left node
-							currNode->numKeys = k;
-
-							// Set the right node
-							newCurrNode->numKeys = 0;
-							newCurrNode->level = currNode->level;
-
-							for(j = k; j < nodeOccupancy-1; j++){
-								newCurrNode->keyArray[j-k] = currNode->keyArray[j+1];
-								newCurrNode->pageNoArray[j-k] = currNode->pageNoArray[j+1];
-								newCurrNode->numKeys++;
-							}
-
-							newCurrNode->keyArray[j-k] = endPagePair->key;
-							newCurrNode->pageNoArray[j-k] = currNode->pageNoArray[j+1];
-							newCurrNode->pageNoArray[j-k+1] = endPagePair->pageNo;
-							newCurrNode->numKeys++;
-
-							// If it is the root
-							if(pageStack.size() == 0){
-								Page* newRootPage;
-								bufMgr->allocPage(file, rootPageNum, newRootPage);
-
-								NonLeafNodeDouble* newRootDouble = (NonLeafNodeDouble*)newRootPage;
-
-								newRootDouble->level = currNode->level + 1;
-								newRootDouble->pageNoArray[0] = currPageId;
-								newRootDouble->pageNoArray[1] = pagePair->pageNo;
-								newRootDouble->keyArray[0] = pagePair->key;
-								newRootDouble->numKeys = 1;
-
-								bufMgr->unPinPage(file, rootPageNum, true);
-
-								// Read the metadata
-								Page* metadataPage;
-								bufMgr->readPage(file, headerPageNum, metadataPage);
-								IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
-								metadata->rootPageNo = rootPageNum;
-
-								bufMgr->unPinPage(file, headerPageNum, true);
-							}
-
-							// Write the changes
-							bufMgr->unPinPage(file, newPageId, true);
-							bufMgr->unPinPage(file, currPageId, true);
-						}
-						else{
-							// If the parent node is not full
-							insertNonLeafArray(currNode->keyArray, currNode->pageNoArray, currNode->numKeys, pagePair);
-
-							bufMgr->unPinPage(file, currPageId, true);
-							break;
-						}
-					}
-				}
-				else{
-					// If leafNode is not full
-					insertLeafArray(leafNode->keyArray, leafNode->ridArray, leafNode->numKeys, keyPair);
-
-					// Write the changes
-					bufMgr->unPinPage(file, currPageId, true);
-					bufMgr->unPinPage(file, rootPageNum, false);
-					return;
-				}
+				bufMgr->allocPage(file, nodeNum, nodePage);
 			}
-			break;
-		}
-		case STRING:{
-			NonLeafNodeString* rootString = (NonLeafNodeString*)rootPage;
-			rootString->level = 0;
-			break;
+
+			nodeBuilder.write((NonLeafNodeT*)nodePage, level);
+			parents.push_back(PageKeyPair<T>(nodeNum, children[begin].key));
+
+			bufMgr->unPinPage(file, nodeNum, true);
 		}
+
+		children.swap(parents);
+		level++;
+	}
+
+	// With at most one leaf, the root stays at level 0 and points at it directly
+	if(level == 1){
+		Page* rootPage;
+		bufMgr->readPage(file, rootPageNum, rootPage);
+		Ops::initNonLeaf((NonLeafNodeT*)rootPage, 0, children.empty() ? 0 : children[0].pageNo);
+		bufMgr->unPinPage(file, rootPageNum, true);
 	}
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::startScan
+// BTreeIndex::insertEntry
 // -----------------------------------------------------------------------------
 
-const void BTreeIndex::startScan(const void* lowValParm,
-				   const Operator lowOpParm,
-				   const void* highValParm,
-				   const Operator highOpParm)
-{	
-	// If another scan is executing
-	if(scanExecuting){
-		endScan();
-	}
+const void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
+{
+	checkWritable();
 
-	// Check parameter
-	if(lowOpParm != GT && lowOpParm != GTE){
-		throw BadOpcodesException();
+	switch(attributeType){
+		case INTEGER:
+			insertKey<int>(*(int*)key, rid);
+			break;
+		case DOUBLE:
+			insertKey<double>(*(double*)key, rid);
+			break;
+		case STRING:
+			insertKey<std::string>(KeyTraits<std::string>::readKey((const char*)key, STRINGSIZE), rid);
+			break;
 	}
+}
 
-	lowOp = lowOpParm;
+template <class T, class Compare>
+void BTreeIndex::insertKey(const T& key, const RecordId rid)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
 
-	if(highOpParm != LT && highOpParm != LTE){
-		throw BadOpcodesException();
-	}
+	// Stack to store pageId for reverse traversal
+	std::stack<PageId> pageStack;
+	PageId leafPageNum = findLeaf<T, Compare>(key, false, &pageStack);
+	Page* leafPage;
 
-	highOp = highOpParm;
+	if(leafPageNum == 0){
+		// If the leaf node does not exist yet(first insert), create the first leaf node
+		Page* rootPage;
+		bufMgr->readPage(file, rootPageNum, rootPage);
+		allocIndexPage(leafPageNum, leafPage);
 
-	switch(attributeType){
-		case INTEGER:{
-			lowValInt = *(int*)lowValParm;
-			highValInt = *(int*)highValParm;
+		LeafNodeT* leafNode = (LeafNodeT*)leafPage;
+		Ops::initLeaf(leafNode);
+		Ops::insert(leafNode, key, rid);
+		Ops::setChild((NonLeafNodeT*)rootPage, 0, leafPageNum);
 
-			if(lowValInt > highValInt){
-				throw BadScanrangeException();
-			}
+		// Write page
+		bufMgr->unPinPage(file, leafPageNum, true);
+		bufMgr->unPinPage(file, rootPageNum, true);
+		return;
+	}
 
-			// Scan for the low Value
-			scanTree(&lowValInt, this->currentPageNum);
+	bufMgr->readPage(file, leafPageNum, leafPage);
+	LeafNodeT* leafNode = (LeafNodeT*)leafPage;
 
-			bufMgr->readPage(file, this->currentPageNum, this->currentPageData);
-			LeafNodeInt* leafInt = (LeafNodeInt*)this->currentPageData;
+	// If leafNode is not full, just insert the key
+	if(Ops::insert(leafNode, key, rid)){
+		bufMgr->unPinPage(file, leafPageNum, true);
+		return;
+	}
 
-			bool entryFound = false;
+	// Split the leaf node, the separator of the new leaf is copied up into the parent
+	PageId newPageNum;
+	Page* newPage;
+	allocIndexPage(newPageNum, newPage);
+	LeafNodeT* newLeafNode = (LeafNodeT*)newPage;
 
-			// Search through the current leaf node
-			int i = 0;
-			for(i = 0; i < leafInt->numKeys; i++){
-				if(lowOp == GT){
-					if(leafInt->keyArray[i] > lowValInt){
-						this->nextEntry = i;
-						entryFound = true;
-						this->scanExecuting = true;
-						break;
-					}
-				}
-				else if(lowOp == GTE){
-					if(leafInt->keyArray[i] >= lowValInt){
-						this->nextEntry = i;
-						entryFound = true;
-						this->scanExecuting = true;
-						break;
-					}
-				}
-			}
+	PageKeyPair<T> pagePair(newPageNum, key);
+	Ops::initLeaf(newLeafNode);
+	Ops::split(leafNode, newLeafNode, key, rid, pagePair.key);
 
-			if(!entryFound){
-				std::cout << "No entry found" << std::endl;
-			}
+	// The new node takes over the right sibling of the left node
+	Ops::setRightSib(newLeafNode, Ops::rightSib(leafNode));
+	Ops::setRightSib(leafNode, newPageNum);
 
-			// Search the right sibling if it is not found in this current leaf node
-			if(!entryFound){
-				PageId rightPageId = leafInt->rightSibPageNo;
-				bufMgr->unPinPage(file, this->currentPageNum, false);
-				this->currentPageNum = rightPageId;
-
-				bufMgr->readPage(file, this->currentPageNum, this->currentPageData);
-				leafInt = (LeafNodeInt*)this->currentPageData;
-
-				for(i = 0; i < leafInt->numKeys; i++){
-					if(lowOp == GT){
-						if(leafInt->keyArray[i] > lowValInt){
-							this->nextEntry = i;
-							entryFound = true;
-							this->scanExecuting = true;
-							break;
-						}
-					}
-					else if(lowOp == GTE){
-						if(leafInt->keyArray[i] >= lowValInt){
-							this->nextEntry = i;
-							entryFound = true;
-							this->scanExecuting = true;
-							break;
-						}
-					}
-				}
-			}
+	bufMgr->unPinPage(file, leafPageNum, true);
+	bufMgr->unPinPage(file, newPageNum, true);
 
-			// If there is still no entry found
-			if(!entryFound){
-				endScan();
-				throw NoSuchKeyFoundException();
-			}
+	// Reverse traversal up the tree
+	int splitLevel = 0;
+	while(!pageStack.empty()){
+		// Get the parent node pageId
+		PageId currPageNum = pageStack.top();
+		pageStack.pop();
 
-			// If the key found does not satisfy highOp
-			if(highOp == LT){
-				if(!(leafInt->keyArray[this->nextEntry] < highValInt)){
-					endScan();
-					throw NoSuchKeyFoundException();
-				}
-			}
-			else if(highOp == LTE){
-				if(!(leafInt->keyArray[this->nextEntry] <= highValInt)){
-					endScan();
-					throw NoSuchKeyFoundException();
-				}
+		Page* currPage;
+		bufMgr->readPage(file, currPageNum, currPage);
+		NonLeafNodeT* currNode = (NonLeafNodeT*)currPage;
+
+		// If the parent node is not full, insert the key and stop
+		if(Ops::insert(currNode, pagePair)){
+			// A level 0 root gets its first key, its children are leaves
+			if(Ops::level(currNode) == 0){
+				Ops::setLevel(currNode, 1);
 			}
-			break;
+			bufMgr->unPinPage(file, currPageNum, true);
+			return;
 		}
-		case DOUBLE:{
-			lowValDouble = *(double*)lowValParm;
-			highValDouble = *(double*)highValParm;
 
-			if(lowValDouble > highValDouble){
-				throw BadScanrangeException();
-			}
+		// If the parent node is full, split it and move the middle key up
+		allocIndexPage(newPageNum, newPage);
+		Ops::split(currNode, (NonLeafNodeT*)newPage, pagePair);
+		pagePair.pageNo = newPageNum;
+		splitLevel = Ops::level(currNode);
 
-			// Scan for the low Value
-			scanTree(&lowValDouble, this->currentPageNum);
+		bufMgr->unPinPage(file, currPageNum, true);
+		bufMgr->unPinPage(file, newPageNum, true);
+	}
 
-			bufMgr->readPage(file, this->currentPageNum, this->currentPageData);
-			LeafNodeDouble* leafDouble = (LeafNodeDouble*)this->currentPageData;
+	// The root was split, add a new root above it
+	PageId newRootPageNum;
+	Page* newRootPage;
+	allocIndexPage(newRootPageNum, newRootPage);
+	NonLeafNodeT* newRoot = (NonLeafNodeT*)newRootPage;
 
-			bool entryFound = false;
+	Ops::initNonLeaf(newRoot, splitLevel + 1, rootPageNum);
+	Ops::insert(newRoot, pagePair);
 
-			// Search through the current leaf node
-			int i = 0;
-			for(i = 0; i < leafDouble->numKeys; i++){
-				if(lowOp == GT){
-					if(leafDouble->keyArray[i] > lowValDouble){
-						this->nextEntry = i;
-						entryFound = true;
-						this->scanExecuting = true;
-						break;
-					}
-				}
-				else if(lowOp == GTE){
-					if(leafDouble->keyArray[i] >= lowValDouble){
-						this->nextEntry = i;
-						entryFound = true;
-						this->scanExecuting = true;
-						break;
-					}
-				}
-			}
+	bufMgr->unPinPage(file, newRootPageNum, true);
+	rootPageNum = newRootPageNum;
 
-			if(!entryFound){
-				std::cout << "No entry found" << std::endl;
-			}
+	// Update the root in the metadata
+	Page* metadataPage;
+	bufMgr->readPage(file, headerPageNum, metadataPage);
+	IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
+	metadata->rootPageNo = rootPageNum;
+	bufMgr->unPinPage(file, headerPageNum, true);
+}
 
-			// Search the right sibling if it is not found in this current leaf node
-			if(!entryFound){
-				PageId rightPageId = leafDouble->rightSibPageNo;
-				bufMgr->unPinPage(file, this->currentPageNum, false);
-				this->currentPageNum = rightPageId;
-
-				bufMgr->readPage(file, this->currentPageNum, this->currentPageData);
-				leafDouble = (LeafNodeDouble*)this->currentPageData;
-
-				for(i = 0; i < leafDouble->numKeys; i++){
-					if(lowOp == GT){
-						if(leafDouble->keyArray[i] > lowValDouble){
-							this->nextEntry = i;
-							entryFound = true;
-							this->scanExecuting = true;
-							break;
-						}
-					}
-					else if(lowOp == GTE){
-						if(leafDouble->keyArray[i] >= lowValDouble){
-							this->nextEntry = i;
-							entryFound = true;
-							this->scanExecuting = true;
-							break;
-						}
-					}
-				}
-			}
+// -----------------------------------------------------------------------------
+// BTreeIndex::deleteEntry
+// -----------------------------------------------------------------------------
 
-			// If there is still no entry found
-			if(!entryFound){
-				endScan();
-				throw NoSuchKeyFoundException();
-			}
+const void BTreeIndex::deleteEntry(const void *key, const RecordId rid)
+{
+	checkWritable();
 
-			// If the key found does not satisfy highOp
-			if(highOp == LT){
-				if(!(leafDouble->keyArray[this->nextEntry] < highValDouble)){
-					endScan();
-					throw NoSuchKeyFoundException();
-				}
-			}
-			else if(highOp == LTE){
-				if(!(leafDouble->keyArray[this->nextEntry] <= highValDouble)){
-					endScan();
-					throw NoSuchKeyFoundException();
-				}
-			}
+	switch(attributeType){
+		case INTEGER:
+			deleteKey<int>(*(int*)key, rid);
 			break;
-		}
-		case STRING:{
+		case DOUBLE:
+			deleteKey<double>(*(double*)key, rid);
 			break;
-		}
-	}	
+		case STRING:
+			deleteKey<std::string>(KeyTraits<std::string>::readKey((const char*)key, STRINGSIZE), rid);
+			break;
+	}
 }
 
-// -----------------------------------------------------------------------------
-// BTreeIndex::scanNext
-// -----------------------------------------------------------------------------
-
-const void BTreeIndex::scanNext(RecordId& outRid) 
+template <class T, class Compare>
+void BTreeIndex::deleteKey(const T& key, const RecordId rid)
 {
-	if(!scanExecuting){
-		throw ScanNotInitializedException();
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
+
+	Page* rootPage;
+	bufMgr->readPage(file, rootPageNum, rootPage);
+	NonLeafNodeT* root = (NonLeafNodeT*)rootPage;
+
+	if(!removeEntry<T, Compare>(root, key, rid)){
+		bufMgr->unPinPage(file, rootPageNum, false);
+		throw NoSuchKeyFoundException();
 	}
 
-	// There is no right sibling
-	if(this->nextEntry == -1){
-		throw IndexScanCompletedException();
+	// A root left with a single child is no longer needed
+	if(Ops::numKeys(root) == 0 && Ops::level(root) == 1){
+		// The only child is a leaf, the root points at it directly from level 0
+		Ops::setLevel(root, 0);
 	}
+	else if(Ops::numKeys(root) == 0 && Ops::level(root) > 1){
+		// The only child becomes the root
+		PageId oldRootPageNum = rootPageNum;
+		rootPageNum = Ops::child(root, 0);
+		freeIndexPage(oldRootPageNum, rootPage);
+		bufMgr->unPinPage(file, oldRootPageNum, true);
 
-	switch(attributeType){
-		case INTEGER:{
-			LeafNodeInt* leafInt = (LeafNodeInt*)currentPageData;
+		Page* metadataPage;
+		bufMgr->readPage(file, headerPageNum, metadataPage);
+		IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
+		metadata->rootPageNo = rootPageNum;
+		bufMgr->unPinPage(file, headerPageNum, true);
+		return;
+	}
 
-			if(highOp == LT){
-				if(!(leafInt->keyArray[this->nextEntry] < highValInt)){
-					throw IndexScanCompletedException();
-				}
-			}
-			else if(highOp == LTE){
-				if(!(leafInt->keyArray[this->nextEntry] <= highValInt)){
-					throw IndexScanCompletedException();
-				}
-			}
+	bufMgr->unPinPage(file, rootPageNum, true);
+}
 
-			outRid = leafInt->ridArray[this->nextEntry];
+template <class T, class Compare>
+bool BTreeIndex::removeEntry(typename KeyTraits<T>::NonLeafNodeType* node, const T& key, const RecordId rid)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
 
-			if(this->nextEntry + 1 >= leafInt->numKeys){
-				PageId rightPageId = leafInt->rightSibPageNo;
+	bool childIsLeaf = Ops::level(node) <= 1;
 
-				// If there is no right sibling
-				if(rightPageId == 0){
-					this->nextEntry = -1;
-				}
-				else{
-					bufMgr->unPinPage(file, currentPageNum, false);
-					currentPageNum = rightPageId;
-					bufMgr->readPage(file, currentPageNum, currentPageData);
-					this->nextEntry = 0;
-				}
-			}
-			else{
-				this->nextEntry++;
-			}			
-			break;
+	// Keys equal to the key may be in any child between the two bounds
+	int lastChild = Ops::upperBound(node, key);
+	for(int i = Ops::lowerBound(node, key); i <= lastChild; i++){
+		PageId childPageNum = Ops::child(node, i);
+
+		// The tree is empty
+		if(childPageNum == 0){
+			return false;
 		}
-		case DOUBLE:{
-			LeafNodeDouble* leafDouble = (LeafNodeDouble*)currentPageData;
 
-			if(highOp == LT){
-				if(!(leafDouble->keyArray[this->nextEntry] < highValDouble)){
-					throw IndexScanCompletedException();
-				}
-			}
-			else if(highOp == LTE){
-				if(!(leafDouble->keyArray[this->nextEntry] <= highValDouble)){
-					throw IndexScanCompletedException();
+		Page* childPage;
+		bufMgr->readPage(file, childPageNum, childPage);
+		bool found = false;
+		bool underflow = false;
+
+		if(childIsLeaf){
+			LeafNodeT* leaf = (LeafNodeT*)childPage;
+			int end = Ops::upperBound(leaf, key);
+			for(int j = Ops::lowerBound(leaf, key); j < end; j++){
+				if(Ops::rid(leaf, j) == rid){
+					Ops::remove(leaf, j);
+					found = true;
+					underflow = Ops::underflow(leaf);
+					break;
 				}
 			}
+		}
+		else{
+			NonLeafNodeT* child = (NonLeafNodeT*)childPage;
+			found = removeEntry<T, Compare>(child, key, rid);
+			underflow = found && Ops::underflow(child);
+		}
 
-			outRid = leafDouble->ridArray[this->nextEntry];
-
-			if(this->nextEntry + 1 >= leafDouble->numKeys){
-				PageId rightPageId = leafDouble->rightSibPageNo;
+		bufMgr->unPinPage(file, childPageNum, found);
 
-				// If there is no right sibling
-				if(rightPageId == 0){
-					this->nextEntry = -1;
-				}
-				else{
-					bufMgr->unPinPage(file, currentPageNum, false);
-					currentPageNum = rightPageId;
-					bufMgr->readPage(file, currentPageNum, currentPageData);
-					this->nextEntry = 0;
-				}
+		if(found){
+			if(underflow){
+				rebalanceChild<T, Compare>(node, i);
 			}
-			else{
-				this->nextEntry++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template <class T, class Compare>
+void BTreeIndex::rebalanceChild(typename KeyTraits<T>::NonLeafNodeType* node, const int i)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
+
+	bool childIsLeaf = Ops::level(node) <= 1;
+
+	// A node with a single child has no sibling to pair it with.
+	// Under a level 0 root that child is the only leaf, which is dropped once it is empty.
+	if(Ops::numKeys(node) == 0){
+		if(Ops::level(node) == 0){
+			PageId leafPageNum = Ops::child(node, 0);
+			Page* leafPage;
+			bufMgr->readPage(file, leafPageNum, leafPage);
+
+			bool empty = Ops::numKeys((LeafNodeT*)leafPage) == 0;
+			if(empty){
+				freeIndexPage(leafPageNum, leafPage);
+				Ops::setChild(node, 0, 0);
 			}
-			break;
+			bufMgr->unPinPage(file, leafPageNum, empty);
 		}
-		case STRING:{
-			break;
+		return;
+	}
+
+	// Pair the child with its left sibling, or with its right sibling if it is the first child
+	int sepIndex = i > 0 ? i - 1 : i;
+	PageId leftPageNum = Ops::child(node, sepIndex);
+	PageId rightPageNum = Ops::child(node, sepIndex + 1);
+
+	Page* leftPage;
+	Page* rightPage;
+	bufMgr->readPage(file, leftPageNum, leftPage);
+	bufMgr->readPage(file, rightPageNum, rightPage);
+
+	bool merged = false;
+	bool moved = false;
+	std::vector<T> keys;
+	std::vector<T> rightKeys;
+
+	if(childIsLeaf){
+		LeafNodeT* left = (LeafNodeT*)leftPage;
+		LeafNodeT* right = (LeafNodeT*)rightPage;
+
+		std::vector<RecordId> rids;
+		std::vector<RecordId> rightRids;
+		Ops::getEntries(left, keys, rids);
+		Ops::getEntries(right, rightKeys, rightRids);
+		size_t leftCount = keys.size();
+		keys.insert(keys.end(), rightKeys.begin(), rightKeys.end());
+		rids.insert(rids.end(), rightRids.begin(), rightRids.end());
+
+		if(Ops::leafFits(keys, 0, keys.size())){
+			// Merge the right leaf into the left leaf
+			Ops::setEntries(left, keys, rids, 0, keys.size());
+			Ops::setRightSib(left, Ops::rightSib(right));
+			merged = true;
+		}
+		else{
+			// Even out the two leaves, the separator in the parent moves with them
+			size_t k = Ops::leafSplitPoint(keys);
+			if(k != leftCount && Ops::replaceKey(node, sepIndex, Ops::separator(keys[k-1], keys[k]))){
+				Ops::setEntries(left, keys, rids, 0, k);
+				Ops::setEntries(right, keys, rids, k, keys.size());
+				moved = true;
+			}
+		}
+	}
+	else{
+		NonLeafNodeT* left = (NonLeafNodeT*)leftPage;
+		NonLeafNodeT* right = (NonLeafNodeT*)rightPage;
+
+		// The separator in the parent comes down between the keys of the two nodes
+		std::vector<PageId> pageNos;
+		std::vector<PageId> rightPageNos;
+		Ops::getEntries(left, keys, pageNos);
+		Ops::getEntries(right, rightKeys, rightPageNos);
+		size_t leftCount = keys.size();
+		keys.push_back(Ops::key(node, sepIndex));
+		keys.insert(keys.end(), rightKeys.begin(), rightKeys.end());
+		pageNos.insert(pageNos.end(), rightPageNos.begin(), rightPageNos.end());
+
+		if(Ops::nonLeafFits(keys, 0, keys.size())){
+			// Merge the right node into the left node
+			Ops::setEntries(left, keys, pageNos, 0, keys.size());
+			merged = true;
+		}
+		else{
+			// Even out the two nodes, the middle key goes up to the parent
+			size_t m = Ops::nonLeafSplitPoint(keys);
+			if(m != leftCount && Ops::replaceKey(node, sepIndex, keys[m])){
+				Ops::setEntries(left, keys, pageNos, 0, m);
+				Ops::setEntries(right, keys, pageNos, m + 1, keys.size());
+				moved = true;
+			}
 		}
 	}
+
+	// A merged right node is dropped from the parent and its page is freed
+	if(merged){
+		Ops::removeKey(node, sepIndex);
+		freeIndexPage(rightPageNum, rightPage);
+	}
+
+	bufMgr->unPinPage(file, leftPageNum, merged || moved);
+	bufMgr->unPinPage(file, rightPageNum, merged || moved);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startScan
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{
+	scanCursor.startScan(lowValParm, lowOpParm, highValParm, highOpParm);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+
+const void BTreeIndex::scanNext(RecordId& outRid)
+{
+	scanCursor.scanNext(outRid);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNextBatch
+// -----------------------------------------------------------------------------
+
+size_t BTreeIndex::scanNextBatch(RecordId* outRids, const size_t maxRids)
+{
+	return scanCursor.scanNextBatch(outRids, maxRids);
 }
 
 // -----------------------------------------------------------------------------
 // BTreeIndex::endScan
 // -----------------------------------------------------------------------------
-//
-const void BTreeIndex::endScan() 
-{	
-	// If there is no scan
-	if(!scanExecuting){
-		throw ScanNotInitializedException();
+
+const void BTreeIndex::endScan()
+{
+	scanCursor.endScan();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setReadOnly
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setReadOnly(const bool readOnly)
+{
+	if(readOnly == isReadOnly()){
+		return;
 	}
 
-	scanExecuting = false;
-	bufMgr->unPinPage(file, currentPageNum, false);
+	// The scan holds a page of the mode it was started in
+	if(scanCursor.isScanning()){
+		scanCursor.endScan();
+	}
 
-	currentPageNum = 0;
-	currentPageData = NULL;
-	nextEntry = -1;
+	if(readOnly){
+		// Write the index out and give its frames back, reads no longer go through the buffer pool
+		bufMgr->flushFile(file);
+		BlobFile* blobFile = static_cast<BlobFile*>(file);
+		blobFile->map();
+		mappedFile = blobFile;
+	}
+	else{
+		mappedFile->unmap();
+		mappedFile = NULL;
+	}
 }
 
-// --------------------------------------------------------------------------------
-/*
-	Helper functions
-*/
-// --------------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+// IndexCursor::IndexCursor -- Constructor
+// -----------------------------------------------------------------------------
 
-// scan the tree for the key
-// return the leaf's pageId
-// the leaf's right sibling pageId, if there's no sibling, return 0
-// a pageId stack of the traversal down the tree
-void BTreeIndex::scanTree(void* key, PageId& pageId, PageId& rightPageId, std::stack<PageId>* stack){
-	Page* rootPage;
-	bufMgr->readPage(file, rootPageNum, rootPage);
+IndexCursor::IndexCursor(BTreeIndex* indexIn)
+	: index(indexIn),
+	scanExecuting(false),
+	nextEntry(-1),
+	scanEndEntry(0),
+	currentPageNum(0),
+	currentPageData(NULL),
+	readAheadMax(READAHEADLEAVES),
+	readAheadWindow(1),
+	readAheadParent(0),
+	ring(NULL)
+{
+}
 
-	switch(attributeType){
-		case INTEGER:{
-			int intKey = *(int*)key;
-			NonLeafNodeInt* rootInt = (NonLeafNodeInt*)rootPage;
-			Page* currPage;
-			int currLevel = rootInt->level;
-			PageId currPageId = rootPageNum;
-			PageId prevPageId = rootPageNum;
-
-			while(currLevel > 0){
-				bufMgr->readPage(file, currPageId, currPage);
-				NonLeafNodeInt* currInt = (NonLeafNodeInt*)currPage;
-				stack->push(currPageId);
-				int i = 0;
-
-				for(i = 0; i < currInt->numKeys; i++){
-					if(!(intKey >= currInt->keyArray[i])){
-						break;
-					}
-				}
+// -----------------------------------------------------------------------------
+// IndexCursor::~IndexCursor -- destructor
+// -----------------------------------------------------------------------------
 
-				prevPageId = currPageId;
-				currPageId = currInt->pageNoArray[i];
+IndexCursor::~IndexCursor()
+{
+	// If it is still scanning, end the scan
+	if(scanExecuting){
+		endScan();
+	}
+	delete ring;
+}
 
-				// For setting leafNode right sibling later
-				if(!(i >= nodeOccupancy)){
-					rightPageId = currInt->pageNoArray[i+1];
-				}
-				else{
-					rightPageId = 0;
-				}
+// -----------------------------------------------------------------------------
+// IndexCursor::setBufRing
+// -----------------------------------------------------------------------------
 
-				bufMgr->unPinPage(file, prevPageId, false);
-				currLevel--;
-			}
+void IndexCursor::setBufRing(const std::uint32_t frames)
+{
+	// Frames of the old ring stay in the buffer pool like any others
+	delete ring;
+	ring = frames > 0 ? new BufRing(frames) : NULL;
+}
 
-			pageId = currPageId;
-			break;
-		}
-		case DOUBLE:{
-			double doubleKey = *(double*)key;
-			NonLeafNodeDouble* rootDouble = (NonLeafNodeDouble*)rootPage;
-			Page* currPage;
-			double currLevel = rootDouble->level;
-			PageId currPageId = rootPageNum;
-			PageId prevPageId = rootPageNum;
-
-			while(currLevel > 0){
-				bufMgr->readPage(file, currPageId, currPage);
-				NonLeafNodeDouble* currDouble = (NonLeafNodeDouble*)currPage;
-				stack->push(currPageId);
-				int i = 0;
-
-				for(i = 0; i < currDouble->numKeys; i++){
-					if(!(doubleKey >= currDouble->keyArray[i])){
-						break;
-					}
-				}
+// -----------------------------------------------------------------------------
+// IndexCursor::startScan
+// -----------------------------------------------------------------------------
 
-				prevPageId = currPageId;
-				currPageId = currDouble->pageNoArray[i];
+const void IndexCursor::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{	
+	// If another scan is executing
+	if(scanExecuting){
+		endScan();
+	}
 
-				// For setting leafNode right sibling later
-				if(!(i >= nodeOccupancy)){
-					rightPageId = currDouble->pageNoArray[i+1];
-				}
-				else{
-					rightPageId = 0;
-				}
+	// Check parameter
+	if(lowOpParm != GT && lowOpParm != GTE){
+		throw BadOpcodesException();
+	}
 
-				bufMgr->unPinPage(file, prevPageId, false);
-				currLevel--;
-			}
+	lowOp = lowOpParm;
+
+	if(highOpParm != LT && highOpParm != LTE){
+		throw BadOpcodesException();
+	}
 
-			pageId = currPageId;
+	highOp = highOpParm;
+
+	switch(index->attributeType){
+		case INTEGER:
+			lowValInt = *(int*)lowValParm;
+			highValInt = *(int*)highValParm;
+			startScanRange<int>(lowValInt, highValInt);
 			break;
-		}
-		case STRING:{
+		case DOUBLE:
+			lowValDouble = *(double*)lowValParm;
+			highValDouble = *(double*)highValParm;
+			startScanRange<double>(lowValDouble, highValDouble);
 			break;
-		}
-	}
-	bufMgr->unPinPage(file, rootPageNum, false);
+		case STRING:
+			lowValString = KeyTraits<std::string>::readKey((const char*)lowValParm, STRINGSIZE);
+			highValString = KeyTraits<std::string>::readKey((const char*)highValParm, STRINGSIZE);
+			startScanRange<std::string>(lowValString, highValString);
+			break;
+	}	
 }
 
-// scan the tree for the key and return the pageId
-void BTreeIndex::scanTree(void* key, PageId& pageId){
-	Page* rootPage;
-	bufMgr->readPage(file, rootPageNum, rootPage);
-	
-	switch(attributeType){
-		case INTEGER:{
-			int intKey = *(int*)key;
-			NonLeafNodeInt* rootInt = (NonLeafNodeInt*)rootPage;
-			Page* currPage;
-			int currLevel = rootInt->level;
-			PageId currPageId = rootPageNum;
-			PageId prevPageId = rootPageNum;
-
-			while(currLevel > 0){
-				bufMgr->readPage(file, currPageId, currPage);
-				NonLeafNodeInt* currInt = (NonLeafNodeInt*)currPage;
-
-				int i = 0;
-
-				for(i = 0; i < currInt->numKeys; i++){
-					if(!(intKey >= currInt->keyArray[i])){
-						break;
-					}
-				}
+template <class T, class Compare>
+void IndexCursor::startScanRange(const T& lowVal, const T& highVal)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
 
-				prevPageId = currPageId;
-				currPageId = currInt->pageNoArray[i];
+	Compare comp;
+	if(comp(highVal, lowVal)){
+		throw BadScanrangeException();
+	}
 
-				bufMgr->unPinPage(file, prevPageId, false);
-				currLevel--;
-			}
+	// Scan for the low Value
+	PageId pageNum = index->findLeaf<T, Compare>(lowVal, lowOp == GTE, NULL);
+	if(pageNum == 0){
+		throw NoSuchKeyFoundException();
+	}
 
-			pageId = currPageId;
-			break;
-		}
-		case DOUBLE:{
-			double doubleKey = *(double*)key;
-			NonLeafNodeDouble* rootDouble = (NonLeafNodeDouble*)rootPage;
-			Page* currPage;
-			double currLevel = rootDouble->level;
-			PageId currPageId = rootPageNum;
-			PageId prevPageId = rootPageNum;
-
-			while(currLevel > 0){
-				bufMgr->readPage(file, currPageId, currPage);
-				NonLeafNodeDouble* currDouble = (NonLeafNodeDouble*)currPage;
-
-				int i = 0;
-
-				for(i = 0; i < currDouble->numKeys; i++){
-					if(!(doubleKey >= currDouble->keyArray[i])){
-						break;
-					}
-				}
+	this->currentPageNum = pageNum;
+	this->currentPageData = index->readNode(this->currentPageNum, ring);
+	this->scanExecuting = true;
 
-				prevPageId = currPageId;
-				currPageId = currDouble->pageNoArray[i];
+	// Search through the leaf nodes for the first key satisfying lowOp
+	while(1){
+		LeafNodeT* leaf = (LeafNodeT*)this->currentPageData;
 
-				bufMgr->unPinPage(file, prevPageId, false);
-				currLevel--;
-			}
+		if(lowOp == GT){
+			this->nextEntry = Ops::upperBound(leaf, lowVal);
+		}
+		else{
+			this->nextEntry = Ops::lowerBound(leaf, lowVal);
+		}
 
-			pageId = currPageId;
+		if(this->nextEntry < Ops::numKeys(leaf)){
 			break;
 		}
-		case STRING:{
-			break;
+
+		// Search the right sibling if it is not found in this current leaf node
+		PageId rightPageId = Ops::rightSib(leaf);
+		if(rightPageId == 0){
+			endScan();
+			throw NoSuchKeyFoundException();
 		}
+
+		index->releaseNode(this->currentPageNum);
+		this->currentPageNum = rightPageId;
+		this->currentPageData = index->readNode(this->currentPageNum, ring);
 	}
-	bufMgr->unPinPage(file, rootPageNum, false);
-}
 
+	// If the key found does not satisfy highOp
+	setScanEnd<T, Compare>(highVal);
+	if(this->nextEntry >= this->scanEndEntry){
+		endScan();
+		throw NoSuchKeyFoundException();
+	}
 
-// Insert PageKeyPair into arrays in non-leaf
-void BTreeIndex::insertNonLeafArray(void* array, void* pageArray, int& numItems, void* pageKey){
-	switch(attributeType){
-		case INTEGER:{
-			PageKeyPair<int>* x = (PageKeyPair<int>*)pageKey;
-			int* arr = (int*)array;
-			PageId* pageArr = (PageId*)pageArray;
-
-			int i = 0;
-			for(i = 0; i < numItems; i++){
-				if(arr[i] > x->key){
-					break;
-				}
-			}
+	// Only read ahead if the range goes on past this leaf
+	this->readAheadWindow = 1;
+	if(this->scanEndEntry >= Ops::numKeys((LeafNodeT*)this->currentPageData)){
+		startReadAhead<T, Compare>(highVal);
+	}
+}
 
-			for(int j = numItems; j > i; j--){
-				arr[j] = arr[j-1];
-				pageArr[j+1] = pageArr[j];
-			}
+// -----------------------------------------------------------------------------
+// IndexCursor::scanNext
+// -----------------------------------------------------------------------------
 
-			arr[i] = x->key;
-			pageArr[i+1] = x->pageNo;
+const void IndexCursor::scanNext(RecordId& outRid) 
+{
+	if(!scanExecuting){
+		throw ScanNotInitializedException();
+	}
 
-			numItems++;
+	// There is no right sibling
+	if(this->nextEntry == -1){
+		throw IndexScanCompletedException();
+	}
+
+	switch(index->attributeType){
+		case INTEGER:
+			scanNextEntry<int>(outRid, highValInt);
 			break;
-		}
-		case DOUBLE:{
-			PageKeyPair<double>* x = (PageKeyPair<double>*)pageKey;
-			double* arr = (double*)array;
-			PageId* pageArr = (PageId*)pageArray;
-
-			int i = 0;
-			for(i = 0; i < numItems; i++){
-				if(arr[i] > x->key){
-					break;
-				}
-			}
+		case DOUBLE:
+			scanNextEntry<double>(outRid, highValDouble);
+			break;
+		case STRING:
+			scanNextEntry<std::string>(outRid, highValString);
+			break;
+	}
+}
 
-			for(int j = numItems; j > i; j--){
-				arr[j] = arr[j-1];
-				pageArr[j+1] = pageArr[j];
-			}
+// -----------------------------------------------------------------------------
+// IndexCursor::scanNextBatch
+// -----------------------------------------------------------------------------
 
-			arr[i] = x->key;
-			pageArr[i+1] = x->pageNo;
+size_t IndexCursor::scanNextBatch(RecordId* outRids, const size_t maxRids)
+{
+	if(!scanExecuting){
+		throw ScanNotInitializedException();
+	}
 
-			numItems++;
-			break;
-		}
-		case STRING:{
-			break;
-		}
+	switch(index->attributeType){
+		case INTEGER:
+			return scanNextRun<int>(outRids, maxRids, highValInt);
+		case DOUBLE:
+			return scanNextRun<double>(outRids, maxRids, highValDouble);
+		case STRING:
+			return scanNextRun<std::string>(outRids, maxRids, highValString);
 	}
+	return 0;
 }
 
-// Insert RIDKeyPair into arrays in the leaf
-void BTreeIndex::insertLeafArray(void* array, void* ridArray, int& numItems, void* ridPair){
-	switch(attributeType){
-		case INTEGER:{
-			RIDKeyPair<int>* x = (RIDKeyPair<int>*)ridPair;
-			int* arr = (int*)array;
-			RecordId* ridArr = (RecordId*)ridArray;
-
-			int i = 0;
-			for(i = 0; i < numItems; i++){
-				if(arr[i] > x->key){
-					break;
-				}
-			}
+template <class T, class Compare>
+void IndexCursor::scanNextEntry(RecordId& outRid, const T& highVal)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
 
-			for(int j = numItems; j > i; j--){
-				arr[j] = arr[j-1];
-				ridArr[j] = ridArr[j-1];
-			}
+	// The rest of the leaf is past the high end of the range
+	if(this->nextEntry >= this->scanEndEntry){
+		throw IndexScanCompletedException();
+	}
 
-			arr[i] = x->key;
-			ridArr[i] = x->rid;
+	LeafNodeT* leaf = (LeafNodeT*)currentPageData;
+	outRid = Ops::rid(leaf, this->nextEntry);
+	this->nextEntry++;
 
-			numItems++;
-			break;
-		}
-		case DOUBLE:{
-			RIDKeyPair<double>* x = (RIDKeyPair<double>*)ridPair;
-			double* arr = (double*)array;
-			RecordId* ridArr = (RecordId*)ridArray;
-
-			int i = 0;
-			for(i = 0; i < numItems; i++){
-				if(arr[i] > x->key){
-					break;
-				}
-			}
+	if(this->nextEntry >= Ops::numKeys(leaf)){
+		nextLeaf<T, Compare>(highVal);
+	}
+}
 
-			for(int j = numItems; j > i; j--){
-				arr[j] = arr[j-1];
-				ridArr[j] = ridArr[j-1];
-			}
+template <class T, class Compare>
+size_t IndexCursor::scanNextRun(RecordId* outRids, const size_t maxRids, const T& highVal)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
 
-			arr[i] = x->key;
-			ridArr[i] = x->rid;
+	size_t count = 0;
+	while(count < maxRids && this->nextEntry != -1 && this->nextEntry < this->scanEndEntry){
+		LeafNodeT* leaf = (LeafNodeT*)currentPageData;
 
-			numItems++;
-			break;
+		// Everything up to scanEndEntry is in range, copy as much of it as fits
+		int end = this->scanEndEntry;
+		if((size_t)(end - this->nextEntry) > maxRids - count){
+			end = this->nextEntry + (int)(maxRids - count);
 		}
-		case STRING:{
-			break;
+		for(int i = this->nextEntry; i < end; i++){
+			outRids[count++] = Ops::rid(leaf, i);
+		}
+		this->nextEntry = end;
+
+		if(this->nextEntry >= Ops::numKeys(leaf)){
+			nextLeaf<T, Compare>(highVal);
 		}
 	}
+	return count;
 }
-  
-// Swap x PageKeyPair with y PageKeyPair if x < y
-void BTreeIndex::swapPageKeyPair(void* x, void* y){
-	switch(attributeType){
-		case INTEGER:{
-			PageKeyPair<int>* xInt = (PageKeyPair<int>*)x;
-			PageKeyPair<int>* yInt = (PageKeyPair<int>*)y;
 
-			if(xInt->key < yInt->key){
-				int tempKey = xInt->key;
-				PageId tempId = xInt->pageNo;
+template <class T, class Compare>
+void IndexCursor::nextLeaf(const T& highVal)
+{
+	typedef NodeOps<T, Compare> Ops;
+	PageId rightPageId = Ops::rightSib((typename Ops::LeafNodeT*)currentPageData);
 
-				xInt->set(yInt->pageNo, yInt->key);
-				yInt->set(tempId, tempKey);		
+	// If there is no right sibling
+	if(rightPageId == 0){
+		this->nextEntry = -1;
+	}
+	else{
+		index->releaseNode(currentPageNum);
+		currentPageNum = rightPageId;
+		currentPageData = index->readNode(currentPageNum, ring);
+		this->nextEntry = 0;
+		setScanEnd<T, Compare>(highVal);
+
+		if(readAheadParent != 0){
+			readAheadPos++;
+
+			// The leaf was read ahead in time, read further ahead from now on
+			if(readAheadPos < readAheadEnd){
+				readAheadWindow = std::min(readAheadWindow * 2, readAheadMax);
 			}
-			break;
-		}
-		case DOUBLE:{
-			PageKeyPair<double>* xDouble = (PageKeyPair<double>*)x;
-			PageKeyPair<double>* yDouble = (PageKeyPair<double>*)y;
 
-			if(xDouble->key < yDouble->key){
-				double tempKey = xDouble->key;
-				PageId tempId = xDouble->pageNo;
-
-				xDouble->set(yDouble->pageNo, yDouble->key);
-				yDouble->set(tempId, tempKey);		
+			if(this->scanEndEntry < Ops::numKeys((typename Ops::LeafNodeT*)currentPageData)){
+				// The range ends in this leaf
+				readAheadParent = 0;
+			}
+			else if(readAheadPos <= readAheadLast){
+				readAhead<T, Compare>();
+			}
+			else if(readAheadMore){
+				startReadAhead<T, Compare>(highVal);
+			}
+			else{
+				readAheadParent = 0;
 			}
-			break;
-		}
-		case STRING:{
-			break;
 		}
 	}
 }
 
-// Swap x keyPair with ykeyPair if x < y
-void BTreeIndex::swapRIDKeyPair(void* x, void* y){
-	switch(attributeType){
-		case INTEGER:{
-			RIDKeyPair<int>* xInt = (RIDKeyPair<int>*)x;
-			RIDKeyPair<int>* yInt = (RIDKeyPair<int>*)y;
+template <class T, class Compare>
+void IndexCursor::startReadAhead(const T& highVal)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
 
-			if(xInt->key < yInt->key){
-				int tempKey = xInt->key;
-				RecordId tempRid = xInt->rid;
+	readAheadParent = 0;
+	if(readAheadMax == 0){
+		return;
+	}
 
-				xInt->set(yInt->rid, yInt->key);
-				yInt->set(tempRid, tempKey);		
-			}
+	// Descend to the current leaf again by its last key, keeping the path to get at its parent
+	LeafNodeT* leaf = (LeafNodeT*)currentPageData;
+	std::stack<PageId> path;
+	index->findLeaf<T, Compare>(Ops::key(leaf, Ops::numKeys(leaf) - 1), true, &path);
+
+	PageId parentPageNum = path.top();
+	NonLeafNodeT* parent = (NonLeafNodeT*)index->readNode(parentPageNum);
+
+	// With a long run of duplicates the descent can end left of the leaf, then there is no read-ahead
+	int numChildren = Ops::numKeys(parent) + 1;
+	for(int i = 0; i < numChildren; i++){
+		if(Ops::child(parent, i) == currentPageNum){
+			readAheadParent = parentPageNum;
+			readAheadPos = i;
+			readAheadEnd = i + 1;
+			readAheadLast = Ops::upperBound(parent, highVal);
+			readAheadMore = readAheadLast == numChildren - 1;
 			break;
 		}
-		case DOUBLE:{
-			RIDKeyPair<double>* xDouble = (RIDKeyPair<double>*)x;
-			RIDKeyPair<double>* yDouble = (RIDKeyPair<double>*)y;
+	}
+	index->releaseNode(parentPageNum);
 
-			if(xDouble->key < yDouble->key){
-				double tempKey = xDouble->key;
-				RecordId tempRid = xDouble->rid;
+	readAhead<T, Compare>();
+}
 
-				xDouble->set(yDouble->rid, yDouble->key);
-				yDouble->set(tempRid, tempKey);		
-			}
-			break;
-		}
-		case STRING:{
-			break;
-		}
+template <class T, class Compare>
+void IndexCursor::readAhead()
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
+
+	if(readAheadParent == 0){
+		return;
+	}
+
+	int last = std::min(readAheadLast, readAheadPos + readAheadWindow);
+	if(readAheadEnd > last || readAheadEnd - 1 - readAheadPos > readAheadWindow / 2){
+		return;
+	}
+
+	// Submit the reads of the leaves together, so they are in flight at once
+	NonLeafNodeT* parent = (NonLeafNodeT*)index->readNode(readAheadParent);
+	std::vector<PageId> leaves;
+	for(; readAheadEnd <= last; readAheadEnd++){
+		leaves.push_back(Ops::child(parent, readAheadEnd));
 	}
+	index->releaseNode(readAheadParent);
+	index->prefetchNodes(leaves, ring);
 }
 
-// Print the whole tree
-void BTreeIndex::printTree(void){
-	Page* rootPage;
-	bufMgr->readPage(file, rootPageNum, rootPage);
-	int nonLeafNum = 0;
-	std::queue<PageId> pageQueue;
+template <class T, class Compare>
+void IndexCursor::setScanEnd(const T& highVal)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typename Ops::LeafNodeT* leaf = (typename Ops::LeafNodeT*)currentPageData;
 
-	switch(attributeType){
-		case INTEGER:{
-			NonLeafNodeInt* root = (NonLeafNodeInt*)rootPage;
-			std::cout << "root: " << rootPageNum << std::endl;
-			printNonLeafNode(rootPage);
-			for(int i = 0; i < root->numKeys + 1; i++){
-				pageQueue.push(root->pageNoArray[i]);
-			}
+	if(highOp == LT){
+		this->scanEndEntry = Ops::lowerBound(leaf, highVal);
+	}
+	else{
+		this->scanEndEntry = Ops::upperBound(leaf, highVal);
+	}
+}
 
-			if(root->level > 1){
-				nonLeafNum += root->numKeys + 1;
-			}
-			break;
-		}
-		case DOUBLE:{
-			NonLeafNodeDouble* root = (NonLeafNodeDouble*)rootPage;
-			std::cout << "root: " << rootPageNum << std::endl;
-			printNonLeafNode(rootPage);
-			for(int i = 0; i < root->numKeys + 1; i++){
-				pageQueue.push(root->pageNoArray[i]);
-			}
+// -----------------------------------------------------------------------------
+// IndexCursor::endScan
+// -----------------------------------------------------------------------------
+//
+const void IndexCursor::endScan() 
+{	
+	// If there is no scan
+	if(!scanExecuting){
+		throw ScanNotInitializedException();
+	}
 
-			if(root->level > 1){
-				nonLeafNum += root->numKeys + 1;
-			}
-			break;
+	scanExecuting = false;
+	index->releaseNode(currentPageNum);
+
+	currentPageNum = 0;
+	currentPageData = NULL;
+	nextEntry = -1;
+	readAheadParent = 0;
+}
+
+// --------------------------------------------------------------------------------
+/*
+	Helper functions
+*/
+// --------------------------------------------------------------------------------
+
+// scan the tree for the key and return the leaf's pageId, 0 if there is no leaf yet
+// with lowerBound set, a key equal to a separator goes to the left child so the first duplicate is found
+// a pageId stack of the non-leaf nodes on the traversal down the tree is returned if stack is given
+template <class T, class Compare>
+PageId BTreeIndex::findLeaf(const T& key, const bool lowerBound, std::stack<PageId>* stack)
+{
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
+
+	PageId currPageId = rootPageNum;
+
+	while(1){
+		NonLeafNodeT* currNode = (NonLeafNodeT*)readNode(currPageId);
+
+		if(stack != NULL){
+			stack->push(currPageId);
 		}
-		case STRING:{
-			NonLeafNodeString* root = (NonLeafNodeString*)rootPage;
-			std::cout << "root: " << rootPageNum << std::endl;
-			printNonLeafNode(rootPage);
-			for(int i = 0; i < root->numKeys + 1; i++){
-				pageQueue.push(root->pageNoArray[i]);
-			}
 
-			if(root->level > 1){
-				nonLeafNum += root->numKeys + 1;
-			}
-			break;
+		int i = lowerBound ? Ops::lowerBound(currNode, key) : Ops::upperBound(currNode, key);
+
+		// A level 0 root has no keys and points at the only leaf
+		PageId prevPageId = currPageId;
+		bool childIsLeaf = Ops::level(currNode) <= 1;
+		currPageId = Ops::child(currNode, i);
+
+		releaseNode(prevPageId);
+
+		if(childIsLeaf){
+			return currPageId;
 		}
 	}
-	bufMgr->unPinPage(file, rootPageNum, false);
+}
 
-	while(pageQueue.size() > 0){
-		Page* currPage;
-		PageId currPageId = pageQueue.front();
-		pageQueue.pop();
-		bufMgr->readPage(file, currPageId, currPage);
+// Return the node page, pinned in the buffer pool or pointing into the mapping of a read-only index
+Page* BTreeIndex::readNode(const PageId pageNo, BufRing* ring)
+{
+	if(mappedFile != NULL){
+		// Nodes of a read-only index are never written through
+		return const_cast<Page*>(mappedFile->mappedPage(pageNo));
+	}
 
-		switch(attributeType){
-			case INTEGER:{
-				if(nonLeafNum > 0){
-					NonLeafNodeInt* node = (NonLeafNodeInt*)currPage;
-					std::cout << "Non-leaf: " << currPageId << std::endl;
-					printNonLeafNode(currPage);
-					for(int i = 0; i < node->numKeys + 1; i++){
-						pageQueue.push(node->pageNoArray[i]);
-					}
-
-					if(node->level > 1){
-						nonLeafNum += node->numKeys + 1;
-					}
-				}
-				else{
-					std::cout << "Leaf: " << currPageId << std::endl;
-					printLeafNode(currPage);
-				}
-				break;
-			}
-			case DOUBLE:{
-				if(nonLeafNum > 0){
-					NonLeafNodeDouble* node = (NonLeafNodeDouble*)currPage;
-					std::cout << "Non-leaf: " << currPageId << std::endl;
-					printNonLeafNode(currPage);
-					for(int i = 0; i < node->numKeys + 1; i++){
-						pageQueue.push(node->pageNoArray[i]);
-					}
-
-					if(node->level > 1){
-						nonLeafNum += node->numKeys + 1;
-					}
-				}
-				else{
-					std::cout << "Leaf: " << currPageId << std::endl;
-					printLeafNode(currPage);
-				}
-				break;
-			}
-			case STRING:{
-				if(nonLeafNum > 0){
-					NonLeafNodeString* node = (NonLeafNodeString*)currPage;
-					std::cout << "Non-leaf: " << currPageId << std::endl;
-					printNonLeafNode(currPage);
-					for(int i = 0; i < node->numKeys + 1; i++){
-						pageQueue.push(node->pageNoArray[i]);
-					}
-
-					if(node->level > 1){
-						nonLeafNum += node->numKeys + 1;
-					}
-				}
-				else{
-					std::cout << "Leaf: " << currPageId << std::endl;
-					printLeafNode(currPage);
-				}
-				break;
-			}
-		}
+	Page* page;
+	bufMgr->readPage(file, pageNo, page, ring);
+	return page;
+}
 
-		bufMgr->unPinPage(file, currPageId, false);
-		nonLeafNum--;
+// Let go of a node page returned by readNode
+void BTreeIndex::releaseNode(const PageId pageNo)
+{
+	if(mappedFile == NULL){
+		bufMgr->unPinPage(file, pageNo, false);
 	}
 }
 
-// Print the non-leaf node, print both the keys and page no
-void BTreeIndex::printNonLeafNode(Page* page){
-	switch(attributeType){
-		case INTEGER:{
-			NonLeafNodeInt* node = (NonLeafNodeInt*)page;
-			std::cout << "Key array: " <<  std::endl;
-			printArray(node->keyArray, node->numKeys, 'i');
-			std::cout << "PageNo array: " << std::endl;
-			printArray(node->pageNoArray, node->numKeys+1, 'i');
-			break;
-		}
-		case DOUBLE:{
-			NonLeafNodeDouble* node = (NonLeafNodeDouble*)page;
-			std::cout << "Key array: " << std::endl;
-			printArray(node->keyArray, node->numKeys, 'd');
-			std::cout << "PageNo array: " << std::endl;
-			printArray(node->pageNoArray, node->numKeys+1, 'i');
-			break;
-		}
-		case STRING:{
-			NonLeafNodeString* node = (NonLeafNodeString*)page;
-			std::cout << "Key array: " << std::endl;
-			printArray(node->keyArray, node->numKeys, 's');
-			std::cout << "PageNo array: " << std::endl;
-			printArray(node->pageNoArray, node->numKeys+1, 'i');
-			break;
+// Start bringing the node pages in ahead of their reads
+void BTreeIndex::prefetchNodes(const std::vector<PageId>& pageNos, BufRing* ring)
+{
+	if(pageNos.empty()){
+		return;
+	}
+
+	if(mappedFile == NULL){
+		bufMgr->prefetchPages(file, &pageNos[0], (std::uint32_t)pageNos.size(), ring);
+		return;
+	}
+
+	// Leaves written by the bulk loader are consecutive, advise each run of them at once
+	size_t first = 0;
+	for(size_t i = 1; i <= pageNos.size(); i++){
+		if(i == pageNos.size() || pageNos[i] != pageNos[i - 1] + 1){
+			mappedFile->adviseWillNeed(pageNos[first], (PageId)(i - first));
+			first = i;
 		}
 	}
 }
 
-// Print the leaf node, only print the keys
-void BTreeIndex::printLeafNode(Page* page){
+// Throw if the index is read-only
+void BTreeIndex::checkWritable()
+{
+	if(mappedFile != NULL){
+		throw BadgerDbException("Index " + indexFileName + " is read-only");
+	}
+}
+
+// Allocate a page for a node, reusing a page freed by deletes if there is one
+void BTreeIndex::allocIndexPage(PageId& pageNo, Page*& page)
+{
+	Page* metadataPage;
+	bufMgr->readPage(file, headerPageNum, metadataPage);
+	IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
+
+	if(metadata->firstFreePageNo == 0){
+		bufMgr->unPinPage(file, headerPageNum, false);
+		bufMgr->allocPage(file, pageNo, page);
+		return;
+	}
+
+	// Take the first page off the free list
+	pageNo = metadata->firstFreePageNo;
+	bufMgr->readPage(file, pageNo, page);
+	metadata->firstFreePageNo = *(PageId*)page;
+	bufMgr->unPinPage(file, headerPageNum, true);
+}
+
+// Put the pinned page of a node that is no longer used on the free list, the caller unpins it dirty
+void BTreeIndex::freeIndexPage(const PageId pageNo, Page* page)
+{
+	Page* metadataPage;
+	bufMgr->readPage(file, headerPageNum, metadataPage);
+	IndexMetaInfo* metadata = (IndexMetaInfo*)metadataPage;
+
+	*(PageId*)page = metadata->firstFreePageNo;
+	metadata->firstFreePageNo = pageNo;
+	bufMgr->unPinPage(file, headerPageNum, true);
+}
+
+// Print the whole tree
+void BTreeIndex::printTree(void){
 	switch(attributeType){
-		case INTEGER:{
-			LeafNodeInt* node = (LeafNodeInt*)page;
-			printArray(node->keyArray, node->numKeys, 'i');
+		case INTEGER:
+			printNodes<int>();
 			break;
-		}
-		case DOUBLE:{
-			LeafNodeDouble* node = (LeafNodeDouble*)page;
-			printArray(node->keyArray, node->numKeys, 'd');
+		case DOUBLE:
+			printNodes<double>();
 			break;
-		}
-		case STRING:{
-			LeafNodeString* node = (LeafNodeString*)page;
-			printArray(node->keyArray, node->numKeys, 's');
+		case STRING:
+			printNodes<std::string>();
 			break;
-		}
 	}
 }
 
-// Print out the given array based on types
-void BTreeIndex::printArray(void* array, int numItems, char type){
-	switch(type){
-		case 'i':{
-			int* arr = (int*)array;
+// Print the tree level by level, the keys of every node and the page numbers of non-leaf children
+template <class T, class Compare>
+void BTreeIndex::printNodes(void){
+	typedef NodeOps<T, Compare> Ops;
+	typedef typename Ops::LeafNodeT LeafNodeT;
+	typedef typename Ops::NonLeafNodeT NonLeafNodeT;
 
-			std::cout << "[";
-			for(int i = 0; i < numItems-1; i++){
-				std::cout << arr[i] << ",";
-			}
-			std::cout << arr[numItems-1] << "] " << numItems << " items" << std::endl;
-			break;
+	// Pages in the queue together with whether they are leaves
+	std::queue<std::pair<PageId, bool> > pageQueue;
+	pageQueue.push(std::make_pair(rootPageNum, false));
+	std::cout << "root: " << rootPageNum << std::endl;
+
+	while(pageQueue.size() > 0){
+		Page* currPage;
+		PageId currPageId = pageQueue.front().first;
+		bool isLeaf = pageQueue.front().second;
+		pageQueue.pop();
+
+		if(currPageId == 0){
+			continue;
 		}
-		case 'd':{
-			double* arr = (double*)array;
+		currPage = readNode(currPageId);
+
+		if(!isLeaf){
+			NonLeafNodeT* node = (NonLeafNodeT*)currPage;
+			int numKeys = Ops::numKeys(node);
 
-			std::cout << "[";
-			for(int i = 0; i < numItems-1; i++){
-				std::cout << arr[i] << ",";
+			std::cout << "Non-leaf: " << currPageId << std::endl << "Key array: " << std::endl << "[";
+			for(int i = 0; i < numKeys; i++){
+				std::cout << (i > 0 ? "," : "") << Ops::key(node, i);
 			}
-			std::cout << arr[numItems-1] << "] " << numItems << " items" << std::endl;
-			break;
+			std::cout << "] " << numKeys << " items" << std::endl << "PageNo array: " << std::endl << "[";
+			for(int i = 0; i < numKeys + 1; i++){
+				std::cout << (i > 0 ? "," : "") << Ops::child(node, i);
+				pageQueue.push(std::make_pair(Ops::child(node, i), Ops::level(node) <= 1));
+			}
+			std::cout << "] " << numKeys + 1 << " items" << std::endl;
 		}
-		case 'c':{
-			char** arr = (char**)array;
+		else{
+			LeafNodeT* node = (LeafNodeT*)currPage;
+			int numKeys = Ops::numKeys(node);
 
-			std::cout << "[";
-			for(int i = 0; i < numItems-1; i++){
-				std::cout << arr[i] << ",";
+			std::cout << "Leaf: " << currPageId << std::endl << "[";
+			for(int i = 0; i < numKeys; i++){
+				std::cout << (i > 0 ? "," : "") << Ops::key(node, i);
 			}
-			std::cout << arr[numItems-1] << "] " << numItems << " items" << std::endl;
-
-			break;
+			std::cout << "] " << numKeys << " items" << std::endl;
 		}
+
+		releaseNode(currPageId);
 	}
 }
 
@@ -9,10 +9,13 @@
 
 #include <queue>
 #include <stack>
+#include <vector>
 #include <iostream>
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <functional>
+#include <algorithm>
 
 #include "types.h"
 #include "page.h"
@@ -44,9 +47,10 @@ enum Operator
 };
 
 /**
- * @brief Size of String key.
+ * @brief Maximum size of a STRING key in bytes. Keys are read up to the first null character
+ * and longer keys are truncated to this size.
  */
-const  int STRINGSIZE = 10;
+const  int STRINGSIZE = 255;
 
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
@@ -61,16 +65,22 @@ const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int
 const  int DOUBLEARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( double ) + sizeof( RecordId ) );
 
 /**
- * @brief Number of key slots in B+Tree leaf for STRING key.
+ * @brief Number of bytes shared by the slots and keys of a B+Tree leaf for STRING key.
  */
-//                                                    sibling ptr           key                      rid
-const  int STRINGARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( 10 * sizeof(char) + sizeof( RecordId ) );
+//                                                   numKeys       sibling ptr         prefixLength and heapOffset
+const  int STRINGLEAFDATASIZE = Page::SIZE - sizeof( int ) - sizeof( PageId ) - 2 * sizeof( unsigned short );
+
+/**
+ * @brief Maximum number of keys in B+Tree leaf for STRING key, reached when every key is the node's common prefix.
+ */
+//                                                                      rid              key offset and length
+const  int STRINGARRAYLEAFSIZE = STRINGLEAFDATASIZE / ( sizeof( RecordId ) + 2 * sizeof( unsigned short ) );
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                     level     extra pageNo                  key       pageNo
-const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
+//                                                     level     numKeys         extra pageNo                  key       pageNo
+const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
 
 /**
  * @brief Number of key slots in B+Tree leaf for DOUBLE key.
@@ -79,10 +89,31 @@ const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId )
 const  int DOUBLEARRAYNONLEAFSIZE = (( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( double ) + sizeof( PageId ) )) - 1;
 
 /**
- * @brief Number of key slots in B+Tree leaf for STRING key.
+ * @brief Number of bytes shared by the slots and keys of a B+Tree non-leaf for STRING key.
+ */
+//                                                      level         numKeys        first pageNo         prefixLength and heapOffset
+const  int STRINGNONLEAFDATASIZE = Page::SIZE - sizeof( int ) - sizeof( int ) - sizeof( PageId ) - 2 * sizeof( unsigned short );
+
+/**
+ * @brief Maximum number of keys in B+Tree non-leaf for STRING key, reached when every key is the node's common prefix.
+ */
+//                                                                            pageNo            key offset and length
+const  int STRINGARRAYNONLEAFSIZE = STRINGNONLEAFDATASIZE / ( sizeof( PageId ) + 2 * sizeof( unsigned short ) );
+
+/**
+ * @brief Default fraction of the key slots in each node that is filled when the index is bulk loaded.
+ */
+const double BULKLOADFILLFACTOR = 0.9;
+
+/**
+ * @brief Default number of key-rid pairs sorted in memory by the bulk loader before a sorted run is spilled to disk.
+ */
+const int BULKLOADRUNSIZE = 1 << 20;
+
+/**
+ * @brief Default for the most leaves a range scan reads ahead of the leaf it is on.
  */
-//                                                        level        extra pageNo             key                   pageNo
-const  int STRINGARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( 10 * sizeof(char) + sizeof( PageId ) );
+const int READAHEADLEAVES = 8;
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
@@ -94,6 +125,9 @@ public:
 	RecordId rid;
 	T key;
 
+  RIDKeyPair(){
+  }
+
   RIDKeyPair(RecordId r, T k){
     rid = r;
     key = k;
@@ -170,28 +204,37 @@ struct IndexMetaInfo{
    * Page number of root page of the B+ Tree inside the file index file.
    */
 	PageId rootPageNo;
+
+  /**
+   * Page number of the first index page freed by deletes, 0 if there is none.
+   * The first bytes of each free page hold the page number of the next one.
+   */
+	PageId firstFreePageNo;
 };
 
 /*
 Each node is a page, so once we read the page in we just cast the pointer to the page to this struct and use it to access the parts
 These structures basically are the format in which the information is stored in the pages for the index file depending on what kind of 
-node they are. The level memeber of each non leaf structure seen below is set to 1 if the nodes 
-at this level are just above the leaf nodes. Otherwise set to 0.
+node they are. The level member of each non leaf structure seen below is the height of the node above the leaves:
+1 for the nodes just above the leaf nodes, 2 for their parents and so on. A root with no keys that points at a single
+leaf, or at no leaf yet, has level 0; it becomes level 1 when it gets its first key. Nodes with level <= 1 have leaf
+children.
 */
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all non-leaf nodes. Is templated for the key type and the number of key slots.
 */
-struct NonLeafNodeInt{
+template <class T, int ARRAYSIZE>
+struct NonLeafNode{
   /**
-   * Level of the node in the tree.
+   * Height of the node above the leaves, 0 only for a root without keys.
    */
 	int level;
 
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYNONLEAFSIZE ];
+	T keyArray[ ARRAYSIZE ];
 
   /**
    * Number of keys 
@@ -201,22 +244,23 @@ struct NonLeafNodeInt{
   /**
    * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
    */
-	PageId pageNoArray[ INTARRAYNONLEAFSIZE + 1 ];
+	PageId pageNoArray[ ARRAYSIZE + 1 ];
 };
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of DOUBLE type.
+ * @brief Structure for all leaf nodes. Is templated for the key type and the number of key slots.
 */
-struct NonLeafNodeDouble{
+template <class T, int ARRAYSIZE>
+struct LeafNode{
   /**
-   * Level of the node in the tree.
+   * Stores keys.
    */
-	int level;
+	T keyArray[ ARRAYSIZE ];
 
   /**
-   * Stores keys.
+   * Stores RecordIds.
    */
-	double keyArray[ DOUBLEARRAYNONLEAFSIZE ];
+	RecordId ridArray[ ARRAYSIZE ];
 
   /**
    * Number of keys 
@@ -224,86 +268,113 @@ struct NonLeafNodeDouble{
   int numKeys;
 
   /**
-   * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
+   * Page number of the leaf on the right side.
+	 * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
    */
-	PageId pageNoArray[ DOUBLEARRAYNONLEAFSIZE + 1 ];
+	PageId rightSibPageNo;
 };
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of STRING type.
+ * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
 */
-struct NonLeafNodeString{
-  /**
-   * Level of the node in the tree.
-   */
-	int level;
+typedef NonLeafNode<int, INTARRAYNONLEAFSIZE> NonLeafNodeInt;
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of DOUBLE type.
+*/
+typedef NonLeafNode<double, DOUBLEARRAYNONLEAFSIZE> NonLeafNodeDouble;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of INTEGER type.
+*/
+typedef LeafNode<int, INTARRAYLEAFSIZE> LeafNodeInt;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of DOUBLE type.
+*/
+typedef LeafNode<double, DOUBLEARRAYLEAFSIZE> LeafNodeDouble;
 
+/**
+ * @brief Slot of a STRING leaf. The key suffix is stored at offset in the data of the node.
+*/
+struct StringLeafSlot{
   /**
-   * Stores keys.
+   * RecordId of the key.
    */
-	char keyArray[ STRINGARRAYNONLEAFSIZE ][ STRINGSIZE ];
+	RecordId rid;
 
   /**
-   * Number of keys 
+   * Offset of the key suffix in the node data.
    */
-  int numKeys;
+	unsigned short offset;
 
   /**
-   * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
+   * Number of bytes of the key after the common prefix of the node.
    */
-	PageId pageNoArray[ STRINGARRAYNONLEAFSIZE + 1 ];
+	unsigned short length;
 };
 
 /**
- * @brief Structure for all leaf nodes when the key is of INTEGER type.
+ * @brief Slot of a STRING non-leaf. The key suffix is stored at offset in the data of the node.
 */
-struct LeafNodeInt{
+struct StringNonLeafSlot{
   /**
-   * Stores keys.
+   * Page number of the child to the right of the key.
    */
-	int keyArray[ INTARRAYLEAFSIZE ];
+	PageId pageNo;
 
   /**
-   * Stores RecordIds.
+   * Offset of the key suffix in the node data.
    */
-	RecordId ridArray[ INTARRAYLEAFSIZE ];
+	unsigned short offset;
 
   /**
-   * Number of keys 
+   * Number of bytes of the key after the common prefix of the node.
    */
-  int numKeys;
-
-  /**
-   * Page number of the leaf on the right side.
-	 * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
-   */
-	PageId rightSibPageNo;
+	unsigned short length;
 };
 
+/*
+STRING nodes are slotted pages holding variable-length keys. The data starts with one slot per key in key order
+and the bytes of the keys are stored at the end of the data growing down towards the slots. The prefix shared
+by every key of the node is stored once at the very end of the data and only the remaining suffix of each key
+is kept in the key bytes. Separators in non-leaf nodes are truncated to the shortest prefix that still
+separates the two leaves when a leaf is split.
+*/
+
 /**
- * @brief Structure for all leaf nodes when the key is of DOUBLE type.
+ * @brief Structure for all non-leaf nodes when the key is of STRING type.
 */
-struct LeafNodeDouble{
+struct NonLeafNodeString{
   /**
-   * Stores keys.
+   * Height of the node above the leaves, 0 only for a root without keys.
    */
-	double keyArray[ DOUBLEARRAYLEAFSIZE ];
+	int level;
 
   /**
-   * Stores RecordIds.
+   * Number of keys 
    */
-	RecordId ridArray[ DOUBLEARRAYLEAFSIZE ];
+	int numKeys;
 
   /**
-   * Number of keys 
+   * Page number of the leftmost child, the child to the right of each key is kept in its slot.
    */
-  int numKeys;
+	PageId firstPageNo;
 
   /**
-   * Page number of the leaf on the right side.
-	 * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
+   * Length of the common prefix of the keys, stored at the end of data.
    */
-	PageId rightSibPageNo;
+	unsigned short prefixLength;
+
+  /**
+   * Offset of the lowest key byte in data. Free space lies between the slots and heapOffset.
+   */
+	unsigned short heapOffset;
+
+  /**
+   * Slots followed by free space and the key bytes.
+   */
+	char data[ STRINGNONLEAFDATASIZE ];
 };
 
 /**
@@ -311,82 +382,107 @@ struct LeafNodeDouble{
 */
 struct LeafNodeString{
   /**
-   * Stores keys.
+   * Number of keys 
    */
-	char keyArray[ STRINGARRAYLEAFSIZE ][ STRINGSIZE ];
+	int numKeys;
 
   /**
-   * Stores RecordIds.
+   * Page number of the leaf on the right side.
    */
-	RecordId ridArray[ STRINGARRAYLEAFSIZE ];
+	PageId rightSibPageNo;
 
   /**
-   * Number of keys 
+   * Length of the common prefix of the keys, stored at the end of data.
    */
-  int numKeys;
+	unsigned short prefixLength;
 
   /**
-   * Page number of the leaf on the right side.
-	 * This linking of leaves allows to easily move from one leaf to the next leaf during index scan.
+   * Offset of the lowest key byte in data. Free space lies between the slots and heapOffset.
    */
-	PageId rightSibPageNo;
+	unsigned short heapOffset;
+
+  /**
+   * Slots followed by free space and the key bytes.
+   */
+	char data[ STRINGLEAFDATASIZE ];
 };
 
+static_assert(sizeof(NonLeafNodeInt) <= Page::SIZE && sizeof(LeafNodeInt) <= Page::SIZE,
+              "INTEGER nodes must fit in a page.");
+static_assert(sizeof(NonLeafNodeDouble) <= Page::SIZE && sizeof(LeafNodeDouble) <= Page::SIZE,
+              "DOUBLE nodes must fit in a page.");
+static_assert(sizeof(StringLeafSlot) == sizeof(RecordId) + 2 * sizeof(unsigned short) &&
+              sizeof(StringNonLeafSlot) == sizeof(PageId) + 2 * sizeof(unsigned short),
+              "STRING slots must match the STRING node sizes.");
+static_assert(sizeof(NonLeafNodeString) <= Page::SIZE && sizeof(LeafNodeString) <= Page::SIZE,
+              "STRING nodes must fit in a page.");
+
 /**
- * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
- * relation. This index supports only one scan at a time.
+ * @brief Maps a key type to the node structures that store it. The tree algorithms in
+ * BTreeIndex are templated on the key type and look their node layout up here.
 */
-class BTreeIndex {
+template <class T>
+struct KeyTraits;
 
- private:
+template <>
+struct KeyTraits<int>{
+	typedef LeafNodeInt LeafNodeType;
+	typedef NonLeafNodeInt NonLeafNodeType;
 
-  /**
-   * File object for the index file.
-   */
-	File		*file;
+	// Fewest bytes a record must have from the key offset on to hold a key
+	static const size_t minKeySize = sizeof(int);
 
-  /**
-   * File object for the index file.
-   */
-  std::string indexFileName;  
+	// Read the key stored at data, size is the number of bytes available there
+	static int readKey(const char* data, const size_t size)
+	{
+		return *(const int*)data;
+	}
+};
 
-  /**
-   * Buffer Manager Instance.
-   */
-	BufMgr	*bufMgr;
+template <>
+struct KeyTraits<double>{
+	typedef LeafNodeDouble LeafNodeType;
+	typedef NonLeafNodeDouble NonLeafNodeType;
 
-  /**
-   * Page number of meta page.
-   */
-	PageId	headerPageNum;
+	static const size_t minKeySize = sizeof(double);
 
-  /**
-   * page number of root page of B+ tree inside index file.
-   */
-	PageId	rootPageNum;
+	static double readKey(const char* data, const size_t size)
+	{
+		return *(const double*)data;
+	}
+};
 
-  /**
-   * Datatype of attribute over which index is built.
-   */
-	Datatype	attributeType;
+template <>
+struct KeyTraits<std::string>{
+	typedef LeafNodeString LeafNodeType;
+	typedef NonLeafNodeString NonLeafNodeType;
 
-  /**
-   * Offset of attribute, over which index is built, inside records. 
-   */
-	int 		attrByteOffset;
+	// A string key may be cut short by the end of the record
+	static const size_t minKeySize = 0;
 
-  /**
-   * Number of keys in leaf node, depending upon the type of key.
-   */
-	int			leafOccupancy;
+	// The key ends at the first null character, at size or at STRINGSIZE
+	static std::string readKey(const char* data, const size_t size)
+	{
+		return std::string(data, strnlen(data, std::min(size, (size_t)STRINGSIZE)));
+	}
+};
 
-  /**
-   * Number of keys in non-leaf node, depending upon the type of key.
-   */
-	int			nodeOccupancy;
+class BTreeIndex;
 
+/**
+ * @brief IndexCursor class. A range scan over a BTreeIndex with its own bounds and its own
+ * pinned leaf page, so many scans (for example both sides of a nested-loop join over one index)
+ * can be open on the same index at once.
+ * The index must not be modified or destroyed while the cursor has a scan open.
+*/
+class IndexCursor {
 
-	// MEMBERS SPECIFIC TO SCANNING
+ private:
+
+  /**
+   * Index being scanned.
+   */
+	BTreeIndex	*index;
 
   /**
    * True if an index scan has been started.
@@ -398,6 +494,11 @@ class BTreeIndex {
    */
 	int			nextEntry;
 
+  /**
+   * Index one past the last entry of the current leaf that is within the scan range.
+   */
+	int			scanEndEntry;
+
   /**
    * Page number of current page being scanned.
    */
@@ -448,55 +549,308 @@ class BTreeIndex {
    */
 	Operator	highOp;
 
-  // scan the tree for the key
-  // return the leaf's pageId
-  // the leaf's right sibling pageId, if there's no sibling, return 0
-  // a pageId stack of the traversal down the tree
-  void scanTree(void* key, PageId& pageId, PageId& rightPageId, std::stack<PageId>* stack);
+  /**
+   * Most leaves read ahead of the leaf being scanned, 0 turns read-ahead off.
+   */
+	int			readAheadMax;
+
+  /**
+   * Number of leaves currently read ahead. Starts at one and doubles, up to readAheadMax, each time the
+   * scan moves onto a leaf that was read ahead.
+   */
+	int			readAheadWindow;
+
+  /**
+   * Parent of the leaf being scanned, 0 while the scan is not reading ahead.
+   */
+	PageId	readAheadParent;
+
+  /**
+   * Child index of the leaf being scanned in readAheadParent.
+   */
+	int			readAheadPos;
+
+  /**
+   * Children of readAheadParent before this index have been read ahead.
+   */
+	int			readAheadEnd;
 
-  // scan the tree for the key and return the pageId
-  void scanTree(void* key, PageId& pageId);
+  /**
+   * Last child of readAheadParent that may hold keys within the scan range.
+   */
+	int			readAheadLast;
 
-  // Swap x PageKeyPair with y PageKeyPair if x < y
-  void swapPageKeyPair(void* x, void* y);
+  /**
+   * True if readAheadLast is the last child of readAheadParent, so the range may go on under the next parent.
+   */
+	bool		readAheadMore;
 
-  // Swap x RIDKeyPair with y RIDKeyPair if x < y
-  void swapRIDKeyPair(void* x, void* y);
+  /**
+   * Ring of frames the leaves of the scan are read through, NULL to read them through the whole buffer pool.
+   */
+	BufRing	*ring;
 
-  // Sort the key array and pageNo array
-  void insertNonLeafArray(void* array, void* pageArray, int& numItems, void* pageKey);
+  // Set up the scan variables for a scan starting at lowVal
+  template <class T, class Compare = std::less<T> >
+  void startScanRange(const T& lowVal, const T& highVal);
 
-  // Sort the key array and Rid array
-  void insertLeafArray(void* array, void* ridArray, int& numItems, void* ridKey);
+  // Return the next record id of the scan ending at highVal
+  template <class T, class Compare = std::less<T> >
+  void scanNextEntry(RecordId& outRid, const T& highVal);
 
-  // Print tree
-  void printTree(void);
+  // Copy up to maxRids record ids of the scan ending at highVal, return how many were copied
+  template <class T, class Compare = std::less<T> >
+  size_t scanNextRun(RecordId* outRids, const size_t maxRids, const T& highVal);
+
+  // Move the scan from its exhausted leaf to the right sibling, or mark it finished if there is none
+  template <class T, class Compare>
+  void nextLeaf(const T& highVal);
+
+  // Set scanEndEntry for the current leaf of the scan
+  template <class T, class Compare>
+  void setScanEnd(const T& highVal);
 
-  // Print non-leaf node
-  void printNonLeafNode(Page* page);
+  // Find the parent of the current leaf and start reading ahead the leaves after it that may be in range
+  template <class T, class Compare>
+  void startReadAhead(const T& highVal);
 
-  // Print out the leaf node
-  void printLeafNode(Page* page);
+  // Read the next leaves of readAheadParent into the buffer pool once half of the window has been scanned
+  template <class T, class Compare>
+  void readAhead();
 
-  // Print out the array given, type = (i = int, d = double, c = string)
-  void printArray(void* array, int numItems, char type);
+  // Cursors hold a pinned page and are not copied
+  IndexCursor(const IndexCursor&);
+  IndexCursor& operator=(const IndexCursor&);
+
+ public:
+
+  /**
+   * IndexCursor Constructor. No scan is open until startScan is called.
+   *
+   * @param indexIn		Index to scan
+   */
+	IndexCursor(BTreeIndex* indexIn);
+
+  /**
+   * IndexCursor Destructor. Ends the scan if one is still open, unpinning its page.
+   */
+	~IndexCursor();
+
+  /**
+	 * Begin a filtered scan of the index.  For instance, if the method is called 
+	 * using ("a",GT,"d",LTE) then we should seek all entries with a value 
+	 * greater than "a" and less than or equal to "d".
+	 * A scan that is already open on this cursor is ended first.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	const void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	const void scanNext(RecordId& outRid);
+
+  /**
+	 * Fetch the record ids of the next index entries that match the scan, crossing into right siblings as
+	 * needed. The entries of a leaf that are in range are copied in one loop, and the end of the scan is
+	 * reported by the return value instead of an exception.
+   * @param outRids	Array receiving the record ids
+   * @param maxRids	Number of record ids outRids has room for
+   * @return Number of record ids copied, 0 once the scan has no more entries (or maxRids is 0)
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	size_t scanNextBatch(RecordId* outRids, const size_t maxRids);
+
+  /**
+	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	const void endScan();
+
+  /**
+   * Set the most leaves a scan reads ahead of the leaf it is on. Leaves past the high end of the range are
+   * never read ahead.
+   *
+   * @param maxLeaves		Most leaves to read ahead, 0 turns read-ahead off
+   */
+	void setReadAhead(const int maxLeaves) { readAheadMax = maxLeaves > 0 ? maxLeaves : 0; }
+
+  /**
+   * Read the leaves of later scans through a BufRing, so a long range scan recycles a few frames instead of
+   * pushing other pages out of the buffer pool. Inner nodes are read as usual. The ring should have more frames
+   * than the scan reads ahead, or leaves read ahead are recycled before they are reached.
+   *
+   * @param frames		Number of frames in the ring, 0 reads the leaves through the whole buffer pool
+   */
+	void setBufRing(const std::uint32_t frames);
+
+  /**
+   * True if a scan is open on this cursor.
+   */
+	bool isScanning() const { return scanExecuting; }
+};
+
+/**
+ * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
+ * relation. The index runs one scan of its own through startScan, any number of further
+ * scans can run at the same time through IndexCursor objects.
+*/
+class BTreeIndex {
+
+	friend class IndexCursor;
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	File		*file;
+
+  /**
+   * File object for the index file.
+   */
+  std::string indexFileName;  
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Page number of meta page.
+   */
+	PageId	headerPageNum;
+
+  /**
+   * page number of root page of B+ tree inside index file.
+   */
+	PageId	rootPageNum;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records. 
+   */
+	int 		attrByteOffset;
+
+  /**
+   * Number of keys in leaf node, depending upon the type of key.
+   */
+	int			leafOccupancy;
+
+  /**
+   * Number of keys in non-leaf node, depending upon the type of key.
+   */
+	int			nodeOccupancy;
+
+  /**
+   * Fraction of the key slots in each node filled by the bulk loader.
+   */
+	double	fillFactor;
+
+  /**
+   * Number of key-rid pairs the bulk loader sorts in memory before spilling a run to disk.
+   */
+	int			sortRunSize;
+
+
+	// MEMBERS SPECIFIC TO SCANNING
+
+  /**
+   * Cursor behind startScan, scanNext and endScan of the index itself.
+   */
+	IndexCursor	scanCursor;
+
+  /**
+   * The index file while it is mapped read-only, NULL while nodes are read through the buffer pool.
+   */
+	BlobFile	*mappedFile;
+
+  // Build the tree bottom-up from the sorted key-rid pairs of the relation
+  template <class T, class Compare = std::less<T> >
+  void bulkLoad(const std::string & relationName);
+
+  // Insert the key-rid pair, splitting nodes on the way back up as needed
+  template <class T, class Compare = std::less<T> >
+  void insertKey(const T& key, const RecordId rid);
+
+  // Delete the key-rid pair and shrink the tree from the root if it lost a level
+  template <class T, class Compare = std::less<T> >
+  void deleteKey(const T& key, const RecordId rid);
+
+  // Delete the key-rid pair from the subtree under the pinned non-leaf node, return false if it is not there.
+  // Children left less than half full are merged with or borrow from a sibling.
+  template <class T, class Compare>
+  bool removeEntry(typename KeyTraits<T>::NonLeafNodeType* node, const T& key, const RecordId rid);
+
+  // Merge child i of the pinned non-leaf node with a sibling, or move entries over from the sibling
+  template <class T, class Compare>
+  void rebalanceChild(typename KeyTraits<T>::NonLeafNodeType* node, const int i);
+
+  // Allocate a page for a node, reusing a page freed by deletes if there is one
+  void allocIndexPage(PageId& pageNo, Page*& page);
+
+  // Put the pinned page of a node that is no longer used on the free list
+  void freeIndexPage(const PageId pageNo, Page* page);
+
+  // scan the tree for the key and return the leaf's pageId, 0 if there is no leaf yet
+  // with lowerBound set, a key equal to a separator goes to the left child so the first duplicate is found
+  // a pageId stack of the non-leaf nodes on the traversal down the tree is returned if stack is given
+  template <class T, class Compare>
+  PageId findLeaf(const T& key, const bool lowerBound, std::stack<PageId>* stack);
+
+  // Return the node page, pinned in the buffer pool or pointing into the mapping of a read-only index
+  Page* readNode(const PageId pageNo, BufRing* ring = NULL);
+
+  // Let go of a node page returned by readNode
+  void releaseNode(const PageId pageNo);
+
+  // Start bringing the node pages in ahead of their reads
+  void prefetchNodes(const std::vector<PageId>& pageNos, BufRing* ring);
+
+  // Throw if the index is read-only
+  void checkWritable();
+
+  // Print tree
+  void printTree(void);
+
+  // Print every node of the tree level by level
+  template <class T, class Compare = std::less<T> >
+  void printNodes(void);
 
  public:
 
   /**
    * BTreeIndex Constructor. 
 	 * Check to see if the corresponding index file exists. If so, open the file.
-	 * If not, create it and insert entries for every tuple in the base relation using FileScan class.
+	 * If not, create it and bulk load entries for every tuple in the base relation using FileScan class.
+	 * The (key, rid) pairs are sorted (spilling sorted runs to temporary files when there are more than
+	 * sortRunSizeIn of them) and the leaf and non-leaf pages are then written left-to-right.
    *
    * @param relationName        Name of file.
    * @param outIndexName        Return the name of index file.
    * @param bufMgrIn						Buffer Manager Instance
    * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
    * @param attrType						Datatype of attribute over which index is built
+   * @param fillFactorIn				Fraction of each node filled by the bulk loader, in (0, 1]
+   * @param sortRunSizeIn				Number of key-rid pairs sorted in memory before a run is spilled to disk
    * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
    */
 	BTreeIndex(const std::string & relationName, std::string & outIndexName,
-						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const double fillFactorIn = BULKLOADFILLFACTOR, const int sortRunSizeIn = BULKLOADRUNSIZE);
 	
 
   /**
@@ -516,15 +870,32 @@ class BTreeIndex {
 	 * Make sure to unpin pages as soon as you can.
    * @param key			Key to insert, pointer to integer/double/char string
    * @param rid			Record ID of a record whose entry is getting inserted into the index.
+	 * @throws BadgerDbException If the index is read-only.
 	**/
 	const void insertEntry(const void* key, const RecordId rid);
 
 
+  /**
+	 * Delete the entry <value,rid>.
+	 * Start from root to find the leaf holding the entry and remove it. A node left less than half full
+	 * is merged with a sibling when both fit in one node, otherwise entries are moved over from the sibling.
+	 * Merging removes a key from the parent, which may in turn be rebalanced, and the root is dropped
+	 * when it is left with a single child. Pages of merged nodes are kept on a free list in the index file
+	 * and reused by later inserts.
+   * @param key			Key to delete, pointer to integer/double/char string
+   * @param rid			Record ID of the record whose entry is getting deleted from the index.
+	 * @throws NoSuchKeyFoundException If the index has no entry <value,rid>.
+	 * @throws BadgerDbException If the index is read-only.
+	**/
+	const void deleteEntry(const void* key, const RecordId rid);
+
+
   /**
 	 * Begin a filtered scan of the index.  For instance, if the method is called 
 	 * using ("a",GT,"d",LTE) then we should seek all entries with a value 
 	 * greater than "a" and less than or equal to "d".
-	 * If another scan is already executing, that needs to be ended here.
+	 * If another scan is already executing, that needs to be ended here. Scans that should stay open
+	 * at the same time each need their own IndexCursor.
 	 * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
 	 * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
    * @param lowVal	Low value of range, pointer to integer / double / char string
@@ -547,12 +918,52 @@ class BTreeIndex {
 	**/
 	const void scanNext(RecordId& outRid);  // returned record id
 
+  /**
+	 * Fetch the record ids of the next index entries that match the scan, crossing into right siblings as
+	 * needed. The entries of a leaf that are in range are copied in one loop, and the end of the scan is
+	 * reported by the return value instead of an exception.
+   * @param outRids	Array receiving the record ids
+   * @param maxRids	Number of record ids outRids has room for
+   * @return Number of record ids copied, 0 once the scan has no more entries (or maxRids is 0)
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	size_t scanNextBatch(RecordId* outRids, const size_t maxRids);
+
 
   /**
 	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	**/
 	const void endScan();
+
+
+  /**
+	 * Set the most leaves the scan started by startScan reads ahead of the leaf it is on.
+	 * @param maxLeaves		Most leaves to read ahead, 0 turns read-ahead off
+	**/
+	void setReadAhead(const int maxLeaves) { scanCursor.setReadAhead(maxLeaves); }
+
+  /**
+	 * Read the leaves of the scans started by startScan through a BufRing of the given number of frames.
+	 * @param frames		Number of frames in the ring, 0 reads the leaves through the whole buffer pool
+	**/
+	void setBufRing(const std::uint32_t frames) { scanCursor.setBufRing(frames); }
+
+  /**
+	 * Make the index read-only and serve its node reads straight from a read-only mapping of the index file,
+	 * or go back to reading them through the buffer pool. While read-only, lookups and scans use no buffer
+	 * frames and copy no pages, and the leaves a scan reads ahead are only advised to the operating system.
+	 * The pages of the index are flushed out of the buffer pool when it becomes read-only.
+	 * The scan started by startScan is ended, and no IndexCursor may have a scan open.
+   * @param readOnly	True to map the index file, false to unmap it
+	 * @throws BadgerDbException If the index file cannot be mapped.
+	**/
+	void setReadOnly(const bool readOnly);
+
+  /**
+	 * True if the index is read-only, see setReadOnly.
+	**/
+	bool isReadOnly() const { return mappedFile != NULL; }
 	
 };
 
@@ -0,0 +1,679 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <cstring>
+#include "btree_node.h"
+#include "exceptions/badgerdb_exception.h"
+
+namespace badgerdb
+{
+
+typedef NodeOps<std::string, std::less<std::string> > StringNodeOps;
+
+namespace
+{
+
+// -----------------------------------------------------------------------------
+// Slotted node helpers shared by STRING leaves and non-leaves
+// -----------------------------------------------------------------------------
+
+// Compare two byte strings the way std::string does
+int compareBytes(const char* a, const size_t aLength, const char* b, const size_t bLength)
+{
+	int c = std::memcmp(a, b, std::min(aLength, bLength));
+	if(c != 0){
+		return c;
+	}
+	return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+}
+
+size_t commonPrefix(const std::string& a, const std::string& b)
+{
+	size_t n = std::min(a.size(), b.size());
+	size_t i = 0;
+	while(i < n && a[i] == b[i]){
+		i++;
+	}
+	return i;
+}
+
+template <class NodeT, class SlotT>
+SlotT* slotArray(NodeT* node)
+{
+	return (SlotT*)node->data;
+}
+
+template <class NodeT, class SlotT>
+const SlotT* slotArray(const NodeT* node)
+{
+	return (const SlotT*)node->data;
+}
+
+// The common prefix of the node is kept at the very end of its data
+template <class NodeT>
+const char* prefixData(const NodeT* node)
+{
+	return node->data + sizeof(node->data) - node->prefixLength;
+}
+
+template <class NodeT>
+void initSlots(NodeT* node)
+{
+	node->numKeys = 0;
+	node->prefixLength = 0;
+	node->heapOffset = sizeof(node->data);
+}
+
+template <class NodeT, class SlotT>
+std::string keyAt(const NodeT* node, const int i)
+{
+	const SlotT& slot = slotArray<NodeT, SlotT>(node)[i];
+	std::string key(prefixData(node), node->prefixLength);
+	key.append(node->data + slot.offset, slot.length);
+	return key;
+}
+
+// Number of keys in the node that are less than the key, or less than or equal to it with upper set
+template <class NodeT, class SlotT>
+int searchKeys(const NodeT* node, const std::string& key, const bool upper)
+{
+	size_t prefixLength = node->prefixLength;
+
+	// Keys not starting with the prefix of the node come before or after all of its keys
+	int c = std::memcmp(key.data(), prefixData(node), std::min(key.size(), prefixLength));
+	if(c < 0 || (c == 0 && key.size() < prefixLength)){
+		return 0;
+	}
+	if(c > 0){
+		return node->numKeys;
+	}
+
+	const char* rest = key.data() + prefixLength;
+	size_t restLength = key.size() - prefixLength;
+	const SlotT* slots = slotArray<NodeT, SlotT>(node);
+	const SlotT* base = slots;
+	int n = node->numKeys;
+
+	// Every slot before base comes before the key, every slot from base + n on does not
+	while(n > 1){
+		int half = n / 2;
+		c = compareBytes(node->data + base[half].offset, base[half].length, rest, restLength);
+		base = (upper ? c <= 0 : c < 0) ? base + half : base;
+		n -= half;
+	}
+	if(n == 1){
+		c = compareBytes(node->data + base->offset, base->length, rest, restLength);
+		if(upper ? c <= 0 : c < 0){
+			base++;
+		}
+	}
+	return (int)(base - slots);
+}
+
+template <class NodeT, class SlotT>
+void decodeNode(const NodeT* node, std::vector<std::string>& keys, std::vector<SlotT>& slots)
+{
+	const SlotT* nodeSlots = slotArray<NodeT, SlotT>(node);
+	keys.resize(node->numKeys);
+	slots.assign(nodeSlots, nodeSlots + node->numKeys);
+	for(int i = 0; i < node->numKeys; i++){
+		keys[i] = keyAt<NodeT, SlotT>(node, i);
+	}
+}
+
+// Bytes needed by the slots and compressed keys [begin, end), which are sorted
+template <class SlotT>
+size_t encodedSize(const std::vector<std::string>& keys, const size_t begin, const size_t end)
+{
+	if(begin == end){
+		return 0;
+	}
+
+	size_t prefixLength = commonPrefix(keys[begin], keys[end-1]);
+	size_t size = prefixLength;
+	for(size_t i = begin; i < end; i++){
+		size += keys[i].size() - prefixLength + sizeof(SlotT);
+	}
+	return size;
+}
+
+// Write the sorted keys [begin, end) and their slots into the node, compacting the key bytes
+template <class NodeT, class SlotT>
+void encodeNode(NodeT* node, const std::vector<std::string>& keys, const std::vector<SlotT>& slots,
+                const size_t begin, const size_t end)
+{
+	if(encodedSize<SlotT>(keys, begin, end) > sizeof(node->data)){
+		throw BadgerDbException("STRING keys do not fit in a B+ tree node");
+	}
+
+	size_t prefixLength = begin == end ? 0 : commonPrefix(keys[begin], keys[end-1]);
+	size_t top = sizeof(node->data) - prefixLength;
+	if(prefixLength > 0){
+		std::memcpy(node->data + top, keys[begin].data(), prefixLength);
+	}
+
+	SlotT* nodeSlots = slotArray<NodeT, SlotT>(node);
+	for(size_t i = begin; i < end; i++){
+		size_t length = keys[i].size() - prefixLength;
+		top -= length;
+		std::memcpy(node->data + top, keys[i].data() + prefixLength, length);
+
+		nodeSlots[i-begin] = slots[i];
+		nodeSlots[i-begin].offset = top;
+		nodeSlots[i-begin].length = length;
+	}
+
+	node->numKeys = end - begin;
+	node->prefixLength = prefixLength;
+	node->heapOffset = top;
+}
+
+// Insert the key with the payload of slot as slot i, return false if the node is full
+template <class NodeT, class SlotT>
+bool insertSlot(NodeT* node, const int i, const std::string& key, const SlotT& slot)
+{
+	size_t prefixLength = node->prefixLength;
+	int numKeys = node->numKeys;
+
+	// Fast path, the key keeps the prefix of the node and there is room below the key bytes
+	if(numKeys > 0 && key.size() >= prefixLength && std::memcmp(key.data(), prefixData(node), prefixLength) == 0){
+		size_t length = key.size() - prefixLength;
+		size_t slotsEnd = (numKeys + 1) * sizeof(SlotT);
+
+		if(slotsEnd + length <= node->heapOffset){
+			size_t top = node->heapOffset - length;
+			std::memcpy(node->data + top, key.data() + prefixLength, length);
+
+			SlotT* slots = slotArray<NodeT, SlotT>(node);
+			std::memmove(slots + i + 1, slots + i, (numKeys - i) * sizeof(SlotT));
+			slots[i] = slot;
+			slots[i].offset = top;
+			slots[i].length = length;
+
+			node->numKeys++;
+			node->heapOffset = top;
+			return true;
+		}
+	}
+
+	// Otherwise rebuild the node with a new prefix and without holes
+	std::vector<std::string> keys;
+	std::vector<SlotT> slots;
+	decodeNode(node, keys, slots);
+	keys.insert(keys.begin() + i, key);
+	slots.insert(slots.begin() + i, slot);
+
+	if(encodedSize<SlotT>(keys, 0, keys.size()) > sizeof(node->data)){
+		return false;
+	}
+	encodeNode(node, keys, slots, 0, keys.size());
+	return true;
+}
+
+// Remove slot i, its key bytes are left behind until the node is next rebuilt
+template <class NodeT, class SlotT>
+void removeSlot(NodeT* node, const int i)
+{
+	SlotT* slots = slotArray<NodeT, SlotT>(node);
+	std::memmove(slots + i, slots + i + 1, (node->numKeys - i - 1) * sizeof(SlotT));
+	node->numKeys--;
+
+	if(node->numKeys == 0){
+		initSlots(node);
+	}
+}
+
+// Bytes used by the slots and the key bytes still referenced by them
+template <class NodeT, class SlotT>
+size_t usedBytes(const NodeT* node)
+{
+	const SlotT* slots = slotArray<NodeT, SlotT>(node);
+	size_t size = node->prefixLength + node->numKeys * sizeof(SlotT);
+	for(int i = 0; i < node->numKeys; i++){
+		size += slots[i].length;
+	}
+	return size;
+}
+
+// Replace the key of slot i keeping the keys in order, return false if the node is full
+template <class NodeT, class SlotT>
+bool replaceSlotKey(NodeT* node, const int i, const std::string& key)
+{
+	size_t prefixLength = node->prefixLength;
+	SlotT* slots = slotArray<NodeT, SlotT>(node);
+
+	// Fast path, the key keeps the prefix and fits over the old key or below the key bytes
+	if(key.size() >= prefixLength && std::memcmp(key.data(), prefixData(node), prefixLength) == 0){
+		size_t length = key.size() - prefixLength;
+
+		if(length <= slots[i].length){
+			std::memcpy(node->data + slots[i].offset, key.data() + prefixLength, length);
+			slots[i].length = length;
+			return true;
+		}
+		if(node->numKeys * sizeof(SlotT) + length <= node->heapOffset){
+			size_t top = node->heapOffset - length;
+			std::memcpy(node->data + top, key.data() + prefixLength, length);
+			slots[i].offset = top;
+			slots[i].length = length;
+			node->heapOffset = top;
+			return true;
+		}
+	}
+
+	std::vector<std::string> keys;
+	std::vector<SlotT> nodeSlots;
+	decodeNode(node, keys, nodeSlots);
+	keys[i] = key;
+
+	if(encodedSize<SlotT>(keys, 0, keys.size()) > sizeof(node->data)){
+		return false;
+	}
+	encodeNode(node, keys, nodeSlots, 0, keys.size());
+	return true;
+}
+
+// Choose where to split the sorted keys so the larger of the two compressed halves is as small as possible.
+// Keys [0, k) go left and keys [k + gap, n) go right, gap is 1 when the key at k moves up into the parent.
+template <class SlotT>
+size_t chooseSplit(const std::vector<std::string>& keys, const size_t gap)
+{
+	size_t n = keys.size();
+	std::vector<size_t> lengthSum(n + 1, 0);
+	for(size_t i = 0; i < n; i++){
+		lengthSum[i+1] = lengthSum[i] + keys[i].size();
+	}
+
+	size_t best = n / 2;
+	size_t bestSize = (size_t)-1;
+	for(size_t k = 1; k + gap < n; k++){
+		size_t leftPrefix = commonPrefix(keys[0], keys[k-1]);
+		size_t leftSize = leftPrefix + lengthSum[k] - k * leftPrefix + k * sizeof(SlotT);
+
+		size_t r = k + gap;
+		size_t rightPrefix = commonPrefix(keys[r], keys[n-1]);
+		size_t rightSize = rightPrefix + lengthSum[n] - lengthSum[r] - (n - r) * rightPrefix + (n - r) * sizeof(SlotT);
+
+		if(std::max(leftSize, rightSize) < bestSize){
+			bestSize = std::max(leftSize, rightSize);
+			best = k;
+		}
+	}
+	return best;
+}
+
+}
+
+// -----------------------------------------------------------------------------
+// STRING leaf nodes
+// -----------------------------------------------------------------------------
+
+void StringNodeOps::initLeaf(LeafNodeT* node)
+{
+	initSlots(node);
+	node->rightSibPageNo = 0;
+}
+
+int StringNodeOps::numKeys(const LeafNodeT* node)
+{
+	return node->numKeys;
+}
+
+PageId StringNodeOps::rightSib(const LeafNodeT* node)
+{
+	return node->rightSibPageNo;
+}
+
+void StringNodeOps::setRightSib(LeafNodeT* node, const PageId pageNo)
+{
+	node->rightSibPageNo = pageNo;
+}
+
+std::string StringNodeOps::key(const LeafNodeT* node, const int i)
+{
+	return keyAt<LeafNodeT, StringLeafSlot>(node, i);
+}
+
+RecordId StringNodeOps::rid(const LeafNodeT* node, const int i)
+{
+	return slotArray<LeafNodeT, StringLeafSlot>(node)[i].rid;
+}
+
+int StringNodeOps::lowerBound(const LeafNodeT* node, const std::string& key)
+{
+	return searchKeys<LeafNodeT, StringLeafSlot>(node, key, false);
+}
+
+int StringNodeOps::upperBound(const LeafNodeT* node, const std::string& key)
+{
+	return searchKeys<LeafNodeT, StringLeafSlot>(node, key, true);
+}
+
+bool StringNodeOps::insert(LeafNodeT* node, const std::string& key, const RecordId rid)
+{
+	StringLeafSlot slot;
+	slot.rid = rid;
+	return insertSlot(node, upperBound(node, key), key, slot);
+}
+
+void StringNodeOps::split(LeafNodeT* node, LeafNodeT* newNode, const std::string& key, const RecordId rid, std::string& sepKey)
+{
+	std::vector<std::string> keys;
+	std::vector<StringLeafSlot> slots;
+	decodeNode(node, keys, slots);
+
+	int i = upperBound(node, key);
+	StringLeafSlot slot;
+	slot.rid = rid;
+	keys.insert(keys.begin() + i, key);
+	slots.insert(slots.begin() + i, slot);
+
+	size_t k = chooseSplit<StringLeafSlot>(keys, 0);
+	encodeNode(node, keys, slots, 0, k);
+	encodeNode(newNode, keys, slots, k, keys.size());
+
+	sepKey = separator(keys[k-1], keys[k]);
+}
+
+void StringNodeOps::remove(LeafNodeT* node, const int i)
+{
+	removeSlot<LeafNodeT, StringLeafSlot>(node, i);
+}
+
+bool StringNodeOps::underflow(const LeafNodeT* node)
+{
+	return usedBytes<LeafNodeT, StringLeafSlot>(node) < STRINGLEAFDATASIZE / 2;
+}
+
+void StringNodeOps::getEntries(const LeafNodeT* node, std::vector<std::string>& keys, std::vector<RecordId>& rids)
+{
+	std::vector<StringLeafSlot> slots;
+	decodeNode(node, keys, slots);
+
+	rids.resize(slots.size());
+	for(size_t i = 0; i < slots.size(); i++){
+		rids[i] = slots[i].rid;
+	}
+}
+
+bool StringNodeOps::leafFits(const std::vector<std::string>& keys, const size_t begin, const size_t end)
+{
+	return encodedSize<StringLeafSlot>(keys, begin, end) <= STRINGLEAFDATASIZE;
+}
+
+size_t StringNodeOps::leafSplitPoint(const std::vector<std::string>& keys)
+{
+	return chooseSplit<StringLeafSlot>(keys, 0);
+}
+
+void StringNodeOps::setEntries(LeafNodeT* node, const std::vector<std::string>& keys, const std::vector<RecordId>& rids,
+                               const size_t begin, const size_t end)
+{
+	std::vector<StringLeafSlot> slots(keys.size());
+	for(size_t i = begin; i < end; i++){
+		slots[i].rid = rids[i];
+	}
+	encodeNode(node, keys, slots, begin, end);
+}
+
+// -----------------------------------------------------------------------------
+// STRING non-leaf nodes
+// -----------------------------------------------------------------------------
+
+void StringNodeOps::initNonLeaf(NonLeafNodeT* node, const int level, const PageId firstPageNo)
+{
+	initSlots(node);
+	node->level = level;
+	node->firstPageNo = firstPageNo;
+}
+
+int StringNodeOps::level(const NonLeafNodeT* node)
+{
+	return node->level;
+}
+
+void StringNodeOps::setLevel(NonLeafNodeT* node, const int level)
+{
+	node->level = level;
+}
+
+int StringNodeOps::numKeys(const NonLeafNodeT* node)
+{
+	return node->numKeys;
+}
+
+std::string StringNodeOps::key(const NonLeafNodeT* node, const int i)
+{
+	return keyAt<NonLeafNodeT, StringNonLeafSlot>(node, i);
+}
+
+PageId StringNodeOps::child(const NonLeafNodeT* node, const int i)
+{
+	if(i == 0){
+		return node->firstPageNo;
+	}
+	return slotArray<NonLeafNodeT, StringNonLeafSlot>(node)[i-1].pageNo;
+}
+
+void StringNodeOps::setChild(NonLeafNodeT* node, const int i, const PageId pageNo)
+{
+	if(i == 0){
+		node->firstPageNo = pageNo;
+	}
+	else{
+		slotArray<NonLeafNodeT, StringNonLeafSlot>(node)[i-1].pageNo = pageNo;
+	}
+}
+
+int StringNodeOps::lowerBound(const NonLeafNodeT* node, const std::string& key)
+{
+	return searchKeys<NonLeafNodeT, StringNonLeafSlot>(node, key, false);
+}
+
+int StringNodeOps::upperBound(const NonLeafNodeT* node, const std::string& key)
+{
+	return searchKeys<NonLeafNodeT, StringNonLeafSlot>(node, key, true);
+}
+
+bool StringNodeOps::insert(NonLeafNodeT* node, const PageKeyPair<std::string>& pageKey)
+{
+	StringNonLeafSlot slot;
+	slot.pageNo = pageKey.pageNo;
+	return insertSlot(node, upperBound(node, pageKey.key), pageKey.key, slot);
+}
+
+void StringNodeOps::split(NonLeafNodeT* node, NonLeafNodeT* newNode, PageKeyPair<std::string>& pageKey)
+{
+	std::vector<std::string> keys;
+	std::vector<StringNonLeafSlot> slots;
+	decodeNode(node, keys, slots);
+
+	int i = upperBound(node, pageKey.key);
+	StringNonLeafSlot slot;
+	slot.pageNo = pageKey.pageNo;
+	keys.insert(keys.begin() + i, pageKey.key);
+	slots.insert(slots.begin() + i, slot);
+
+	// Key m moves up, the child to its right becomes the first child of the new node
+	size_t m = chooseSplit<StringNonLeafSlot>(keys, 1);
+	encodeNode(node, keys, slots, 0, m);
+
+	initNonLeaf(newNode, node->level, slots[m].pageNo);
+	encodeNode(newNode, keys, slots, m + 1, keys.size());
+
+	pageKey.key = keys[m];
+}
+
+void StringNodeOps::removeKey(NonLeafNodeT* node, const int i)
+{
+	// Slot i holds key i and the child to its right
+	removeSlot<NonLeafNodeT, StringNonLeafSlot>(node, i);
+}
+
+bool StringNodeOps::replaceKey(NonLeafNodeT* node, const int i, const std::string& key)
+{
+	return replaceSlotKey<NonLeafNodeT, StringNonLeafSlot>(node, i, key);
+}
+
+bool StringNodeOps::underflow(const NonLeafNodeT* node)
+{
+	return usedBytes<NonLeafNodeT, StringNonLeafSlot>(node) < STRINGNONLEAFDATASIZE / 2;
+}
+
+void StringNodeOps::getEntries(const NonLeafNodeT* node, std::vector<std::string>& keys, std::vector<PageId>& pageNos)
+{
+	std::vector<StringNonLeafSlot> slots;
+	decodeNode(node, keys, slots);
+
+	pageNos.resize(slots.size() + 1);
+	pageNos[0] = node->firstPageNo;
+	for(size_t i = 0; i < slots.size(); i++){
+		pageNos[i+1] = slots[i].pageNo;
+	}
+}
+
+bool StringNodeOps::nonLeafFits(const std::vector<std::string>& keys, const size_t begin, const size_t end)
+{
+	return encodedSize<StringNonLeafSlot>(keys, begin, end) <= STRINGNONLEAFDATASIZE;
+}
+
+size_t StringNodeOps::nonLeafSplitPoint(const std::vector<std::string>& keys)
+{
+	return chooseSplit<StringNonLeafSlot>(keys, 1);
+}
+
+void StringNodeOps::setEntries(NonLeafNodeT* node, const std::vector<std::string>& keys, const std::vector<PageId>& pageNos,
+                               const size_t begin, const size_t end)
+{
+	std::vector<StringNonLeafSlot> slots(keys.size());
+	for(size_t i = begin; i < end; i++){
+		slots[i].pageNo = pageNos[i+1];
+	}
+	node->firstPageNo = pageNos[begin];
+	encodeNode(node, keys, slots, begin, end);
+}
+
+std::string StringNodeOps::separator(const std::string& leftLast, const std::string& rightFirst)
+{
+	size_t prefixLength = commonPrefix(leftLast, rightFirst);
+	if(prefixLength >= rightFirst.size()){
+		return rightFirst;
+	}
+	return rightFirst.substr(0, prefixLength + 1);
+}
+
+// -----------------------------------------------------------------------------
+// STRING bulk loading
+// -----------------------------------------------------------------------------
+
+StringNodeOps::LeafBuilder::LeafBuilder(const double fillFactor)
+{
+	maxBytes = std::min((size_t)STRINGLEAFDATASIZE, (size_t)(STRINGLEAFDATASIZE * fillFactor));
+	prefixLength = 0;
+	keyBytes = 0;
+}
+
+bool StringNodeOps::LeafBuilder::empty() const
+{
+	return keys.empty();
+}
+
+bool StringNodeOps::LeafBuilder::fits(const std::string& key) const
+{
+	if(keys.empty()){
+		return true;
+	}
+
+	size_t n = keys.size() + 1;
+	size_t newPrefix = std::min(prefixLength, commonPrefix(keys[0], key));
+	return newPrefix + keyBytes + key.size() - n * newPrefix + n * sizeof(StringLeafSlot) <= maxBytes;
+}
+
+void StringNodeOps::LeafBuilder::add(const std::string& key, const RecordId rid)
+{
+	prefixLength = keys.empty() ? key.size() : std::min(prefixLength, commonPrefix(keys[0], key));
+	keyBytes += key.size();
+
+	StringLeafSlot slot;
+	slot.rid = rid;
+	keys.push_back(key);
+	slots.push_back(slot);
+}
+
+const std::string& StringNodeOps::LeafBuilder::firstKey() const
+{
+	return keys.front();
+}
+
+const std::string& StringNodeOps::LeafBuilder::lastKey() const
+{
+	return keys.back();
+}
+
+void StringNodeOps::LeafBuilder::write(LeafNodeT* node)
+{
+	initLeaf(node);
+	encodeNode(node, keys, slots, 0, keys.size());
+
+	keys.clear();
+	slots.clear();
+	prefixLength = 0;
+	keyBytes = 0;
+}
+
+StringNodeOps::NonLeafBuilder::NonLeafBuilder(const double fillFactor)
+{
+	maxBytes = std::min((size_t)STRINGNONLEAFDATASIZE, (size_t)(STRINGNONLEAFDATASIZE * fillFactor));
+	prefixLength = 0;
+	keyBytes = 0;
+	firstPageNo = 0;
+}
+
+void StringNodeOps::NonLeafBuilder::start(const PageId firstPageNo)
+{
+	this->firstPageNo = firstPageNo;
+	keys.clear();
+	slots.clear();
+	prefixLength = 0;
+	keyBytes = 0;
+}
+
+int StringNodeOps::NonLeafBuilder::numKeys() const
+{
+	return keys.size();
+}
+
+bool StringNodeOps::NonLeafBuilder::fits(const std::string& key) const
+{
+	// Like the other key types a non-leaf always takes two keys
+	if(keys.size() < 2){
+		return true;
+	}
+
+	size_t n = keys.size() + 1;
+	size_t newPrefix = std::min(prefixLength, commonPrefix(keys[0], key));
+	return newPrefix + keyBytes + key.size() - n * newPrefix + n * sizeof(StringNonLeafSlot) <= maxBytes;
+}
+
+void StringNodeOps::NonLeafBuilder::add(const std::string& key, const PageId pageNo)
+{
+	prefixLength = keys.empty() ? key.size() : std::min(prefixLength, commonPrefix(keys[0], key));
+	keyBytes += key.size();
+
+	StringNonLeafSlot slot;
+	slot.pageNo = pageNo;
+	keys.push_back(key);
+	slots.push_back(slot);
+}
+
+void StringNodeOps::NonLeafBuilder::write(NonLeafNodeT* node, const int level)
+{
+	initNonLeaf(node, level, firstPageNo);
+	encodeNode(node, keys, slots, 0, keys.size());
+}
+
+}
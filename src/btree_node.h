@@ -0,0 +1,544 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "btree.h"
+#include "btree_search.h"
+
+namespace badgerdb
+{
+
+/**
+ * @brief Operations on the nodes of a B+ tree with keys of type T ordered by Compare. The tree
+ * algorithms in BTreeIndex only touch nodes through these functions, so each node layout
+ * provides its own version. This generic version works on the fixed-size key arrays of
+ * LeafNode and NonLeafNode.
+*/
+template <class T, class Compare>
+struct NodeOps{
+	typedef typename KeyTraits<T>::LeafNodeType LeafNodeT;
+	typedef typename KeyTraits<T>::NonLeafNodeType NonLeafNodeT;
+
+	enum{
+		LEAFSIZE = sizeof(((LeafNodeT*)0)->keyArray) / sizeof(T),
+		NONLEAFSIZE = sizeof(((NonLeafNodeT*)0)->keyArray) / sizeof(T)
+	};
+
+	// -----------------------------------------------------------------------------
+	// Leaf nodes
+	// -----------------------------------------------------------------------------
+
+	static void initLeaf(LeafNodeT* node)
+	{
+		node->numKeys = 0;
+		node->rightSibPageNo = 0;
+	}
+
+	static int numKeys(const LeafNodeT* node)
+	{
+		return node->numKeys;
+	}
+
+	static PageId rightSib(const LeafNodeT* node)
+	{
+		return node->rightSibPageNo;
+	}
+
+	static void setRightSib(LeafNodeT* node, const PageId pageNo)
+	{
+		node->rightSibPageNo = pageNo;
+	}
+
+	static T key(const LeafNodeT* node, const int i)
+	{
+		return node->keyArray[i];
+	}
+
+	static RecordId rid(const LeafNodeT* node, const int i)
+	{
+		return node->ridArray[i];
+	}
+
+	// Number of keys in the leaf that are less than the key
+	static int lowerBound(const LeafNodeT* node, const T& key)
+	{
+		return NodeSearch<T, Compare>::lowerBound(node->keyArray, node->numKeys, key);
+	}
+
+	// Number of keys in the leaf that are less than or equal to the key
+	static int upperBound(const LeafNodeT* node, const T& key)
+	{
+		return NodeSearch<T, Compare>::upperBound(node->keyArray, node->numKeys, key);
+	}
+
+	// Insert the key-rid pair after any equal keys, return false if the leaf is full
+	static bool insert(LeafNodeT* node, const T& key, const RecordId rid)
+	{
+		if(node->numKeys >= LEAFSIZE){
+			return false;
+		}
+
+		int i = upperBound(node, key);
+		for(int j = node->numKeys; j > i; j--){
+			node->keyArray[j] = node->keyArray[j-1];
+			node->ridArray[j] = node->ridArray[j-1];
+		}
+
+		node->keyArray[i] = key;
+		node->ridArray[i] = rid;
+		node->numKeys++;
+		return true;
+	}
+
+	// Move the upper half of a full leaf into the empty newNode and insert the key-rid pair,
+	// sepKey is set to the separator to insert into the parent for newNode
+	static void split(LeafNodeT* node, LeafNodeT* newNode, const T& key, const RecordId rid, T& sepKey)
+	{
+		int k = (node->numKeys + 1) / 2;
+		int i = upperBound(node, key);
+
+		// Move one more pair to the new node if the key goes into the left node
+		int moveFrom = i < k ? k - 1 : k;
+
+		newNode->numKeys = node->numKeys - moveFrom;
+		for(int j = moveFrom; j < node->numKeys; j++){
+			newNode->keyArray[j-moveFrom] = node->keyArray[j];
+			newNode->ridArray[j-moveFrom] = node->ridArray[j];
+		}
+		node->numKeys = moveFrom;
+
+		if(i < k){
+			insert(node, key, rid);
+		}
+		else{
+			insert(newNode, key, rid);
+		}
+
+		sepKey = newNode->keyArray[0];
+	}
+
+	// Remove pair i from the leaf
+	static void remove(LeafNodeT* node, const int i)
+	{
+		for(int j = i + 1; j < node->numKeys; j++){
+			node->keyArray[j-1] = node->keyArray[j];
+			node->ridArray[j-1] = node->ridArray[j];
+		}
+		node->numKeys--;
+	}
+
+	// Whether the leaf is less than half full
+	static bool underflow(const LeafNodeT* node)
+	{
+		return node->numKeys < LEAFSIZE / 2;
+	}
+
+	static void getEntries(const LeafNodeT* node, std::vector<T>& keys, std::vector<RecordId>& rids)
+	{
+		keys.assign(node->keyArray, node->keyArray + node->numKeys);
+		rids.assign(node->ridArray, node->ridArray + node->numKeys);
+	}
+
+	// Whether the sorted keys [begin, end) fit in one leaf
+	static bool leafFits(const std::vector<T>& keys, const size_t begin, const size_t end)
+	{
+		return end - begin <= (size_t)LEAFSIZE;
+	}
+
+	// Where to split the sorted keys of two leaves between them, keys before it go left
+	static size_t leafSplitPoint(const std::vector<T>& keys)
+	{
+		return keys.size() / 2;
+	}
+
+	// Replace the pairs of the leaf with the pairs [begin, end), which must fit
+	static void setEntries(LeafNodeT* node, const std::vector<T>& keys, const std::vector<RecordId>& rids,
+	                       const size_t begin, const size_t end)
+	{
+		for(size_t i = begin; i < end; i++){
+			node->keyArray[i-begin] = keys[i];
+			node->ridArray[i-begin] = rids[i];
+		}
+		node->numKeys = end - begin;
+	}
+
+	// -----------------------------------------------------------------------------
+	// Non-leaf nodes
+	// -----------------------------------------------------------------------------
+
+	static void initNonLeaf(NonLeafNodeT* node, const int level, const PageId firstPageNo)
+	{
+		node->level = level;
+		node->numKeys = 0;
+		node->pageNoArray[0] = firstPageNo;
+	}
+
+	static int level(const NonLeafNodeT* node)
+	{
+		return node->level;
+	}
+
+	static void setLevel(NonLeafNodeT* node, const int level)
+	{
+		node->level = level;
+	}
+
+	static int numKeys(const NonLeafNodeT* node)
+	{
+		return node->numKeys;
+	}
+
+	static T key(const NonLeafNodeT* node, const int i)
+	{
+		return node->keyArray[i];
+	}
+
+	// Page number of child i, child i holds the keys between key i-1 and key i
+	static PageId child(const NonLeafNodeT* node, const int i)
+	{
+		return node->pageNoArray[i];
+	}
+
+	static void setChild(NonLeafNodeT* node, const int i, const PageId pageNo)
+	{
+		node->pageNoArray[i] = pageNo;
+	}
+
+	static int lowerBound(const NonLeafNodeT* node, const T& key)
+	{
+		return NodeSearch<T, Compare>::lowerBound(node->keyArray, node->numKeys, key);
+	}
+
+	static int upperBound(const NonLeafNodeT* node, const T& key)
+	{
+		return NodeSearch<T, Compare>::upperBound(node->keyArray, node->numKeys, key);
+	}
+
+	// Insert the key with pageNo as the child to its right, return false if the node is full
+	static bool insert(NonLeafNodeT* node, const PageKeyPair<T>& pageKey)
+	{
+		if(node->numKeys >= NONLEAFSIZE){
+			return false;
+		}
+
+		int i = upperBound(node, pageKey.key);
+		for(int j = node->numKeys; j > i; j--){
+			node->keyArray[j] = node->keyArray[j-1];
+			node->pageNoArray[j+1] = node->pageNoArray[j];
+		}
+
+		node->keyArray[i] = pageKey.key;
+		node->pageNoArray[i+1] = pageKey.pageNo;
+		node->numKeys++;
+		return true;
+	}
+
+	// Move the upper half of a full non-leaf into the empty newNode while inserting pageKey,
+	// pageKey.key is set to the middle key that moves up into the parent
+	static void split(NonLeafNodeT* node, NonLeafNodeT* newNode, PageKeyPair<T>& pageKey)
+	{
+		int numKeys = node->numKeys;
+		int i = upperBound(node, pageKey.key);
+
+		// Lay out all the keys and pageNos with the new pair inserted
+		std::vector<T> keys(node->keyArray, node->keyArray + numKeys);
+		std::vector<PageId> pageNos(node->pageNoArray, node->pageNoArray + numKeys + 1);
+		keys.insert(keys.begin() + i, pageKey.key);
+		pageNos.insert(pageNos.begin() + i + 1, pageKey.pageNo);
+
+		int k = (numKeys + 1) / 2;
+
+		// Keys before k stay in the left node
+		node->numKeys = k;
+		for(int j = 0; j < k; j++){
+			node->keyArray[j] = keys[j];
+			node->pageNoArray[j] = pageNos[j];
+		}
+		node->pageNoArray[k] = pageNos[k];
+
+		// Keys after k go to the right node
+		newNode->level = node->level;
+		newNode->numKeys = numKeys - k;
+		for(int j = k + 1; j <= numKeys; j++){
+			newNode->keyArray[j-k-1] = keys[j];
+			newNode->pageNoArray[j-k-1] = pageNos[j];
+		}
+		newNode->pageNoArray[numKeys-k] = pageNos[numKeys+1];
+
+		// Key k moves up
+		pageKey.key = keys[k];
+	}
+
+	// Remove key i and the child to its right
+	static void removeKey(NonLeafNodeT* node, const int i)
+	{
+		for(int j = i + 1; j < node->numKeys; j++){
+			node->keyArray[j-1] = node->keyArray[j];
+			node->pageNoArray[j] = node->pageNoArray[j+1];
+		}
+		node->numKeys--;
+	}
+
+	// Replace key i, return false if the new key does not fit
+	static bool replaceKey(NonLeafNodeT* node, const int i, const T& key)
+	{
+		node->keyArray[i] = key;
+		return true;
+	}
+
+	// Whether the non-leaf is less than half full
+	static bool underflow(const NonLeafNodeT* node)
+	{
+		return node->numKeys < NONLEAFSIZE / 2;
+	}
+
+	static void getEntries(const NonLeafNodeT* node, std::vector<T>& keys, std::vector<PageId>& pageNos)
+	{
+		keys.assign(node->keyArray, node->keyArray + node->numKeys);
+		pageNos.assign(node->pageNoArray, node->pageNoArray + node->numKeys + 1);
+	}
+
+	// Whether the sorted keys [begin, end) fit in one non-leaf
+	static bool nonLeafFits(const std::vector<T>& keys, const size_t begin, const size_t end)
+	{
+		return end - begin <= (size_t)NONLEAFSIZE;
+	}
+
+	// Which of the sorted keys of two non-leaves moves up when they are split between them
+	static size_t nonLeafSplitPoint(const std::vector<T>& keys)
+	{
+		return keys.size() / 2;
+	}
+
+	// Replace the keys of the non-leaf with keys [begin, end) and children [begin, end], which must fit
+	static void setEntries(NonLeafNodeT* node, const std::vector<T>& keys, const std::vector<PageId>& pageNos,
+	                       const size_t begin, const size_t end)
+	{
+		for(size_t i = begin; i < end; i++){
+			node->keyArray[i-begin] = keys[i];
+			node->pageNoArray[i-begin] = pageNos[i];
+		}
+		node->pageNoArray[end-begin] = pageNos[end];
+		node->numKeys = end - begin;
+	}
+
+	// -----------------------------------------------------------------------------
+	// Bulk loading
+	// -----------------------------------------------------------------------------
+
+	// Separator between two neighbouring leaves
+	static T separator(const T& leftLast, const T& rightFirst)
+	{
+		return rightFirst;
+	}
+
+	/**
+	 * @brief Collects the sorted key-rid pairs of one leaf until the leaf is filled to the fill factor.
+	 */
+	class LeafBuilder{
+	public:
+		LeafBuilder(const double fillFactor)
+		{
+			maxKeys = std::max(1, std::min((int)LEAFSIZE, (int)(LEAFSIZE * fillFactor)));
+		}
+
+		bool empty() const
+		{
+			return keys.empty();
+		}
+
+		// Whether the key can still be added, an empty leaf always takes a key
+		bool fits(const T& key) const
+		{
+			return (int)keys.size() < maxKeys;
+		}
+
+		void add(const T& key, const RecordId rid)
+		{
+			keys.push_back(key);
+			rids.push_back(rid);
+		}
+
+		const T& firstKey() const
+		{
+			return keys.front();
+		}
+
+		const T& lastKey() const
+		{
+			return keys.back();
+		}
+
+		// Write the pairs into the leaf and start over
+		void write(LeafNodeT* node)
+		{
+			initLeaf(node);
+			for(size_t i = 0; i < keys.size(); i++){
+				node->keyArray[i] = keys[i];
+				node->ridArray[i] = rids[i];
+			}
+			node->numKeys = keys.size();
+
+			keys.clear();
+			rids.clear();
+		}
+
+	private:
+		int maxKeys;
+		std::vector<T> keys;
+		std::vector<RecordId> rids;
+	};
+
+	/**
+	 * @brief Collects the children of one non-leaf until the node is filled to the fill factor.
+	 */
+	class NonLeafBuilder{
+	public:
+		NonLeafBuilder(const double fillFactor)
+		{
+			maxKeys = std::max(2, std::min((int)NONLEAFSIZE, (int)(NONLEAFSIZE * fillFactor)));
+		}
+
+		void start(const PageId firstPageNo)
+		{
+			keys.clear();
+			pageNos.assign(1, firstPageNo);
+		}
+
+		int numKeys() const
+		{
+			return keys.size();
+		}
+
+		bool fits(const T& key) const
+		{
+			return (int)keys.size() < maxKeys;
+		}
+
+		// Add the key with pageNo as the child to its right
+		void add(const T& key, const PageId pageNo)
+		{
+			keys.push_back(key);
+			pageNos.push_back(pageNo);
+		}
+
+		void write(NonLeafNodeT* node, const int level)
+		{
+			initNonLeaf(node, level, pageNos[0]);
+			for(size_t i = 0; i < keys.size(); i++){
+				node->keyArray[i] = keys[i];
+				node->pageNoArray[i+1] = pageNos[i+1];
+			}
+			node->numKeys = keys.size();
+		}
+
+	private:
+		int maxKeys;
+		std::vector<T> keys;
+		std::vector<PageId> pageNos;
+	};
+};
+
+/**
+ * @brief Operations on the slotted, prefix compressed STRING nodes. Keys are ordered bytewise
+ * like std::string.
+*/
+template <>
+struct NodeOps<std::string, std::less<std::string> >{
+	typedef LeafNodeString LeafNodeT;
+	typedef NonLeafNodeString NonLeafNodeT;
+
+	// Leaf nodes
+	static void initLeaf(LeafNodeT* node);
+	static int numKeys(const LeafNodeT* node);
+	static PageId rightSib(const LeafNodeT* node);
+	static void setRightSib(LeafNodeT* node, const PageId pageNo);
+	static std::string key(const LeafNodeT* node, const int i);
+	static RecordId rid(const LeafNodeT* node, const int i);
+	static int lowerBound(const LeafNodeT* node, const std::string& key);
+	static int upperBound(const LeafNodeT* node, const std::string& key);
+	static bool insert(LeafNodeT* node, const std::string& key, const RecordId rid);
+	static void split(LeafNodeT* node, LeafNodeT* newNode, const std::string& key, const RecordId rid, std::string& sepKey);
+	static void remove(LeafNodeT* node, const int i);
+	static bool underflow(const LeafNodeT* node);
+	static void getEntries(const LeafNodeT* node, std::vector<std::string>& keys, std::vector<RecordId>& rids);
+	static bool leafFits(const std::vector<std::string>& keys, const size_t begin, const size_t end);
+	static size_t leafSplitPoint(const std::vector<std::string>& keys);
+	static void setEntries(LeafNodeT* node, const std::vector<std::string>& keys, const std::vector<RecordId>& rids,
+	                       const size_t begin, const size_t end);
+
+	// Non-leaf nodes
+	static void initNonLeaf(NonLeafNodeT* node, const int level, const PageId firstPageNo);
+	static int level(const NonLeafNodeT* node);
+	static void setLevel(NonLeafNodeT* node, const int level);
+	static int numKeys(const NonLeafNodeT* node);
+	static std::string key(const NonLeafNodeT* node, const int i);
+	static PageId child(const NonLeafNodeT* node, const int i);
+	static void setChild(NonLeafNodeT* node, const int i, const PageId pageNo);
+	static int lowerBound(const NonLeafNodeT* node, const std::string& key);
+	static int upperBound(const NonLeafNodeT* node, const std::string& key);
+	static bool insert(NonLeafNodeT* node, const PageKeyPair<std::string>& pageKey);
+	static void split(NonLeafNodeT* node, NonLeafNodeT* newNode, PageKeyPair<std::string>& pageKey);
+	static void removeKey(NonLeafNodeT* node, const int i);
+	static bool replaceKey(NonLeafNodeT* node, const int i, const std::string& key);
+	static bool underflow(const NonLeafNodeT* node);
+	static void getEntries(const NonLeafNodeT* node, std::vector<std::string>& keys, std::vector<PageId>& pageNos);
+	static bool nonLeafFits(const std::vector<std::string>& keys, const size_t begin, const size_t end);
+	static size_t nonLeafSplitPoint(const std::vector<std::string>& keys);
+	static void setEntries(NonLeafNodeT* node, const std::vector<std::string>& keys, const std::vector<PageId>& pageNos,
+	                       const size_t begin, const size_t end);
+
+	// Shortest prefix of rightFirst that is greater than leftLast
+	static std::string separator(const std::string& leftLast, const std::string& rightFirst);
+
+	/**
+	 * @brief Collects the sorted key-rid pairs of one leaf until the compressed keys fill the fill factor of the page.
+	 */
+	class LeafBuilder{
+	public:
+		LeafBuilder(const double fillFactor);
+		bool empty() const;
+		bool fits(const std::string& key) const;
+		void add(const std::string& key, const RecordId rid);
+		const std::string& firstKey() const;
+		const std::string& lastKey() const;
+		void write(LeafNodeT* node);
+
+	private:
+		size_t maxBytes;
+		size_t prefixLength;
+		size_t keyBytes;
+		std::vector<std::string> keys;
+		std::vector<StringLeafSlot> slots;
+	};
+
+	/**
+	 * @brief Collects the children of one non-leaf until the compressed keys fill the fill factor of the page.
+	 */
+	class NonLeafBuilder{
+	public:
+		NonLeafBuilder(const double fillFactor);
+		void start(const PageId firstPageNo);
+		int numKeys() const;
+		bool fits(const std::string& key) const;
+		void add(const std::string& key, const PageId pageNo);
+		void write(NonLeafNodeT* node, const int level);
+
+	private:
+		size_t maxBytes;
+		size_t prefixLength;
+		size_t keyBytes;
+		PageId firstPageNo;
+		std::vector<std::string> keys;
+		std::vector<StringNonLeafSlot> slots;
+	};
+};
+
+}
@@ -0,0 +1,206 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "btree_search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BTREE_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+namespace badgerdb
+{
+
+namespace
+{
+
+// The binary search stops once this many keys are left, the rest are compared in vector registers
+const int INTSEARCHWINDOW = 16;
+const int DOUBLESEARCHWINDOW = 8;
+
+enum SimdLevel
+{
+	SIMD_NONE,
+	SIMD_SSE4,
+	SIMD_AVX2
+};
+
+SimdLevel detectSimdLevel()
+{
+#ifdef BTREE_SEARCH_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		return SIMD_AVX2;
+	}
+	if(__builtin_cpu_supports("sse4.1")){
+		return SIMD_SSE4;
+	}
+#endif
+	return SIMD_NONE;
+}
+
+const SimdLevel simdLevel = detectSimdLevel();
+
+// Whether a key comes before the search key, i.e. is counted by the bound
+template <class T, bool UPPER>
+inline bool keyBefore(const T x, const T key)
+{
+	return UPPER ? !(key < x) : x < key;
+}
+
+// Narrow the sorted array down to at most window keys that may still be on either side of the key
+template <class T, bool UPPER>
+inline const T* narrowKeys(const T* keyArray, int& n, const T key, const int window)
+{
+	const T* base = keyArray;
+	while(n > window){
+		int half = n / 2;
+		base = keyBefore<T, UPPER>(base[half], key) ? base + half : base;
+		n -= half;
+	}
+	return base;
+}
+
+template <class T, bool UPPER>
+int countBeforeScalar(const T* keys, const int n, const T key)
+{
+	int count = 0;
+	for(int i = 0; i < n; i++){
+		count += keyBefore<T, UPPER>(keys[i], key) ? 1 : 0;
+	}
+	return count;
+}
+
+#ifdef BTREE_SEARCH_X86
+
+template <bool UPPER>
+__attribute__((target("avx2")))
+int countBeforeIntAvx2(const int* keys, const int n, const int key)
+{
+	__m256i keyVec = _mm256_set1_epi32(key);
+	int count = 0;
+	int i = 0;
+	for(; i + 8 <= n; i += 8){
+		__m256i x = _mm256_loadu_si256((const __m256i*)(keys + i));
+		// x < key, or for the upper bound the complement of x > key
+		__m256i mask = UPPER ? _mm256_cmpgt_epi32(x, keyVec) : _mm256_cmpgt_epi32(keyVec, x);
+		int bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+		count += UPPER ? 8 - bits : bits;
+	}
+	return count + countBeforeScalar<int, UPPER>(keys + i, n - i, key);
+}
+
+template <bool UPPER>
+__attribute__((target("sse4.1")))
+int countBeforeIntSse4(const int* keys, const int n, const int key)
+{
+	__m128i keyVec = _mm_set1_epi32(key);
+	int count = 0;
+	int i = 0;
+	for(; i + 4 <= n; i += 4){
+		__m128i x = _mm_loadu_si128((const __m128i*)(keys + i));
+		__m128i mask = UPPER ? _mm_cmpgt_epi32(x, keyVec) : _mm_cmpgt_epi32(keyVec, x);
+		int bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(mask)));
+		count += UPPER ? 4 - bits : bits;
+	}
+	return count + countBeforeScalar<int, UPPER>(keys + i, n - i, key);
+}
+
+template <bool UPPER>
+__attribute__((target("avx2")))
+int countBeforeDoubleAvx2(const double* keys, const int n, const double key)
+{
+	__m256d keyVec = _mm256_set1_pd(key);
+	int count = 0;
+	int i = 0;
+	for(; i + 4 <= n; i += 4){
+		__m256d x = _mm256_loadu_pd(keys + i);
+		// Same results as operator< for NaN: x < key is ordered, !(key < x) is unordered
+		__m256d mask = UPPER ? _mm256_cmp_pd(keyVec, x, _CMP_NLT_UQ) : _mm256_cmp_pd(x, keyVec, _CMP_LT_OQ);
+		count += __builtin_popcount(_mm256_movemask_pd(mask));
+	}
+	return count + countBeforeScalar<double, UPPER>(keys + i, n - i, key);
+}
+
+template <bool UPPER>
+__attribute__((target("sse4.1")))
+int countBeforeDoubleSse4(const double* keys, const int n, const double key)
+{
+	__m128d keyVec = _mm_set1_pd(key);
+	int count = 0;
+	int i = 0;
+	for(; i + 2 <= n; i += 2){
+		__m128d x = _mm_loadu_pd(keys + i);
+		__m128d mask = UPPER ? _mm_cmpnlt_pd(keyVec, x) : _mm_cmplt_pd(x, keyVec);
+		count += __builtin_popcount(_mm_movemask_pd(mask));
+	}
+	return count + countBeforeScalar<double, UPPER>(keys + i, n - i, key);
+}
+
+#endif
+
+template <bool UPPER>
+int searchInt(const int* keyArray, const int numKeys, const int key)
+{
+	int n = numKeys;
+	const int* base = narrowKeys<int, UPPER>(keyArray, n, key, INTSEARCHWINDOW);
+	int offset = (int)(base - keyArray);
+
+	switch(simdLevel){
+#ifdef BTREE_SEARCH_X86
+		case SIMD_AVX2:
+			return offset + countBeforeIntAvx2<UPPER>(base, n, key);
+		case SIMD_SSE4:
+			return offset + countBeforeIntSse4<UPPER>(base, n, key);
+#endif
+		default:
+			return offset + countBeforeScalar<int, UPPER>(base, n, key);
+	}
+}
+
+template <bool UPPER>
+int searchDouble(const double* keyArray, const int numKeys, const double key)
+{
+	int n = numKeys;
+	const double* base = narrowKeys<double, UPPER>(keyArray, n, key, DOUBLESEARCHWINDOW);
+	int offset = (int)(base - keyArray);
+
+	switch(simdLevel){
+#ifdef BTREE_SEARCH_X86
+		case SIMD_AVX2:
+			return offset + countBeforeDoubleAvx2<UPPER>(base, n, key);
+		case SIMD_SSE4:
+			return offset + countBeforeDoubleSse4<UPPER>(base, n, key);
+#endif
+		default:
+			return offset + countBeforeScalar<double, UPPER>(base, n, key);
+	}
+}
+
+}
+
+int lowerBoundInt(const int* keyArray, const int numKeys, const int key)
+{
+	return searchInt<false>(keyArray, numKeys, key);
+}
+
+int upperBoundInt(const int* keyArray, const int numKeys, const int key)
+{
+	return searchInt<true>(keyArray, numKeys, key);
+}
+
+int lowerBoundDouble(const double* keyArray, const int numKeys, const double key)
+{
+	return searchDouble<false>(keyArray, numKeys, key);
+}
+
+int upperBoundDouble(const double* keyArray, const int numKeys, const double key)
+{
+	return searchDouble<true>(keyArray, numKeys, key);
+}
+
+}
@@ -0,0 +1,129 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <functional>
+
+namespace badgerdb
+{
+
+/**
+ * @brief Number of keys in a sorted INTEGER key array that are less than the key.
+ * Uses an AVX2 or SSE4 compare path when the CPU supports it.
+ *
+ * @param keyArray	Sorted keys
+ * @param numKeys		Number of keys in keyArray
+ * @param key				Key to search for
+ * @return Index of the first key not less than the key
+ */
+int lowerBoundInt(const int* keyArray, const int numKeys, const int key);
+
+/**
+ * @brief Number of keys in a sorted INTEGER key array that are less than or equal to the key.
+ * Uses an AVX2 or SSE4 compare path when the CPU supports it.
+ *
+ * @param keyArray	Sorted keys
+ * @param numKeys		Number of keys in keyArray
+ * @param key				Key to search for
+ * @return Index of the first key greater than the key
+ */
+int upperBoundInt(const int* keyArray, const int numKeys, const int key);
+
+/**
+ * @brief Number of keys in a sorted DOUBLE key array that are less than the key.
+ * Uses an AVX2 or SSE4 compare path when the CPU supports it.
+ *
+ * @param keyArray	Sorted keys
+ * @param numKeys		Number of keys in keyArray
+ * @param key				Key to search for
+ * @return Index of the first key not less than the key
+ */
+int lowerBoundDouble(const double* keyArray, const int numKeys, const double key);
+
+/**
+ * @brief Number of keys in a sorted DOUBLE key array that are less than or equal to the key.
+ * Uses an AVX2 or SSE4 compare path when the CPU supports it.
+ *
+ * @param keyArray	Sorted keys
+ * @param numKeys		Number of keys in keyArray
+ * @param key				Key to search for
+ * @return Index of the first key greater than the key
+ */
+int upperBoundDouble(const double* keyArray, const int numKeys, const double key);
+
+/**
+ * @brief Search within the sorted key array of a node. The generic version is a branch-free
+ * binary search using Compare, the INTEGER and DOUBLE keys ordered by std::less are specialized
+ * to use the vectorised searches above.
+*/
+template <class T, class Compare>
+struct NodeSearch{
+  /**
+   * Number of keys in the sorted array that are less than the key.
+   */
+	static int lowerBound(const T* keyArray, const int numKeys, const T& key)
+	{
+		Compare comp;
+		const T* base = keyArray;
+		int n = numKeys;
+
+		// Every key before base is less than the key, every key from base + n on is not
+		while(n > 1){
+			int half = n / 2;
+			base = comp(base[half], key) ? base + half : base;
+			n -= half;
+		}
+		return (int)(base - keyArray) + (n == 1 && comp(*base, key) ? 1 : 0);
+	}
+
+  /**
+   * Number of keys in the sorted array that are less than or equal to the key.
+   */
+	static int upperBound(const T* keyArray, const int numKeys, const T& key)
+	{
+		Compare comp;
+		const T* base = keyArray;
+		int n = numKeys;
+
+		// Every key before base is less than or equal to the key, every key from base + n on is greater
+		while(n > 1){
+			int half = n / 2;
+			base = !comp(key, base[half]) ? base + half : base;
+			n -= half;
+		}
+		return (int)(base - keyArray) + (n == 1 && !comp(key, *base) ? 1 : 0);
+	}
+};
+
+template <>
+struct NodeSearch<int, std::less<int> >{
+	static int lowerBound(const int* keyArray, const int numKeys, const int& key)
+	{
+		return lowerBoundInt(keyArray, numKeys, key);
+	}
+
+	static int upperBound(const int* keyArray, const int numKeys, const int& key)
+	{
+		return upperBoundInt(keyArray, numKeys, key);
+	}
+};
+
+template <>
+struct NodeSearch<double, std::less<double> >{
+	static int lowerBound(const double* keyArray, const int numKeys, const double& key)
+	{
+		return lowerBoundDouble(keyArray, numKeys, key);
+	}
+
+	static int upperBound(const double* keyArray, const int numKeys, const double& key)
+	{
+		return upperBoundDouble(keyArray, numKeys, key);
+	}
+};
+
+}
@@ -6,6 +6,8 @@
  */
 
 #include <memory>
+#include <new>
+#include <cstring>
 #include <iostream>
 #include "buffer.h"
 #include "bufHashTbl.h"
@@ -13,102 +15,244 @@
 #include "exceptions/hash_not_found_exception.h"
 #include "exceptions/hash_table_exception.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+namespace {
+
+// Partitions grow once more than 3/4 of their slots are used
+inline bool overLoaded(const std::uint32_t count, const std::uint32_t capacity)
+{
+  return count * 4 > capacity * 3;
+}
+
+inline std::uint32_t partitionOf(const std::uint64_t h)
+{
+  return (std::uint32_t)(h >> 32) % HTPARTITIONS;
+}
+
+// The tag of a used slot always has its top bit set, 0 marks an empty slot
+inline std::uint8_t tagOf(const std::uint64_t h)
+{
+  return (std::uint8_t)(0x80 | (h >> 57));
+}
+
+inline std::uint32_t homeOf(const std::uint64_t h, const std::uint32_t capacity)
+{
+  return (std::uint32_t)h & (capacity - 1);
+}
+
+// Bit i is set if the tag of slot pos + i equals tag, and in empty if that slot is empty
+inline void matchGroup(const std::uint8_t* tags, const std::uint8_t tag, std::uint32_t& match, std::uint32_t& empty)
+{
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i*)tags);
+  match = (std::uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+  empty = (std::uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_setzero_si128()));
+#else
+  match = 0;
+  empty = 0;
+  for (int i = 0; i < HTGROUPSIZE; i++) {
+    match |= (std::uint32_t)(tags[i] == tag) << i;
+    empty |= (std::uint32_t)(tags[i] == 0) << i;
+  }
+#endif
+}
+
+}
+
+std::uint64_t BufHashTbl::hash(const File* file, const PageId pageNo)
 {
-  int tmp, value;
-  tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
-  return value;
+  // Mix the whole pointer and the page number (the finalizer of MurmurHash3)
+  std::uint64_t h = (std::uint64_t)(std::uintptr_t)file ^ ((std::uint64_t)pageNo * 0x9e3779b97f4a7c15ULL);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
 }
 
 BufHashTbl::BufHashTbl(int htSize)
-	: HTSIZE(htSize)
 {
-  // allocate an array of pointers to hashBuckets
-  ht = new hashBucket* [htSize];
-  for(int i=0; i < HTSIZE; i++)
-    ht[i] = NULL;
+  // give each partition a power of two share of the slots
+  std::uint32_t capacity = HTGROUPSIZE;
+  while (capacity * HTPARTITIONS < (std::uint32_t)htSize)
+    capacity *= 2;
+
+  for (int i = 0; i < HTPARTITIONS; i++) {
+    partitions[i].tags = NULL;
+    partitions[i].slots = NULL;
+    partitions[i].count = 0;
+    resize(partitions[i], capacity);
+  }
 }
 
 BufHashTbl::~BufHashTbl()
 {
-  for(int i = 0; i < HTSIZE; i++) {
-    hashBucket* tmpBuf = ht[i];
-    while (ht[i]) {
-      tmpBuf = ht[i];
-      ht[i] = ht[i]->next;
-      delete tmpBuf;
-    }
+  for (int i = 0; i < HTPARTITIONS; i++) {
+    delete [] partitions[i].tags;
+    delete [] partitions[i].slots;
   }
-  delete [] ht;
 }
 
-void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+void BufHashTbl::setTag(hashPartition& part, const std::uint32_t slot, const std::uint8_t tag)
 {
-  int index = hash(file, pageNo);
+  part.tags[slot] = tag;
+  if (slot < HTGROUPSIZE - 1)
+    part.tags[part.capacity + slot] = tag;
+}
 
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-  		throw HashAlreadyPresentException(tmpBuc->file->filename(), tmpBuc->pageNo, tmpBuc->frameNo);
-    tmpBuc = tmpBuc->next;
+void BufHashTbl::resize(hashPartition& part, const std::uint32_t capacity)
+{
+  std::uint8_t* tags = new (std::nothrow) std::uint8_t[capacity + HTGROUPSIZE - 1];
+  hashBucket* slots = new (std::nothrow) hashBucket[capacity];
+  if (!tags || !slots) {
+    delete [] tags;
+    delete [] slots;
+  	throw HashTableException();
   }
+  memset(tags, 0, capacity + HTGROUPSIZE - 1);
 
-  tmpBuc = new hashBucket;
-  if (!tmpBuc)
-  	throw HashTableException();
+  hashPartition old;
+  old.tags = part.tags;
+  old.slots = part.slots;
+  old.capacity = part.tags ? part.capacity : 0;
+
+  part.tags = tags;
+  part.slots = slots;
+  part.capacity = capacity;
 
-  tmpBuc->file = (File*) file;
-  tmpBuc->pageNo = pageNo;
-  tmpBuc->frameNo = frameNo;
-  tmpBuc->next = ht[index];
-  ht[index] = tmpBuc;
+  // move the entries over, every key is known to be unique
+  for (std::uint32_t i = 0; i < old.capacity; i++) {
+    if (old.tags[i] == 0)
+      continue;
+    std::uint64_t h = hash(old.slots[i].file, old.slots[i].pageNo);
+    std::uint32_t slot = homeOf(h, capacity);
+    while (part.tags[slot] != 0)
+      slot = (slot + 1) & (capacity - 1);
+    setTag(part, slot, tagOf(h));
+    part.slots[slot] = old.slots[i];
+  }
+
+  delete [] old.tags;
+  delete [] old.slots;
 }
 
-void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+int BufHashTbl::findSlot(const hashPartition& part, const std::uint64_t h, const File* file, const PageId pageNo)
 {
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-    {
-      frameNo = tmpBuc->frameNo; // return frameNo by reference
-      return;
+  const std::uint32_t mask = part.capacity - 1;
+  const std::uint8_t tag = tagOf(h);
+  std::uint32_t pos = homeOf(h, part.capacity);
+
+  // Entries are never separated from their home slot by an empty slot, so the search ends at the first one
+  while (true) {
+    std::uint32_t match, empty;
+    matchGroup(part.tags + pos, tag, match, empty);
+
+    // only tags before the first empty slot belong to the probe sequence
+    if (empty)
+      match &= (empty & -empty) - 1;
+
+    while (match) {
+      std::uint32_t slot = (pos + __builtin_ctz(match)) & mask;
+      const hashBucket& bucket = part.slots[slot];
+      if (bucket.file == file && bucket.pageNo == pageNo)
+        return (int)slot;
+      match &= match - 1;
     }
-    tmpBuc = tmpBuc->next;
+
+    if (empty)
+      return -1;
+    pos = (pos + HTGROUPSIZE) & mask;
   }
+}
 
-  throw HashNotFoundException(file->filename(), pageNo);
+void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+{
+  if (!tryInsert(file, pageNo, frameNo))
+  {
+    FrameId presentFrameNo = frameNo;
+    find(file, pageNo, presentFrameNo);
+  	throw HashAlreadyPresentException(file->filename(), pageNo, presentFrameNo);
+  }
+}
+
+bool BufHashTbl::tryInsert(const File* file, const PageId pageNo, const FrameId frameNo)
+{
+  std::uint64_t h = hash(file, pageNo);
+  hashPartition& part = partitions[partitionOf(h)];
+  std::lock_guard<std::mutex> latch(part.latch);
+
+  if (findSlot(part, h, file, pageNo) >= 0)
+    return false;
+
+  if (overLoaded(part.count + 1, part.capacity))
+    resize(part, part.capacity * 2);
+
+  // take the first empty slot from home
+  std::uint32_t slot = homeOf(h, part.capacity);
+  while (part.tags[slot] != 0)
+    slot = (slot + 1) & (part.capacity - 1);
+
+  setTag(part, slot, tagOf(h));
+  part.slots[slot].file = (File*) file;
+  part.slots[slot].pageNo = pageNo;
+  part.slots[slot].frameNo = frameNo;
+  part.count++;
+  return true;
+}
+
+void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+{
+  if (!find(file, pageNo, frameNo))
+    throw HashNotFoundException(file->filename(), pageNo);
+}
+
+bool BufHashTbl::find(const File* file, const PageId pageNo, FrameId &frameNo)
+{
+  std::uint64_t h = hash(file, pageNo);
+  hashPartition& part = partitions[partitionOf(h)];
+  std::lock_guard<std::mutex> latch(part.latch);
+
+  int slot = findSlot(part, h, file, pageNo);
+  if (slot < 0)
+    return false;
+
+  frameNo = part.slots[slot].frameNo; // return frameNo by reference
+  return true;
 }
 
 void BufHashTbl::remove(const File* file, const PageId pageNo) {
 
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
-
-  while (tmpBuc)
-	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-		{
-      if(prevBuc) 
-				prevBuc->next = tmpBuc->next;
-      else
-				ht[index] = tmpBuc->next;
-
-      delete tmpBuc;
-      return;
-    }
-		else
-		{
-      prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
+  std::uint64_t h = hash(file, pageNo);
+  hashPartition& part = partitions[partitionOf(h)];
+  std::lock_guard<std::mutex> latch(part.latch);
+
+  int found = findSlot(part, h, file, pageNo);
+  if (found < 0)
+    throw HashNotFoundException(file->filename(), pageNo);
+
+  // Shift later entries of the probe run back into the hole as long as that does not move
+  // them before their home slot, so lookups never need to step over removed entries
+  const std::uint32_t mask = part.capacity - 1;
+  std::uint32_t hole = (std::uint32_t)found;
+  std::uint32_t next = (hole + 1) & mask;
+  while (part.tags[next] != 0) {
+    std::uint32_t home = homeOf(hash(part.slots[next].file, part.slots[next].pageNo), part.capacity);
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      setTag(part, hole, part.tags[next]);
+      part.slots[hole] = part.slots[next];
+      hole = next;
     }
+    next = (next + 1) & mask;
   }
 
-  throw HashNotFoundException(file->filename(), pageNo);
+  setTag(part, hole, 0);
+  part.count--;
 }
 
 }
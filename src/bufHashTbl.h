@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <mutex>
 #include "file.h"
 
 namespace badgerdb {
@@ -29,43 +31,107 @@ struct hashBucket {
 	 * frame number of page in the buffer pool
 	 */
 	FrameId frameNo;
+};
+
+
+/**
+* @brief Number of partitions of the buffer pool hash table, each with its own latch
+*/
+const int HTPARTITIONS = 16;
+
+/**
+* @brief Number of slot tags compared at once when probing
+*/
+const int HTGROUPSIZE = 16;
+
+/**
+* @brief One partition of the buffer pool hash table: an open-addressing table with linear probing
+*/
+struct hashPartition {
+	/**
+	 * Tag byte of every slot, 0 if the slot is empty. The first HTGROUPSIZE - 1 tags are repeated after
+	 * the last one so that a group of tags can be read starting at any slot.
+	 */
+	std::uint8_t* tags;
 
 	/**
-	 * Next node in the hash table
+	 * Entries, slots[i] is used if tags[i] is not 0
 	 */
-	hashBucket*   next;
+	hashBucket* slots;
+
+	/**
+	 * Number of slots, a power of two no smaller than HTGROUPSIZE
+	 */
+	std::uint32_t capacity;
+
+	/**
+	 * Number of used slots
+	 */
+	std::uint32_t count;
+
+	/**
+	 * Latch held by every operation on the partition
+	 */
+	std::mutex latch;
 };
 
 
 /**
 * @brief Hash table class to keep track of pages in the buffer pool
 *
-* @warning This class is not threadsafe.
+* (file, pageNo) is hashed to 64 bits. The hash picks one of HTPARTITIONS partitions, a home slot within it
+* and a 7-bit tag. Each operation holds only the latch of its partition, so threads working on different
+* partitions do not wait for each other. Within a partition a lookup compares HTGROUPSIZE tags at a time
+* from the home slot onwards and only looks at the entries whose tag matches. Entries live in flat arrays,
+* memory is only allocated when a partition grows.
 */
 class BufHashTbl
 {
  private:
 	/**
-	 *	Size of Hash Table
+	 * Partitions of the hash table
 	 */
-  int HTSIZE;
+  hashPartition partitions[HTPARTITIONS];
+
 	/**
-	 * Actual Hash table object
+	 * returns a 64-bit hash value computed using file and pageNo
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @return  			Hash value.
 	 */
-  hashBucket**  ht;
+  static std::uint64_t hash(const File* file, const PageId pageNo);
 
 	/**
-	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
+	 * Find the slot of (file, pageNo) in the partition, whose latch must be held.
 	 *
+	 * @param part   	Partition of the page
+	 * @param h   		Hash value of the page
 	 * @param file   	File object
 	 * @param pageNo  Page number in the file
-	 * @return  			Hash value.
+	 * @return  			Slot of the page, or -1 if it is not in the partition
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  static int findSlot(const hashPartition& part, const std::uint64_t h, const File* file, const PageId pageNo);
+
+	/**
+	 * Set the tag of a slot, keeping the repeated tags after the last slot in step.
+	 */
+  static void setTag(hashPartition& part, const std::uint32_t slot, const std::uint8_t tag);
+
+	/**
+	 * Allocate the slots of a partition, rehashing the entries it already has.
+	 *
+	 * @param part   	Partition, with its latch held unless it is not in use yet
+	 * @param capacity  New number of slots, a power of two no smaller than HTGROUPSIZE
+   * @throws HashTableException If the slots could not be allocated
+	 */
+  static void resize(hashPartition& part, const std::uint32_t capacity);
 
  public:
 	/**
    * Constructor of BufHashTbl class
+	 *
+	 * @param htSize	Total number of slots to start with, spread over the partitions
 	 */
 	BufHashTbl(const int htSize);  // constructor
 
@@ -81,10 +147,33 @@ class BufHashTbl
 	 * @param pageNo 	Page number in the file
 	 * @param frameNo Frame number assigned to that page of the file
    * @throws  HashAlreadyPresentException	if the corresponding page already exists in the hash table
-   * @throws  HashTableException (optional) if could not create a new bucket as running of memory
+   * @throws  HashTableException if the partition of the page could not grow, running out of memory
 	 */
   void insert(const File* file, const PageId pageNo, const FrameId frameNo);
 
+	/**
+   * Insert entry into hash table mapping (file, pageNo) to frameNo, unless the page already has an entry.
+	 * Used on the buffer pool hot path, where a page entered by another thread is not an error.
+	 *
+	 * @param file   	File object
+	 * @param pageNo 	Page number in the file
+	 * @param frameNo Frame number assigned to that page of the file
+	 * @return				False if the page already has an entry, which is left as it is
+   * @throws  HashTableException if the partition of the page could not grow, running out of memory
+	 */
+  bool tryInsert(const File* file, const PageId pageNo, const FrameId frameNo);
+
+	/**
+   * Check if (file, pageNo) is currently in the buffer pool (ie. in
+   * the hash table), without throwing when it is not. Used on the buffer pool hot path.
+	 *
+	 * @param file  	File object
+	 * @param pageNo	Page number in the file
+	 * @param frameNo Frame number reference, set only if the page is found
+	 * @return				True if the page is in the hash table
+	 */
+  bool find(const File* file, const PageId pageNo, FrameId &frameNo);
+
 	/**
    * Check if (file, pageNo) is currently in the buffer pool (ie. in
    * the hash table).
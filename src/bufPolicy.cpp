@@ -0,0 +1,622 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "buffer.h"
+#include "bufPolicy.h"
+
+namespace badgerdb {
+
+namespace {
+
+// Number of most recent references LRU-K keeps for each page
+const int LRUK = 2;
+
+const FrameId NOFRAME = ~(FrameId)0;
+
+// A page identified the way the buffer pool hash table does, used for pages that have left the pool
+struct PageKey
+{
+  const File* file;
+  PageId pageNo;
+
+  PageKey() : file(NULL), pageNo(Page::INVALID_NUMBER) {}
+  PageKey(const File* fileIn, const PageId pageNoIn) : file(fileIn), pageNo(pageNoIn) {}
+
+  bool operator==(const PageKey& rhs) const
+  {
+    return file == rhs.file && pageNo == rhs.pageNo;
+  }
+};
+
+struct PageKeyHash
+{
+  std::size_t operator()(const PageKey& key) const
+  {
+    return std::hash<const void*>()(key.file) ^ ((std::size_t)key.pageNo * 0x9e3779b97f4a7c15ULL);
+  }
+};
+
+// Doubly linked lists threaded through per-frame arrays, a frame is in at most one of them at a time
+class FrameLists
+{
+ public:
+  FrameLists(const std::uint32_t bufs, const int numLists)
+    : prev(bufs, NOFRAME), next(bufs, NOFRAME), owners(bufs, -1),
+      heads(numLists, NOFRAME), tails(numLists, NOFRAME), sizes(numLists, 0)
+  {
+  }
+
+  void pushFront(const int list, const FrameId frame)
+  {
+    remove(frame);
+    prev[frame] = NOFRAME;
+    next[frame] = heads[list];
+    if (heads[list] != NOFRAME)
+      prev[heads[list]] = frame;
+    else
+      tails[list] = frame;
+    heads[list] = frame;
+    owners[frame] = list;
+    sizes[list]++;
+  }
+
+  void remove(const FrameId frame)
+  {
+    int list = owners[frame];
+    if (list < 0)
+      return;
+    if (prev[frame] != NOFRAME)
+      next[prev[frame]] = next[frame];
+    else
+      heads[list] = next[frame];
+    if (next[frame] != NOFRAME)
+      prev[next[frame]] = prev[frame];
+    else
+      tails[list] = prev[frame];
+    owners[frame] = -1;
+    sizes[list]--;
+  }
+
+  int owner(const FrameId frame) const { return owners[frame]; }
+  FrameId back(const int list) const { return tails[list]; }
+  FrameId towardsFront(const FrameId frame) const { return prev[frame]; }
+  std::uint32_t size(const int list) const { return sizes[list]; }
+
+ private:
+  std::vector<FrameId> prev;
+  std::vector<FrameId> next;
+  std::vector<int> owners;
+  std::vector<FrameId> heads;
+  std::vector<FrameId> tails;
+  std::vector<std::uint32_t> sizes;
+};
+
+// Pages that have left the buffer pool, most recent first
+class GhostList
+{
+ public:
+  void push(const PageKey& key)
+  {
+    erase(key);
+    order.push_front(key);
+    index[key] = order.begin();
+  }
+
+  bool erase(const PageKey& key)
+  {
+    Index::iterator it = index.find(key);
+    if (it == index.end())
+      return false;
+    order.erase(it->second);
+    index.erase(it);
+    return true;
+  }
+
+  bool contains(const PageKey& key) const { return index.count(key) != 0; }
+
+  void popOldest()
+  {
+    if (order.empty())
+      return;
+    index.erase(order.back());
+    order.pop_back();
+  }
+
+  const PageKey& oldest() const { return order.back(); }
+  std::uint32_t size() const { return (std::uint32_t)order.size(); }
+
+ private:
+  typedef std::unordered_map<PageKey, std::list<PageKey>::iterator, PageKeyHash> Index;
+  std::list<PageKey> order;
+  Index index;
+};
+
+// -----------------------------------------------------------------------------
+// Clock
+// -----------------------------------------------------------------------------
+
+class ClockPolicy : public ReplacementPolicy
+{
+ public:
+  ClockPolicy(BufDesc* descs, const std::uint32_t bufs)
+    : ReplacementPolicy(descs, bufs), clockHand(bufs - 1)
+  {
+  }
+
+  const char* name() const { return "clock"; }
+
+  void hit(const FrameId frame) { reference(frame); }
+
+  void loaded(const FrameId frame, const File* file, const PageId pageNo) { reference(frame); }
+
+  void freed(const FrameId frame) {}
+
+  bool claimVictim(FrameId& frame, const File* file, const PageId pageNo)
+  {
+    // Need to scan twice, the first pass may only clear reference bits
+    for (std::uint32_t numScanned = 0; numScanned < 2*numBufs; numScanned++)
+    {
+      FrameId hand = (clockHand.fetch_add(1) + 1) % numBufs;
+
+      // has been referenced, clear the bit
+      if (unreference(hand))
+        continue;
+
+      // not pinned or claimed by another thread, use it
+      if (claim(hand))
+      {
+        frame = hand;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void upcomingVictims(std::vector<FrameId>& frames, const std::uint32_t max)
+  {
+    // frames the hand reaches next whose reference bit is already clear
+    FrameId hand = clockHand.load() % numBufs;
+    for (std::uint32_t i = 1; i <= numBufs && frames.size() < max; i++)
+    {
+      FrameId f = (hand + i) % numBufs;
+      if (!referenced(f))
+        frames.push_back(f);
+    }
+  }
+
+ private:
+  std::atomic<FrameId> clockHand;
+};
+
+// -----------------------------------------------------------------------------
+// Policies keeping frames on lists
+// -----------------------------------------------------------------------------
+
+class ListPolicy : public ReplacementPolicy
+{
+ public:
+  ListPolicy(BufDesc* descs, const std::uint32_t bufs, const int numLists)
+    : ReplacementPolicy(descs, bufs), lists(bufs, numLists), pages(bufs)
+  {
+    // every frame starts out free
+    for (FrameId i = 0; i < bufs; i++)
+      lists.pushFront(FREE, i);
+  }
+
+  void freed(const FrameId frame)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    lists.pushFront(FREE, frame);
+  }
+
+ protected:
+  enum { FREE = 0 };
+
+  std::mutex latch;
+  FrameLists lists;
+
+  // Page each frame was last loaded with
+  std::vector<PageKey> pages;
+
+  // Claim the unpinned frame closest to the back of the list and take it off the list
+  bool claimBack(const int list, FrameId& frame)
+  {
+    for (FrameId f = lists.back(list); f != NOFRAME; f = lists.towardsFront(f))
+    {
+      if (claim(f))
+      {
+        lists.remove(f);
+        frame = f;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // List the frames of the list from the back, as claimBack would try them
+  void listBack(const int list, std::vector<FrameId>& frames, const std::uint32_t max) const
+  {
+    for (FrameId f = lists.back(list); f != NOFRAME && frames.size() < max; f = lists.towardsFront(f))
+      frames.push_back(f);
+  }
+};
+
+// -----------------------------------------------------------------------------
+// LRU-K
+// -----------------------------------------------------------------------------
+
+class LruKPolicy : public ListPolicy
+{
+ public:
+  LruKPolicy(BufDesc* descs, const std::uint32_t bufs)
+    : ListPolicy(descs, bufs, NUMLISTS), now(0), history(bufs)
+  {
+  }
+
+  const char* name() const { return "lru-2"; }
+
+  void hit(const FrameId frame)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    if (lists.owner(frame) == RESIDENT)
+    {
+      ranked.erase(rankOf(frame));
+      record(history[frame]);
+      ranked.insert(rankOf(frame));
+    }
+  }
+
+  void freed(const FrameId frame)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    if (lists.owner(frame) == RESIDENT)
+      ranked.erase(rankOf(frame));
+    lists.pushFront(FREE, frame);
+  }
+
+  void loaded(const FrameId frame, const File* file, const PageId pageNo)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    if (lists.owner(frame) == RESIDENT)
+      ranked.erase(rankOf(frame));
+    PageKey key(file, pageNo);
+    pages[frame] = key;
+
+    // a page seen before keeps the references it had when it was evicted
+    Retained::iterator it = retained.find(key);
+    if (it != retained.end())
+    {
+      history[frame] = it->second;
+      retained.erase(it);
+      retainedOrder.erase(key);
+    }
+    else
+    {
+      history[frame] = References();
+    }
+
+    record(history[frame]);
+    lists.pushFront(RESIDENT, frame);
+    ranked.insert(rankOf(frame));
+  }
+
+  bool claimVictim(FrameId& frame, const File* file, const PageId pageNo)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    if (claimBack(FREE, frame))
+      return true;
+
+    for (Ranked::iterator it = ranked.begin(); it != ranked.end(); ++it)
+    {
+      FrameId f = it->second;
+      if (claim(f))
+      {
+        ranked.erase(it);
+        lists.remove(f);
+        retain(pages[f], history[f]);
+        frame = f;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void upcomingVictims(std::vector<FrameId>& frames, const std::uint32_t max)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    listBack(FREE, frames, max);
+
+    for (Ranked::const_iterator it = ranked.begin(); it != ranked.end() && frames.size() < max; ++it)
+      frames.push_back(it->second);
+  }
+
+ private:
+  enum { RESIDENT = 1, NUMLISTS = 2 };
+
+  // Logical times of the most recent references, most recent first, 0 if there was none
+  struct References
+  {
+    std::uint64_t times[LRUK];
+    References() { std::fill(times, times + LRUK, 0); }
+  };
+
+  typedef std::unordered_map<PageKey, References, PageKeyHash> Retained;
+
+  // Place of a resident frame in the replacement order: the K-th most recent reference, 0 for pages with fewer
+  // than K, then the most recent one
+  typedef std::pair<std::pair<std::uint64_t, std::uint64_t>, FrameId> Rank;
+  typedef std::set<Rank> Ranked;
+
+  Rank rankOf(const FrameId frame) const
+  {
+    return Rank(std::make_pair(history[frame].times[LRUK - 1], history[frame].times[0]), frame);
+  }
+
+  void record(References& refs)
+  {
+    std::copy_backward(refs.times, refs.times + LRUK - 1, refs.times + LRUK);
+    refs.times[0] = ++now;
+  }
+
+  // Keep the references of an evicted page, for as many pages as there are frames
+  void retain(const PageKey& key, const References& refs)
+  {
+    if (key.pageNo == Page::INVALID_NUMBER)
+      return;
+    retained[key] = refs;
+    retainedOrder.push(key);
+    if (retainedOrder.size() > numBufs)
+    {
+      retained.erase(retainedOrder.oldest());
+      retainedOrder.popOldest();
+    }
+  }
+
+  std::uint64_t now;
+  std::vector<References> history;
+
+  // Resident frames in the order they are replaced, kept up to date by every reference
+  Ranked ranked;
+
+  Retained retained;
+  GhostList retainedOrder;
+};
+
+// -----------------------------------------------------------------------------
+// 2Q
+// -----------------------------------------------------------------------------
+
+class TwoQueuePolicy : public ListPolicy
+{
+ public:
+  TwoQueuePolicy(BufDesc* descs, const std::uint32_t bufs)
+    : ListPolicy(descs, bufs, NUMLISTS),
+      inSize(std::max<std::uint32_t>(1, bufs / 4)),
+      outSize(std::max<std::uint32_t>(1, bufs / 2))
+  {
+  }
+
+  const char* name() const { return "2q"; }
+
+  void hit(const FrameId frame)
+  {
+    // a hit while the page is on the FIFO queue is taken as part of its first use
+    std::lock_guard<std::mutex> guard(latch);
+    if (lists.owner(frame) == AM)
+      lists.pushFront(AM, frame);
+  }
+
+  void loaded(const FrameId frame, const File* file, const PageId pageNo)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    PageKey key(file, pageNo);
+    pages[frame] = key;
+
+    // back soon after leaving the FIFO queue, so it is hot
+    if (a1out.erase(key))
+      lists.pushFront(AM, frame);
+    else
+      lists.pushFront(A1IN, frame);
+  }
+
+  bool claimVictim(FrameId& frame, const File* file, const PageId pageNo)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    if (claimBack(FREE, frame))
+      return true;
+
+    int first = firstList();
+    int second = first == A1IN ? AM : A1IN;
+    return claimFrom(first, frame) || claimFrom(second, frame);
+  }
+
+  void upcomingVictims(std::vector<FrameId>& frames, const std::uint32_t max)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    int first = firstList();
+    listBack(FREE, frames, max);
+    listBack(first, frames, max);
+    listBack(first == A1IN ? AM : A1IN, frames, max);
+  }
+
+ private:
+  enum { A1IN = 1, AM = 2, NUMLISTS = 3 };
+
+  // Queue a victim is taken from first, the FIFO one while it is over its share
+  int firstList() const
+  {
+    return (lists.size(A1IN) > inSize || lists.size(AM) == 0) ? A1IN : AM;
+  }
+
+  bool claimFrom(const int list, FrameId& frame)
+  {
+    if (!claimBack(list, frame))
+      return false;
+
+    if (list == A1IN && pages[frame].pageNo != Page::INVALID_NUMBER)
+    {
+      a1out.push(pages[frame]);
+      if (a1out.size() > outSize)
+        a1out.popOldest();
+    }
+    return true;
+  }
+
+  std::uint32_t inSize;
+  std::uint32_t outSize;
+  GhostList a1out;
+};
+
+// -----------------------------------------------------------------------------
+// ARC
+// -----------------------------------------------------------------------------
+
+class ArcPolicy : public ListPolicy
+{
+ public:
+  ArcPolicy(BufDesc* descs, const std::uint32_t bufs)
+    : ListPolicy(descs, bufs, NUMLISTS), target(0)
+  {
+  }
+
+  const char* name() const { return "arc"; }
+
+  void hit(const FrameId frame)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    if (lists.owner(frame) == T1 || lists.owner(frame) == T2)
+      lists.pushFront(T2, frame);
+  }
+
+  void loaded(const FrameId frame, const File* file, const PageId pageNo)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    PageKey key(file, pageNo);
+    pages[frame] = key;
+
+    if (b1.erase(key) || b2.erase(key))
+      lists.pushFront(T2, frame);
+    else
+      lists.pushFront(T1, frame);
+
+    // keep T1 + B1 within c pages and all four lists within 2c
+    while (lists.size(T1) + b1.size() > numBufs && b1.size() > 0)
+      b1.popOldest();
+    while (lists.size(T1) + lists.size(T2) + b1.size() + b2.size() > 2*numBufs && b2.size() > 0)
+      b2.popOldest();
+  }
+
+  bool claimVictim(FrameId& frame, const File* file, const PageId pageNo)
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    PageKey key(file, pageNo);
+
+    // A miss on a page recently evicted from T1 means T1 should have been larger, one from T2 means smaller
+    bool inB2 = false;
+    if (b1.contains(key))
+    {
+      target = std::min(numBufs, target + std::max<std::uint32_t>(b2.size() / b1.size(), 1));
+    }
+    else if (b2.contains(key))
+    {
+      inB2 = true;
+      std::uint32_t step = std::max<std::uint32_t>(b1.size() / b2.size(), 1);
+      target = target > step ? target - step : 0;
+    }
+
+    if (claimBack(FREE, frame))
+      return true;
+
+    std::uint32_t t1 = lists.size(T1);
+    bool fromT1 = t1 > 0 && (t1 > target || (inB2 && t1 == target));
+    return evict(fromT1 ? T1 : T2, frame) || evict(fromT1 ? T2 : T1, frame);
+  }
+
+  void upcomingVictims(std::vector<FrameId>& frames, const std::uint32_t max)
+  {
+    // as for a miss on a page in neither ghost list
+    std::lock_guard<std::mutex> guard(latch);
+    bool fromT1 = lists.size(T1) > target;
+    listBack(FREE, frames, max);
+    listBack(fromT1 ? T1 : T2, frames, max);
+    listBack(fromT1 ? T2 : T1, frames, max);
+  }
+
+ private:
+  enum { T1 = 1, T2 = 2, NUMLISTS = 3 };
+
+  bool evict(const int list, FrameId& frame)
+  {
+    if (!claimBack(list, frame))
+      return false;
+
+    if (pages[frame].pageNo != Page::INVALID_NUMBER)
+      (list == T1 ? b1 : b2).push(pages[frame]);
+    return true;
+  }
+
+  // Target size of T1
+  std::uint32_t target;
+  GhostList b1;
+  GhostList b2;
+};
+
+}
+
+// -----------------------------------------------------------------------------
+// ReplacementPolicy
+// -----------------------------------------------------------------------------
+
+ReplacementPolicy::ReplacementPolicy(BufDesc* descs, const std::uint32_t bufs)
+  : bufDescTable(descs), numBufs(bufs)
+{
+}
+
+ReplacementPolicy* ReplacementPolicy::create(const BufPolicy policy, BufDesc* descs, const std::uint32_t bufs)
+{
+  switch (policy)
+  {
+    case POLICY_LRU2:
+      return new LruKPolicy(descs, bufs);
+    case POLICY_2Q:
+      return new TwoQueuePolicy(descs, bufs);
+    case POLICY_ARC:
+      return new ArcPolicy(descs, bufs);
+    default:
+      return new ClockPolicy(descs, bufs);
+  }
+}
+
+bool ReplacementPolicy::claim(const FrameId frame)
+{
+  return bufDescTable[frame].Claim();
+}
+
+void ReplacementPolicy::reference(const FrameId frame)
+{
+  bufDescTable[frame].refbit = true;
+}
+
+bool ReplacementPolicy::unreference(const FrameId frame)
+{
+  return bufDescTable[frame].refbit.exchange(false);
+}
+
+bool ReplacementPolicy::referenced(const FrameId frame) const
+{
+  return bufDescTable[frame].refbit;
+}
+
+}
@@ -0,0 +1,156 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "types.h"
+#include "file.h"
+
+namespace badgerdb {
+
+class BufDesc;
+
+/**
+ * @brief Buffer replacement policies a BufMgr can be constructed with.
+ */
+enum BufPolicy
+{
+	/**
+	 * Two-pass clock over a reference bit per frame.
+	 */
+	POLICY_CLOCK = 0,
+
+	/**
+	 * LRU-K with K = 2: replaces the page whose second most recent reference is oldest. Pages referenced only once,
+	 * such as those of a sequential scan, go first.
+	 */
+	POLICY_LRU2 = 1,
+
+	/**
+	 * 2Q: pages enter a FIFO queue and only move to the LRU queue of hot pages when they are referenced again after
+	 * leaving it.
+	 */
+	POLICY_2Q = 2,
+
+	/**
+	 * ARC: balances a list of pages seen once against a list of pages seen again, adapting the split to hits on the
+	 * pages recently evicted from each.
+	 */
+	POLICY_ARC = 3
+};
+
+/**
+* @brief Decides which frame of the buffer pool is replaced when a page has to be brought in.
+*
+* BufMgr reports every hit, every page loaded into a frame and every frame emptied by other means, and asks for a
+* victim when it needs a frame. A victim is returned claimed (see BufDesc), which a policy does with claim(), so pinned
+* frames are never chosen. Every method may be called from many threads at once.
+*/
+class ReplacementPolicy
+{
+ public:
+	/**
+   * Constructor of ReplacementPolicy class
+	 *
+	 * @param descs		Frame descriptors of the buffer pool
+	 * @param bufs		Number of frames in the buffer pool
+	 */
+  ReplacementPolicy(BufDesc* descs, const std::uint32_t bufs);
+
+  virtual ~ReplacementPolicy() {}
+
+	/**
+   * Name of the policy, as recorded in BufStats
+	 */
+  virtual const char* name() const = 0;
+
+	/**
+   * A page already in the frame was pinned.
+	 *
+	 * @param frame		Frame of the page
+	 */
+  virtual void hit(const FrameId frame) = 0;
+
+	/**
+   * A page was read into the frame, or allocated in it, and is about to become visible to other threads.
+	 *
+	 * @param frame		Frame the page was loaded into
+	 * @param file		File object
+	 * @param pageNo	Page number in the file
+	 */
+  virtual void loaded(const FrameId frame, const File* file, const PageId pageNo) = 0;
+
+	/**
+   * The frame was emptied without being chosen as a victim, or a frame returned by claimVictim was not used.
+	 *
+	 * @param frame		Frame that is free again
+	 */
+  virtual void freed(const FrameId frame) = 0;
+
+	/**
+   * Choose a frame to bring a page into and claim it.
+	 *
+	 * @param frame		Claimed frame returned via this variable
+	 * @param file		File object of the page that will be brought in
+	 * @param pageNo	Page number of that page, Page::INVALID_NUMBER for a page that is being allocated
+	 * @return False if no frame could be claimed, all of them being pinned
+	 */
+  virtual bool claimVictim(FrameId& frame, const File* file, const PageId pageNo) = 0;
+
+	/**
+   * List the frames the policy is about to choose as victims, the first to go first, without claiming them or
+   * changing its state. The background writer of BufMgr cleans the dirty pages among them before they are chosen.
+	 *
+	 * @param frames	Frames appended to this vector
+	 * @param max		Most frames to list
+	 */
+  virtual void upcomingVictims(std::vector<FrameId>& frames, const std::uint32_t max) = 0;
+
+	/**
+   * Create a policy of the given kind.
+	 *
+	 * @param policy	Kind of policy
+	 * @param descs		Frame descriptors of the buffer pool
+	 * @param bufs		Number of frames in the buffer pool
+	 */
+  static ReplacementPolicy* create(const BufPolicy policy, BufDesc* descs, const std::uint32_t bufs);
+
+ protected:
+	/**
+   * Frame descriptors of the buffer pool
+	 */
+  BufDesc* bufDescTable;
+
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::uint32_t numBufs;
+
+	/**
+   * Claim the frame if it is neither pinned nor claimed.
+	 */
+  bool claim(const FrameId frame);
+
+	/**
+   * Set the reference bit of the frame.
+	 */
+  void reference(const FrameId frame);
+
+	/**
+   * Clear the reference bit of the frame, returning whether it was set.
+	 */
+  bool unreference(const FrameId frame);
+
+	/**
+   * Whether the reference bit of the frame is set.
+	 */
+  bool referenced(const FrameId frame) const;
+};
+
+}
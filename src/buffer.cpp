@@ -7,12 +7,17 @@
 
 #include <memory>
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
 #include "buffer.h"
 #include "exceptions/buffer_exceeded_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/page_pinned_exception.h"
 #include "exceptions/bad_buffer_exception.h"
 #include "exceptions/hash_not_found_exception.h"
+#include "exceptions/invalid_page_exception.h"
 
 namespace badgerdb { 
 
@@ -20,8 +25,8 @@ namespace badgerdb {
 // Constructor of the class BufMgr
 //----------------------------------------
 
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
+BufMgr::BufMgr(std::uint32_t bufs, const BufPolicy policyIn)
+	: numBufs(bufs), writerStop(false), writerWanted(false) {
 	bufDescTable = new BufDesc[bufs];
 
   for (FrameId i = 0; i < bufs; i++) 
@@ -35,11 +40,34 @@ BufMgr::BufMgr(std::uint32_t bufs)
   int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
   hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
 
-  clockHand = bufs - 1;
+  policy = ReplacementPolicy::create(policyIn, bufDescTable, bufs);
+  bufStats.policy = policy->name();
+
+  io = PageIo::create();
+  bufStats.io = io->name();
+  frameIo = new FrameIo[bufs];
+  for (FrameId i = 0; i < bufs; i++)
+  {
+    frameIo[i].bufMgr = this;
+    frameIo[i].frameNo = i;
+  }
+
+  writer = std::thread(&BufMgr::backgroundWrite, this);
 }
 
 
 BufMgr::~BufMgr() {
+  // Stop the background writer before the frames go away
+  {
+    std::lock_guard<std::mutex> guard(writerLatch);
+    writerStop = true;
+  }
+  writerWake.notify_one();
+  writer.join();
+
+  // Wait for the reads and writes in flight
+  delete io;
+
   //Flush out all unwritten pages
   for (std::uint32_t i = 0; i < numBufs; i++) 
   {
@@ -50,104 +78,379 @@ BufMgr::~BufMgr() {
   	}
   }
 
+  delete policy;
+  delete [] frameIo;
   delete [] bufDescTable;
   delete [] bufPool;
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+void BufMgr::allocBuf(FrameId & frame, const File* file, const PageId pageNo, BufRing* ring)
 {
-  // perform first part of clock algorithm to search for 
-  // open buffer frame
-  // Assumes non-concurrent access to buffer manager
-  std::uint32_t numScanned = 0;
-  bool found = 0;
+  // check for full buffer pool
+  if (!tryAllocBuf(frame, file, pageNo, ring))
+  {
+    throw BufferExceededException();
+  }
+}
+
 
-  while (numScanned < 2*numBufs)	//Need to scn twice
+bool BufMgr::tryAllocBuf(FrameId & frame, const File* file, const PageId pageNo, BufRing* ring)
+{
+  // a scan reading through a ring recycles its own frame when it can, otherwise the policy picks the frame and
+  // claims it
+  if ((ring == NULL || !claimRingFrame(ring, frame)) && !policy->claimVictim(frame, file, pageNo))
   {
-    // advance the clock
-    advanceClock();
-    numScanned++;
+    return false;
+  }
+  BufDesc* tmpbuf = &bufDescTable[frame];
 
-    // if invalid, use frame
-    if (! bufDescTable[clockHand].valid)
+  if (tmpbuf->valid)
+  {
+    // write the page back while the hash table still leads to this frame, so no thread can read
+    // the old copy from disk in the meantime
+    if (tmpbuf->dirty)
     {
-      break;
-    }
+      // the background writer did not get to this page in time, have it look further ahead now
+      {
+        std::lock_guard<std::mutex> guard(writerLatch);
+        writerWanted = true;
+      }
+      writerWake.notify_one();
 
-    // is valid, check referenced bit
-    if (! bufDescTable[clockHand].refbit)
-    {
-      // check to see if someone has it pinned
-      if (bufDescTable[clockHand].pinCnt == 0)
+      bufStats.diskwrites++;
+      try
+      {
+        tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[frame]);
+      }
+      catch(...)
       {
-        // hasn't been referenced and is not pinned, use it
-        // remove previous entry from hash table
-        hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
-        found = true;
-        break;
+        // the page stays resident and dirty, hand the frame back to the policy so the write can be retried
+        policy->loaded(frame, tmpbuf->file, tmpbuf->pageNo);
+        tmpbuf->Release();
+        throw;
       }
     }
+
+    // remove previous entry from hash table
+    hashTable->remove(tmpbuf->file, tmpbuf->pageNo);
+  }
+
+  //Reset all the BufDesc entry for the frame before returning the frame, keeping the claim
+  tmpbuf->file = NULL;
+  tmpbuf->pageNo = Page::INVALID_NUMBER;
+  tmpbuf->dirty = false;
+  tmpbuf->valid = false;
+  tmpbuf->ring = ring;
+
+  // the frame takes the place of the one in the current slot of the ring
+  if (ring != NULL)
+  {
+    BufRing::Slot& slot = ring->slots[ring->current];
+    slot.file = file;
+    slot.pageNo = pageNo;
+    slot.frameNo = frame;
+    ring->current = (ring->current + 1) % ring->slots.size();
+  }
+  return true;
+} // end tryAllocBuf
+
+
+bool BufMgr::claimRingFrame(BufRing* ring, FrameId & frame)
+{
+  const BufRing::Slot& slot = ring->slots[ring->current];
+  if (slot.file == NULL)
+  {
+    return false;
+  }
+
+  BufDesc* tmpbuf = &bufDescTable[slot.frameNo];
+  if (!tmpbuf->Claim())
+  {
+    return false;
+  }
+
+  // the frame may have been replaced, or its page wanted by another reader, since the ring loaded it
+  if (!tmpbuf->valid || tmpbuf->ring != ring || tmpbuf->file != slot.file || tmpbuf->pageNo != slot.pageNo)
+  {
+    tmpbuf->Release();
+    return false;
+  }
+
+  frame = slot.frameNo;
+  return true;
+}
+
+
+void BufMgr::backgroundWrite()
+{
+  std::unique_lock<std::mutex> lock(writerLatch);
+  while (!writerStop)
+  {
+    writerWanted = false;
+    lock.unlock();
+    std::uint32_t written = writeAhead();
+    lock.lock();
+
+    // a full batch means there may be more to write right away
+    if (written < BGWRITERBATCH && !writerWanted && !writerStop)
+    {
+      writerWake.wait_for(lock, std::chrono::milliseconds(BGWRITERDELAY));
+    }
+  }
+}
+
+
+std::uint32_t BufMgr::writeAhead()
+{
+  std::vector<FrameId> frames;
+  policy->upcomingVictims(frames, std::min(numBufs, BGWRITERLOOKAHEAD));
+
+  // claim the dirty frames so their pages can neither change nor be replaced while they are written
+  std::vector<std::pair<std::pair<const File*, PageId>, FrameId> > batch;
+  for (std::size_t i = 0; i < frames.size() && batch.size() < BGWRITERBATCH; i++)
+  {
+    BufDesc* tmpbuf = &bufDescTable[frames[i]];
+    if (!tmpbuf->dirty || !tmpbuf->Claim())
+      continue;
+
+    if (tmpbuf->valid && tmpbuf->dirty)
+      batch.push_back(std::make_pair(std::make_pair(tmpbuf->file, tmpbuf->pageNo), frames[i]));
     else
+      tmpbuf->Release();
+  }
+
+  // write in page order, so the pages of a file go to disk in one sweep, all at once where the file allows
+  std::sort(batch.begin(), batch.end());
+  std::vector<IoRequest*> requests;
+  for (std::size_t i = 0; i < batch.size(); i++)
+  {
+    BufDesc* tmpbuf = &bufDescTable[batch[i].second];
+    FrameIo* request = &frameIo[batch[i].second];
+    if (tmpbuf->file->prepareWrite(*request, tmpbuf->pageNo, &bufPool[batch[i].second]))
     {
-      // has been referenced, clear the bit
-      bufStats.accesses++;
-      bufDescTable[clockHand].refbit = false;
+      request->file = tmpbuf->file;
+      request->pageNo = tmpbuf->pageNo;
+      requests.push_back(request);
+      continue;
     }
+
+    try
+    {
+      tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[batch[i].second]);
+      tmpbuf->dirty = false;
+      bufStats.diskwrites++;
+      bufStats.bgwrites++;
+    }
+    catch(...)
+    {
+      // leave the page dirty, whoever replaces the frame writes it and sees the error
+    }
+    tmpbuf->Release();
   }
-  
-  // check for full buffer pool
-  if (!found && numScanned >= 2*numBufs)
+
+  if (!requests.empty())
   {
-    throw BufferExceededException();
+    try
+    {
+      io->submit(&requests[0], (std::uint32_t)requests.size());
+    }
+    catch(...)
+    {
+      // the requests not started completed with the error, their pages stay dirty
+    }
   }
-  
-  // flush any existing changes to disk if necessary
-  if (bufDescTable[clockHand].dirty)
+  return (std::uint32_t)batch.size();
+}
+
+
+void BufMgr::writeDone(FrameIo& request, const int error)
+{
+  BufDesc* tmpbuf = &bufDescTable[request.frameNo];
+
+  // on an error the page stays dirty, whoever replaces the frame writes it and sees the error
+  if (error == 0)
   {
+    tmpbuf->dirty = false;
     bufStats.diskwrites++;
-    //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
-    bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
+    bufStats.bgwrites++;
+  }
+  tmpbuf->Release();
+}
+
+
+void FrameIo::complete(const int error)
+{
+  if (write)
+    bufMgr->writeDone(*this, error);
+  else
+    bufMgr->readDone(*this, error);
+}
+
+
+bool BufMgr::pinResident(File* file, const PageId pageNo, FrameId & frame)
+{
+  while (true)
+  {
+    if (!hashTable->find(file, pageNo, frame))
+    {
+      return false;
+    }
+
+    BufDesc* tmpbuf = &bufDescTable[frame];
+    if (tmpbuf->Pin())
+    {
+      // the frame may have been given to another page between the lookup and the pin
+      if (tmpbuf->valid && tmpbuf->file == file && tmpbuf->pageNo == pageNo)
+      {
+        return true;
+      }
+      tmpbuf->Unpin();
+    }
+
+    // another thread is loading or replacing the frame, look again once it is done
+    std::this_thread::yield();
   }
+}
 
-	//Reset all the BufDesc entry for the frame before returning the frame
-  bufDescTable[clockHand].Clear();
 
-  // return new frame number
-  frame = clockHand;
-} // end allocBuf
+bool BufMgr::loadPage(File* file, const PageId pageNo, const FrameId frame)
+{
+  BufDesc* tmpbuf = &bufDescTable[frame];
+
+  // enter the page in the hash table before reading it, other threads wait on the claim until it is loaded
+  tmpbuf->file = file;
+  tmpbuf->pageNo = pageNo;
+  if (!hashTable->tryInsert(file, pageNo, frame))
+  {
+    tmpbuf->Clear();
+    policy->freed(frame);
+    return false;
+  }
+
+  // read the page into the new frame
+  try
+  {
+    bufStats.diskreads++;
+    file->readPageInto(pageNo, &bufPool[frame]);
+  }
+  catch(...)
+  {
+    hashTable->remove(file, pageNo);
+    tmpbuf->Clear();
+    policy->freed(frame);
+    throw;
+  }
+
+  // set up the entry properly
+  policy->loaded(frame, file, pageNo);
+  tmpbuf->Set(file, pageNo);
+  return true;
+}
 
 	
-void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
+void BufMgr::readPage(File* file, const PageId pageNo, Page*& page, BufRing* ring)
 {
-  // check to see if it is already in the buffer pool
-  // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
+  // check to see if it is already in the buffer pool, otherwise read it in, unless
+  // another thread gets there first
+  bufStats.accesses++;
   FrameId frameNo = 0;
-	try
-	{
-  	hashTable->lookup(file, pageNo, frameNo);
+  while (!pinResident(file, pageNo, frameNo))
+  {
+    // alloc a new frame
+    allocBuf(frameNo, file, pageNo, ring);
+    if (loadPage(file, pageNo, frameNo))
+    {
+      page = &bufPool[frameNo];
+      return;
+    }
+  }
+
+  bufStats.hits++;
+  policy->hit(frameNo);
 
-    // set the referenced bit
-    bufDescTable[frameNo].refbit = true;
-    bufDescTable[frameNo].pinCnt++;
-    page = &bufPool[frameNo];
+  // a page loaded by a ring and wanted outside it is no longer recycled by the ring
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  if (tmpbuf->ring != NULL && tmpbuf->ring != ring)
+  {
+    tmpbuf->ring = NULL;
   }
-  catch(HashNotFoundException e) //not in the buffer pool, must allocate a new page
+  page = &bufPool[frameNo];
+}
+
+
+void BufMgr::prefetchPage(File* file, const PageId pageNo, BufRing* ring)
+{
+  prefetchPages(file, &pageNo, 1, ring);
+}
+
+
+void BufMgr::prefetchPages(File* file, const PageId* pageNos, const std::uint32_t count, BufRing* ring)
+{
+  std::vector<IoRequest*> requests;
+  for (std::uint32_t i = 0; i < count; i++)
   {
-    // alloc a new frame
-    allocBuf(frameNo);
+    FrameId frameNo = 0;
+    if (hashTable->find(file, pageNos[i], frameNo))
+      continue;
+
+    // read-ahead is only a hint, stop when no frame can be freed
+    if (!tryAllocBuf(frameNo, file, pageNos[i], ring))
+      break;
 
-    // read the page into the new frame
+    // enter the page in the hash table while the frame is claimed, readers wait for the read to complete
+    BufDesc* tmpbuf = &bufDescTable[frameNo];
+    tmpbuf->file = file;
+    tmpbuf->pageNo = pageNos[i];
+    if (!hashTable->tryInsert(file, pageNos[i], frameNo))
+    {
+      tmpbuf->Clear();
+      policy->freed(frameNo);
+      continue;
+    }
+
+    FrameIo* request = &frameIo[frameNo];
+    request->file = file;
+    request->pageNo = pageNos[i];
+    file->prepareRead(*request, pageNos[i], &bufPool[frameNo]);
+    requests.push_back(request);
     bufStats.diskreads++;
-    //status = file->readPage(pageNo, &bufPool[frameNo]);
-    bufPool[frameNo] = file->readPage(pageNo);
+  }
+
+  if (!requests.empty())
+  {
+    io->submit(&requests[0], (std::uint32_t)requests.size());
+  }
+}
 
-    // set up the entry properly
-    bufDescTable[frameNo].Set(file, pageNo);
-    page = &bufPool[frameNo];
 
-    // insert in the hash table
-    hashTable->insert(file, pageNo, frameNo);
+void BufMgr::readDone(FrameIo& request, int error)
+{
+  BufDesc* tmpbuf = &bufDescTable[request.frameNo];
+  if (error == 0)
+  {
+    try
+    {
+      request.file->checkRead(request.pageNo, bufPool[request.frameNo]);
+    }
+    catch(InvalidPageException&)
+    {
+      error = EINVAL;
+    }
+  }
+
+  // drop a page that could not be read, a readPage of it reads it again and sees the error
+  if (error != 0)
+  {
+    hashTable->remove(request.file, request.pageNo);
+    tmpbuf->Clear();
+    policy->freed(request.frameNo);
+    return;
   }
+
+  // the frame stays referenced but unpinned
+  policy->loaded(request.frameNo, request.file, request.pageNo);
+  tmpbuf->Set(request.file, request.pageNo);
+  tmpbuf->Unpin();
 }
 
 
@@ -161,36 +464,46 @@ void BufMgr::unPinPage(File* file, const PageId pageNo,
   if (dirty == true) bufDescTable[frameNo].dirty = dirty;
 
   // make sure the page is actually pinned
-  if (bufDescTable[frameNo].pinCnt == 0)
+  if (!bufDescTable[frameNo].Unpin())
   {
   	throw PageNotPinnedException(file->filename(), pageNo, frameNo);
   }
-  else bufDescTable[frameNo].pinCnt--;
 }
 
 void BufMgr::flushFile(const File* file) 
 {
+  // no frame may be claimed by a read or write in flight
+  io->drain();
+
   for (std::uint32_t i = 0; i < numBufs; i++)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
   	if(tmpbuf->valid == true && tmpbuf->file == file)
 		{
-	    if (tmpbuf->pinCnt > 0)
-  			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+	    // the background writer holds its frames claimed only while writing them
+	    while (!tmpbuf->Claim())
+	    {
+	      if (tmpbuf->pinCnt > 0)
+	  			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+	      std::this_thread::yield();
+	    }
 
 	    if (tmpbuf->dirty == true)
 			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
 				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
 				tmpbuf->dirty = false;
     	}
 
     	hashTable->remove(file,tmpbuf->pageNo);
     	tmpbuf->Clear();
+    	policy->freed(i);
   	}
 		else if (tmpbuf->valid == false && tmpbuf->file == file)
   		throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
   }
+
+  // the pages written out are described by the header kept in memory
+  file->flushHeader();
 }
 
 void BufMgr::disposePage(File* file, const PageId pageNo) 
@@ -200,10 +513,16 @@ void BufMgr::disposePage(File* file, const PageId pageNo)
   FrameId frameNo = 0;
   hashTable->lookup(file, pageNo, frameNo);
 
-	// clear the page
-	bufDescTable[frameNo].Clear();
+  // wait for the background writer if it is writing the page
+  while (!bufDescTable[frameNo].Claim() && bufDescTable[frameNo].pinCnt == BufDesc::CLAIMED)
+  {
+    std::this_thread::yield();
+  }
 
+	// clear the page
 	hashTable->remove(file, pageNo);
+	bufDescTable[frameNo].Clear();
+	policy->freed(frameNo);
 
   // deallocate it in the file	
   file->deletePage(pageNo);
@@ -215,14 +534,23 @@ void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
   FrameId frameNo;
 
   // alloc a new frame
-  allocBuf(frameNo);
+  allocBuf(frameNo, file, Page::INVALID_NUMBER);
 
   // allocate a new page in the file
-	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
-  bufPool[frameNo] = file->allocatePage(pageNo);
+  try
+  {
+    file->allocatePageInto(pageNo, &bufPool[frameNo]);
+  }
+  catch(...)
+  {
+    bufDescTable[frameNo].Clear();
+    policy->freed(frameNo);
+    throw;
+  }
   page = &bufPool[frameNo];
 
   // set up the entry properly
+  policy->loaded(frameNo, file, pageNo);
   bufDescTable[frameNo].Set(file, pageNo);
 
   // insert in the hash table
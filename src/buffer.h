@@ -9,7 +9,14 @@
 
 #include "file.h"
 #include "bufHashTbl.h"
+#include "bufPolicy.h"
+#include "pageIo.h"
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
 
 namespace badgerdb {
 
@@ -18,15 +25,51 @@ namespace badgerdb {
 */
 class BufMgr;
 
+/**
+* forward declaration of BufRing class 
+*/
+class BufRing;
+
+/**
+ * @brief Default number of frames in the ring of a scan that reads through a BufRing.
+ */
+const std::uint32_t BUFRINGSIZE = 16;
+
+/**
+ * @brief Number of frames the replacement policy is about to replace that the background writer looks at in a round.
+ */
+const std::uint32_t BGWRITERLOOKAHEAD = 64;
+
+/**
+ * @brief Most dirty pages the background writer writes in a round.
+ */
+const std::uint32_t BGWRITERBATCH = 32;
+
+/**
+ * @brief Milliseconds the background writer waits between rounds, unless a thread had to write a victim itself.
+ */
+const int BGWRITERDELAY = 20;
+
 /**
 * @brief Class for maintaining information about buffer pool frames
+*
+* A frame is claimed by swapping its pin count from 0 to CLAIMED. Only the thread holding the claim
+* changes the file, pageNo and valid fields, which is how a frame is replaced or loaded. Pinning a
+* frame bumps a pin count that is not CLAIMED, so a pinned frame cannot be claimed and a claimed
+* frame cannot be pinned.
 */
 class BufDesc {
 
 	friend class BufMgr;
+	friend class ReplacementPolicy;
 
  private:
 	/**
+	 * Pin count of a frame that is being replaced or loaded
+	 */
+	enum { CLAIMED = -1 };
+
+	/**
    * Pointer to file to which corresponding frame is assigned
 	 */
   File* file;
@@ -42,14 +85,14 @@ class BufDesc {
   FrameId	frameNo;
 
 	/**
-   * Number of times this page has been pinned
+   * Number of times this page has been pinned, CLAIMED while the frame is claimed
 	 */
-  int pinCnt;
+  std::atomic<int> pinCnt;
 
 	/**
    * True if page is dirty;  false otherwise
 	 */
-  bool dirty;
+  std::atomic<bool> dirty;
 
 	/**
    * True if page is valid
@@ -59,24 +102,31 @@ class BufDesc {
 	/**
    * Has this buffer frame been reference recently
 	 */
-  bool refbit;
+  std::atomic<bool> refbit;
 
 	/**
-   * Initialize buffer frame for a new user
+   * Ring the page was loaded through, NULL if it was not or once a reader outside that ring has pinned it
+	 */
+  std::atomic<const BufRing*> ring;
+
+	/**
+   * Initialize buffer frame for a new user. Releases the claim on the frame.
 	 */
   void Clear()
 	{
-    pinCnt = 0;
 		file = NULL;
 		pageNo = Page::INVALID_NUMBER;
     dirty = false;
     refbit = false;
 		valid = false;
+    ring = NULL;
+    pinCnt = 0;
   };
 
 	/**
 	 * Set values of member variables corresponding to assignment of frame to a page in the file. Called when a frame 
-	 * in buffer pool is allocated to any page in the file through readPage() or allocPage()
+	 * in buffer pool is allocated to any page in the file through readPage() or allocPage(). Turns the claim on the
+	 * frame into a single pin.
 	 *
 	 * @param filePtr	File object
 	 * @param pageNum	Page number in the file
@@ -85,10 +135,61 @@ class BufDesc {
 	{ 
 		file = filePtr;
     pageNo = pageNum;
-    pinCnt = 1;
     dirty = false;
     valid = true;
     refbit = true;
+    pinCnt = 1;
+  }
+
+	/**
+	 * Claim the frame if it is not pinned or claimed.
+	 *
+	 * @return True if the frame was claimed
+	 */
+  bool Claim()
+	{
+		int unpinned = 0;
+		return pinCnt.compare_exchange_strong(unpinned, CLAIMED);
+  }
+
+	/**
+	 * Give up the claim on a frame without changing what it holds.
+	 */
+  void Release()
+	{
+		pinCnt = 0;
+  }
+
+	/**
+	 * Pin the frame if it is not claimed.
+	 *
+	 * @return True if the frame was pinned
+	 */
+  bool Pin()
+	{
+		int pins = pinCnt.load();
+		do
+		{
+			if(pins == CLAIMED)
+				return false;
+		} while(!pinCnt.compare_exchange_weak(pins, pins + 1));
+		return true;
+  }
+
+	/**
+	 * Drop one pin of the frame.
+	 *
+	 * @return False if the frame was not pinned
+	 */
+  bool Unpin()
+	{
+		int pins = pinCnt.load();
+		do
+		{
+			if(pins <= 0)
+				return false;
+		} while(!pinCnt.compare_exchange_weak(pins, pins - 1));
+		return true;
   }
 
   void Print()
@@ -122,33 +223,66 @@ class BufDesc {
 */
 struct BufStats
 {
+	/**
+   * Replacement policy of the buffer pool
+	 */
+  const char* policy;
+
+	/**
+   * Engine doing the asynchronous I/O of the buffer pool
+	 */
+  const char* io;
+
 	/**
    * Total number of accesses to buffer pool
 	 */
-  int accesses;
+  std::atomic<int> accesses;
+
+	/**
+   * Number of accesses that found the page in the buffer pool
+	 */
+  std::atomic<int> hits;
 
 	/**
    * Number of pages read from disk (including allocs)
 	 */
-  int diskreads;
+  std::atomic<int> diskreads;
 
 	/**
    * Number of pages written back to disk
 	 */
-  int diskwrites;
+  std::atomic<int> diskwrites;
+
+	/**
+   * Number of the pages written back to disk by the background writer
+	 */
+  std::atomic<int> bgwrites;
 
 	/**
    * Clear all values 
 	 */
   void clear()
   {
-		accesses = diskreads = diskwrites = 0;
+		accesses = 0;
+		hits = 0;
+		diskreads = 0;
+		diskwrites = 0;
+		bgwrites = 0;
   }
       
+	/**
+   * Fraction of accesses that found the page in the buffer pool
+	 */
+  double hitRatio() const
+  {
+		return accesses == 0 ? 0 : (double)hits / accesses;
+  }
+
 	/**
    * Constructor of BufStats class 
 	 */
   BufStats()
+		: policy(""), io("")
   {
 		clear();
   }
@@ -156,15 +290,124 @@ struct BufStats
 
 
 /**
-* @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
+* @brief A small ring of frames that a large sequential read, such as a FileScan or an index range scan, recycles
+* instead of drawing frames from the whole buffer pool, so that a scan of a big file does not push every other page
+* out. Reading through a ring, a miss reuses the frame the ring loaded size() misses ago, as long as that frame
+* still holds the same page, is unpinned, and no reader outside the ring has pinned it since. Otherwise the ring takes
+* a frame from the replacement policy as usual and the old one is left to the buffer pool. A ring belongs to one
+* scan and is not shared between threads.
+*/
+class BufRing
+{
+	friend class BufMgr;
+
+ private:
+	/**
+   * A frame the ring has loaded a page into
+	 */
+  struct Slot
+  {
+    const File* file;
+    PageId pageNo;
+    FrameId frameNo;
+  };
+
+	/**
+   * Frames of the ring, file is NULL while a slot has not been used
+	 */
+  std::vector<Slot> slots;
+
+	/**
+   * Slot the next miss tries to reuse
+	 */
+  std::uint32_t current;
+
+	// Rings are tied to the frames of one scan and are not copied
+  BufRing(const BufRing&);
+  BufRing& operator=(const BufRing&);
+
+ public:
+	/**
+   * Constructor of BufRing class
+	 *
+	 * @param frames	Number of frames the ring recycles, at least 1
+	 */
+  BufRing(const std::uint32_t frames = BUFRINGSIZE)
+		: slots(frames > 0 ? frames : 1), current(0)
+  {
+		for (std::uint32_t i = 0; i < slots.size(); i++)
+			slots[i].file = NULL;
+  }
+
+	/**
+   * Number of frames the ring recycles
+	 */
+  std::uint32_t size() const
+  {
+		return (std::uint32_t)slots.size();
+  }
+};
+
+
+/**
+* @brief Asynchronous read or write of the page in one frame of the buffer pool. A frame has at most one in flight,
+* and stays claimed until it completes.
+*/
+class FrameIo : public IoRequest
+{
+	friend class BufMgr;
+
+ private:
+	/**
+   * Buffer manager the frame belongs to
+	 */
+  BufMgr* bufMgr;
+
+	/**
+   * Frame the page is read into or written from
+	 */
+  FrameId frameNo;
+
+	/**
+   * File object of the page
+	 */
+  File* file;
+
+	/**
+   * Page number in the file
+	 */
+  PageId pageNo;
+
+ public:
+	/**
+   * Constructor of FrameIo class
+	 */
+  FrameIo()
+		: bufMgr(NULL), frameNo(0), file(NULL), pageNo(Page::INVALID_NUMBER)
+  {
+  }
+
+	/**
+   * Hands the result to the buffer manager.
+	 */
+  void complete(const int error);
+};
+
+
+/**
+* @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file.
+* All of its methods can be called from many threads at once, except flushFile and disposePage, which need
+* the file (or page) to be out of use by other threads.
 */
 class BufMgr 
 {
+	friend class FrameIo;
+
  private:
 	/**
-   * Current position of clockhand in our buffer pool
+   * Replacement policy choosing the frames to reuse
 	 */
-  FrameId clockHand;
+  ReplacementPolicy* policy;
 
 	/**
    * Number of frames in the buffer pool
@@ -187,20 +430,126 @@ class BufMgr
   BufStats bufStats;
 
 	/**
-	 * Allocate a free frame.  
+   * Engine doing the reads of prefetchPages and the writes of the background writer
+	 */
+  PageIo* io;
+
+	/**
+   * Asynchronous request of each frame
+	 */
+  FrameIo* frameIo;
+
+	/**
+   * Background writer, which writes back dirty pages before the replacement policy chooses their frames
+	 */
+  std::thread writer;
+
+	/**
+   * Protects writerStop and writerWanted
+	 */
+  std::mutex writerLatch;
+
+	/**
+   * Signalled to start a round of the background writer early, or to stop it
+	 */
+  std::condition_variable writerWake;
+
+	/**
+   * True once the background writer is to stop
+	 */
+  bool writerStop;
+
+	/**
+   * True if a thread had to write back a victim itself since the last round of the background writer
+	 */
+  bool writerWanted;
+
+	/**
+	 * Body of the background writer thread: runs rounds of writeAhead until the buffer manager is destroyed.
+	 */
+  void backgroundWrite();
+
+	/**
+	 * One round of the background writer. Claims the unpinned dirty frames among those the replacement policy is
+	 * about to choose, up to BGWRITERBATCH of them, and writes their pages back in page order, so the frames are
+	 * clean when they are replaced. Pages of files that support it are written asynchronously, each frame staying
+	 * claimed until its write completes.
+	 *
+	 * @return Number of pages written or being written
+	 */
+  std::uint32_t writeAhead();
+
+	/**
+	 * Finish an asynchronous read started by prefetchPages: make the page visible, unpinned, or drop it if the read
+	 * failed.
+	 *
+	 * @param request	Request of the frame
+	 * @param error		0 on success, otherwise an errno value
+	 */
+  void readDone(FrameIo& request, int error);
+
+	/**
+	 * Finish an asynchronous write started by writeAhead: mark the page clean unless the write failed, and release
+	 * the frame.
+	 *
+	 * @param request	Request of the frame
+	 * @param error		0 on success, otherwise an errno value
+	 */
+  void writeDone(FrameIo& request, const int error);
+
+	/**
+	 * Allocate a free frame, chosen by the replacement policy. The frame is returned claimed and cleared, a dirty page
+	 * that was in it has been written back.
 	 *
 	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
+	 * @param file   	File object of the page the frame is for
+	 * @param pageNo  Page number of the page the frame is for, Page::INVALID_NUMBER for a page being allocated
+	 * @param ring   	Ring to recycle a frame of and record the new frame in, NULL to use the whole buffer pool
 	 * @throws BufferExceededException If no such buffer is found which can be allocated
 	 */
-  void allocBuf(FrameId & frame);
+  void allocBuf(FrameId & frame, const File* file, const PageId pageNo, BufRing* ring = NULL);
 
 	/**
-   * Advance clock to next frame in the buffer pool
+	 * Allocate a free frame like allocBuf, but report a buffer pool without a free frame through the return value.
+	 *
+	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
+	 * @param file   	File object of the page the frame is for
+	 * @param pageNo  Page number of the page the frame is for, Page::INVALID_NUMBER for a page being allocated
+	 * @param ring   	Ring to recycle a frame of and record the new frame in, NULL to use the whole buffer pool
+	 * @return False if every frame is pinned
 	 */
-  void advanceClock()
-  {
-		clockHand = (clockHand + 1) % numBufs;
-  }
+  bool tryAllocBuf(FrameId & frame, const File* file, const PageId pageNo, BufRing* ring = NULL);
+
+	/**
+	 * Claim the frame in the current slot of the ring if the ring may reuse it.
+	 *
+	 * @param ring   	Ring of the scan
+	 * @param frame   	Frame ID of the claimed frame returned via this variable
+	 * @return False if the slot is unused, or its frame is pinned or no longer the ring's
+	 */
+  bool claimRingFrame(BufRing* ring, FrameId & frame);
+
+	/**
+	 * Look up the page and pin its frame. Waits while the frame is claimed by another thread loading or
+	 * replacing it.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param frame   	Frame ID of the pinned frame returned via this variable
+	 * @return False if the page is not in the buffer pool
+	 */
+  bool pinResident(File* file, const PageId pageNo, FrameId & frame);
+
+	/**
+	 * Load the page into a frame returned by allocBuf, leaving it with one pin. If another thread enters the same page
+	 * into the buffer pool first, the frame is released and nothing is loaded.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param frame   	Claimed frame to load the page into
+	 * @return False if the page was entered into the buffer pool by another thread first
+	 */
+  bool loadPage(File* file, const PageId pageNo, const FrameId frame);
 
 
  public:
@@ -210,12 +559,15 @@ class BufMgr
   Page* bufPool;
 
 	/**
-   * Constructor of BufMgr class
+   * Constructor of BufMgr class. Starts the background writer.
+	 *
+	 * @param bufs   	Number of frames in the buffer pool
+	 * @param policyIn  Replacement policy used to choose the frames to reuse
 	 */
-  BufMgr(std::uint32_t bufs);
+  BufMgr(std::uint32_t bufs, const BufPolicy policyIn = POLICY_CLOCK);
 	
 	/**
-   * Destructor of BufMgr class
+   * Destructor of BufMgr class. Stops the background writer and writes back all dirty pages.
 	 */
   ~BufMgr();
 
@@ -227,8 +579,31 @@ class BufMgr
 	 * @param file   	File object
 	 * @param PageNo  Page number in the file to be read
 	 * @param page  	Reference to page pointer. Used to fetch the Page object in which requested page from file is read in.
+	 * @param ring  	Ring of a sequential scan to recycle frames of on a miss, NULL to use the whole buffer pool
 	 */
-  void readPage(File* file, const PageId PageNo, Page*& page);
+  void readPage(File* file, const PageId PageNo, Page*& page, BufRing* ring = NULL);
+
+	/**
+	 * Read ahead: start bringing the given page into a frame without pinning it, so a later readPage finds it
+	 * in the buffer pool. Returns without waiting for the read, a readPage of the page in the meantime waits for it.
+	 * Nothing is done if the page is already present, or if every frame is pinned.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number in the file to be read
+	 * @param ring  	Ring of the scan the page is read ahead for, NULL to use the whole buffer pool
+	 */
+  void prefetchPage(File* file, const PageId PageNo, BufRing* ring = NULL);
+
+	/**
+	 * Read ahead a batch of pages like prefetchPage, submitting all of their reads at once so they are in flight
+	 * together. Stops at the first page no frame can be found for.
+	 *
+	 * @param file   	File object
+	 * @param pageNos  Page numbers in the file to be read
+	 * @param count  	Number of page numbers
+	 * @param ring  	Ring of the scan the pages are read ahead for, NULL to use the whole buffer pool
+	 */
+  void prefetchPages(File* file, const PageId* pageNos, const std::uint32_t count, BufRing* ring = NULL);
 
 	/**
 	 * Unpin a page from memory since it is no longer required for it to remain in memory.
@@ -253,7 +628,8 @@ class BufMgr
 	/**
 	 * Writes out all dirty pages of the file to disk.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
-	 * Otherwise Error returned.
+	 * Otherwise Error returned. Waits for the asynchronous reads and writes in flight first, and writes the
+	 * file header kept in memory out after the pages.
 	 *
 	 * @param file   	File object
    * @throws  PagePinnedException If any page of the file is pinned in the buffer pool 
@@ -289,6 +665,14 @@ class BufMgr
   void clearBufStats() 
   {
 		bufStats.clear();
+  }
+
+	/**
+   * Number of frames in the buffer pool
+	 */
+  std::uint32_t numFrames() const
+  {
+		return numBufs;
   }
 };
 
@@ -7,23 +7,84 @@
 
 #include "file.h"
 
-#include <fstream>
+#include <algorithm>
+#include <climits>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
 #include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
+#include "exceptions/badgerdb_exception.h"
 #include "exceptions/file_exists_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
+#include "exceptions/insufficient_space_exception.h"
 #include "exceptions/invalid_page_exception.h"
 #include "file_iterator.h"
 #include "page.h"
+#include "pageIo.h"
 
 namespace badgerdb {
 
-File::StreamMap File::open_streams_;
+namespace {
+
+// Holds the latch of a file shared while in scope.
+class SharedLatch {
+ public:
+  explicit SharedLatch(FileHandle& handle) : latch_(handle.latch()) {
+    pthread_rwlock_rdlock(latch_);
+  }
+  ~SharedLatch() { pthread_rwlock_unlock(latch_); }
+
+ private:
+  pthread_rwlock_t* latch_;
+};
+
+// Holds the latch of a file exclusively while in scope.
+class ExclusiveLatch {
+ public:
+  explicit ExclusiveLatch(FileHandle& handle) : latch_(handle.latch()) {
+    pthread_rwlock_wrlock(latch_);
+  }
+  ~ExclusiveLatch() { pthread_rwlock_unlock(latch_); }
+
+ private:
+  pthread_rwlock_t* latch_;
+};
+
+// Drops the first <done> bytes from the front of the buffers.
+void consume(struct iovec*& buffers, int& count, size_t done) {
+  while (count > 0 && done >= buffers->iov_len) {
+    done -= buffers->iov_len;
+    ++buffers;
+    --count;
+  }
+  if (count > 0) {
+    buffers->iov_base = static_cast<char*>(buffers->iov_base) + done;
+    buffers->iov_len -= done;
+  }
+}
+
+}
+
+FileHandle::FileHandle(const int fd)
+: fd_(fd), header_dirty_(false), space_map_loaded_(false) {
+  pthread_rwlock_init(&latch_, NULL);
+  std::memset(&header_, 0, sizeof(FileHeader));
+}
+
+FileHandle::~FileHandle() {
+  pthread_rwlock_destroy(&latch_);
+  ::close(fd_);
+}
+
+File::HandleMap File::open_handles_;
 File::CountMap File::open_counts_;
 
 void File::remove(const std::string& filename) {
@@ -44,14 +105,7 @@ bool File::isOpen(const std::string& filename) {
 }
 
 bool File::exists(const std::string& filename) {
-	std::fstream file(filename);
-	if(file)
-	{
-		file.close();
-		return true;
-	}
-
-	return false;
+	return ::access(filename.c_str(), F_OK) == 0;
 }
 
 File::~File() {
@@ -60,6 +114,7 @@ File::~File() {
 
 
 PageId File::getFirstPageNo() {
+  SharedLatch latch(*handle_);
   const FileHeader& header = readHeader();
   return header.first_used_page;
 }
@@ -72,16 +127,16 @@ File::File(const std::string& name, const bool create_new) : filename_(name) {
     FileHeader header = {1 /* num_pages */, 0 /* first_used_page */,
                          0 /* num_free_pages */, 0 /* first_free_page */};
     writeHeader(header);
+    flushHeader();
   }
 }
 
 void File::openIfNeeded(const bool create_new) {
   if (open_counts_.find(filename_) != open_counts_.end()) {	//exists an entry already
     ++open_counts_[filename_];
-    stream_ = open_streams_[filename_];
+    handle_ = open_handles_[filename_];
   } else {
-    std::ios_base::openmode mode =
-        std::fstream::in | std::fstream::out | std::fstream::binary;
+    int flags = O_RDWR;
     const bool already_exists = exists(filename_);
     if (create_new) {
       // Error if we try to overwrite an existing file.
@@ -89,15 +144,25 @@ void File::openIfNeeded(const bool create_new) {
         throw FileExistsException(filename_);
       }
       // New files have to be truncated on open.
-      mode = mode | std::fstream::trunc;
+      flags = flags | O_CREAT | O_TRUNC;
     } else {
       // Error if we try to open a file that doesn't exist.
       if (!already_exists) {
         throw FileNotFoundException(filename_);
       }
     }
-    stream_.reset(new std::fstream(filename_, mode));
-    open_streams_[filename_] = stream_;
+    const int fd = ::open(filename_.c_str(), flags, 0666);
+    if (fd < 0) {
+      throw BadgerDbException("Could not open file " + filename_ + ": " +
+                              std::strerror(errno));
+    }
+    handle_.reset(new FileHandle(fd));
+    if (!create_new) {
+      // The header is read once here and kept in memory while the file is open.
+      struct iovec buffers[1] = {{&handle_->header_, sizeof(FileHeader)}};
+      readAt(buffers, 1, 0 /* pos */);
+    }
+    open_handles_[filename_] = handle_;
     open_counts_[filename_] = 1;
   }
 }
@@ -106,26 +171,105 @@ void File::close() {
 	if(open_counts_[filename_] > 0)
   	--open_counts_[filename_];
 
-  stream_.reset();
+  if (open_counts_[filename_] == 0 && handle_) {
+    // The last object of the file writes back what is kept in memory; errors
+    // can no longer be reported from here, flushHeader reports them.
+    try {
+      flushHeader();
+    } catch (const BadgerDbException&) {
+    }
+  }
+
+  handle_.reset();
 	assert(open_counts_[filename_] >= 0);
 
   if (open_counts_[filename_] == 0) {
-    open_streams_.erase(filename_);
+    open_handles_.erase(filename_);
     open_counts_.erase(filename_);
   }
 }
 
 FileHeader File::readHeader() const {
-  FileHeader header;
-  stream_->seekg(0 /* pos */, std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
-  return header;
+  return handle_->header_;
 }
 
 void File::writeHeader(const FileHeader& header) {
-  stream_->seekp(0 /* pos */, std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
-  stream_->flush();
+  handle_->header_ = header;
+  handle_->header_dirty_ = true;
+}
+
+void File::flushHeader() const {
+  ExclusiveLatch latch(*handle_);
+
+  // Changed parts of the space map go out as whole map pages.
+  std::vector<unsigned char>& space_map = handle_->space_map_;
+  std::vector<unsigned char>& dirty = handle_->space_map_dirty_;
+  for (size_t i = 0; i < dirty.size(); ++i) {
+    const PageId map_page = 1 + i * (SPACEMAPENTRIES + 1);
+    if (dirty[i] && map_page + 1 < space_map.size()) {
+      struct iovec buffers[1] = {
+          {&space_map[map_page + 1],
+           std::min<size_t>(SPACEMAPENTRIES, space_map.size() - map_page - 1)}};
+      writeAt(buffers, 1, pagePosition(map_page));
+    }
+    dirty[i] = 0;
+  }
+
+  if (handle_->header_dirty_) {
+    struct iovec buffers[1] = {{&handle_->header_, sizeof(FileHeader)}};
+    writeAt(buffers, 1, 0 /* pos */);
+    handle_->header_dirty_ = false;
+  }
+}
+
+void File::prepareRead(IoRequest& request, const PageId page_number,
+                       Page* page) const {
+  request.fd = handle_->fd();
+  request.offset = pagePosition(page_number);
+  request.buffer.iov_base = page;
+  request.buffer.iov_len = Page::SIZE;
+  request.write = false;
+}
+
+void File::readAt(struct iovec* buffers, int count,
+                  const off_t position) const {
+  off_t pos = position;
+  while (count > 0) {
+    const ssize_t done = ::preadv(handle_->fd(), buffers, count, pos);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw BadgerDbException("Could not read from file " + filename_ + ": " +
+                              std::strerror(errno));
+    }
+    if (done == 0) {
+      // Past the end of the file.
+      for (int i = 0; i < count; ++i) {
+        std::memset(buffers[i].iov_base, 0, buffers[i].iov_len);
+      }
+      return;
+    }
+    pos += done;
+    consume(buffers, count, done);
+  }
+}
+
+void File::writeAt(struct iovec* buffers, int count,
+                   const off_t position) const {
+  off_t pos = position;
+  while (count > 0) {
+    const ssize_t done = ::pwritev(handle_->fd(), buffers, count, pos);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw BadgerDbException("Could not write to file " + filename_ + ": " +
+                              std::strerror(errno));
+    }
+    pos += done;
+    consume(buffers, count, done);
+  }
 }
 
 
@@ -143,6 +287,7 @@ PageFile PageFile::open(const std::string& filename) {
 PageFile::PageFile(const std::string& name, const bool create_new)
 : File(name, create_new)
 {
+  loadSpaceMap();
 }
 
 PageFile::~PageFile() {
@@ -151,6 +296,7 @@ PageFile::~PageFile() {
 PageFile::PageFile(const PageFile& other)
 : File(other.filename_, false /* create_new */)
 {
+  loadSpaceMap();
 }
 
 PageFile& PageFile::operator=(const PageFile& rhs) {
@@ -159,152 +305,228 @@ PageFile& PageFile::operator=(const PageFile& rhs) {
   close();	//close my file and associate me with the new one
   filename_ = rhs.filename_;
   openIfNeeded(false /* create_new */);
+  loadSpaceMap();
   return *this;
 }
 
 Page PageFile::allocatePage(PageId &new_page_number) {
-  FileHeader header = readHeader();
   Page new_page;
-  Page existing_page;
+  allocatePageInto(new_page_number, &new_page);
+  return new_page;
+}
+
+void PageFile::allocatePageInto(PageId &new_page_number, Page* page) {
+  ExclusiveLatch latch(*handle_);
+  FileHeader header = readHeader();
+  std::vector<unsigned char>& space_map = handle_->space_map_;
+
+  // Reuse the lowest free page; map pages are never in use, so skip them.
+  PageId page_number = Page::INVALID_NUMBER;
   if (header.num_free_pages > 0) {
-    new_page = readPage(header.first_free_page, true /* allow_free */);
-    new_page.set_page_number(header.first_free_page);
-		new_page_number = new_page.page_number();
-    header.first_free_page = new_page.next_page_number();
-    --header.num_free_pages;
-
-    if (header.first_used_page == Page::INVALID_NUMBER ||
-        header.first_used_page > new_page.page_number()) {
-      // Either have no pages used or the head of the used list is a page later
-      // than the one we just allocated, so add the new page to the head.
-      if (header.first_used_page > new_page.page_number()) {
-        new_page.set_next_page_number(header.first_used_page);
-      }
-      header.first_used_page = new_page.page_number();
-    } else {
-      // New page is reused from somewhere after the beginning, so we need to
-      // find where in the used list to insert it.
-      PageId next_page_number = Page::INVALID_NUMBER;
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        next_page_number = (*iter).next_page_number();
-        if (next_page_number > new_page.page_number() ||
-            next_page_number == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
+    for (PageId i = std::max<PageId>(header.first_free_page, 1);
+         i < header.num_pages; ++i) {
+      if (space_map[i] == 0 && spaceMapPage(i) != i) {
+        page_number = i;
+        --header.num_free_pages;
+        header.first_free_page = i + 1;
+        break;
       }
-      existing_page.set_next_page_number(new_page.page_number());
-      new_page.set_next_page_number(next_page_number);
     }
-
-    assert((header.num_free_pages == 0) ==
-           (header.first_free_page == Page::INVALID_NUMBER));
   }
-	else
-	{
-    new_page.set_page_number(header.num_pages);
-		new_page_number = new_page.page_number();
 
-    if (header.first_used_page == Page::INVALID_NUMBER)
-		{
-      header.first_used_page = new_page.page_number();
+  // Otherwise the file grows, by a map page too when the last one is full.
+  if (page_number == Page::INVALID_NUMBER) {
+    page_number = header.num_pages;
+    if (spaceMapPage(page_number) == page_number) {
+      handle_->space_map_dirty_.push_back(0);
+      ++page_number;
     }
-		else
-		{
-      // If we have pages allocated, we need to add the new page to the tail
-      // of the linked list.
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        if ((*iter).next_page_number() == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      assert(existing_page.isUsed());
-      existing_page.set_next_page_number(new_page.page_number());
-    }
-    ++header.num_pages;
+    header.num_pages = page_number + 1;
+    space_map.resize(header.num_pages, 0);
   }
-  writePage(new_page_number, new_page.header_, new_page);
-  if (existing_page.page_number() != Page::INVALID_NUMBER) {
-    // If we updated an existing page by inserting the new page into the
-    // used list, we need to write it out.
-    writePage(existing_page.page_number(), existing_page.header_, existing_page);
+
+  Page& new_page = *page;
+  new_page.initialize();
+  new_page.set_page_number(page_number);
+  new_page_number = page_number;
+
+  struct iovec buffers[1] = {{page, Page::SIZE}};
+  writeAt(buffers, 1, pagePosition(page_number));
+  setSpaceEntry(page_number, spaceEntryFor(new_page));
+
+  if (header.first_used_page == Page::INVALID_NUMBER ||
+      header.first_used_page > page_number) {
+    header.first_used_page = page_number;
   }
   writeHeader(header);
-
-  return new_page;
 }
 
-Page PageFile::readPage(const PageId page_number) const {
+void PageFile::appendPages(Page* pages, const std::uint32_t count) {
+  if (count == 0) {
+    return;
+  }
+  ExclusiveLatch latch(*handle_);
   FileHeader header = readHeader();
 
-	if (page_number >= header.num_pages)
-	{
-		throw InvalidPageException(page_number, filename_);
-	}
-	return readPage(page_number, false /* allow_free */);
+  // Number the pages, stepping over the map pages that fall between them.
+  // Nothing about the file changes until the pages are written, so a failed
+  // write can be retried.
+  std::vector<struct iovec> buffers(count);
+  std::uint32_t new_map_pages = 0;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    PageId page_number = header.num_pages;
+    if (spaceMapPage(page_number) == page_number) {
+      ++new_map_pages;
+      ++page_number;
+    }
+    header.num_pages = page_number + 1;
+    pages[i].set_page_number(page_number);
+    buffers[i].iov_base = &pages[i];
+    buffers[i].iov_len = Page::SIZE;
+  }
+
+  // Each run of consecutive pages goes out in one write.
+  std::uint32_t first = 0;
+  for (std::uint32_t i = 1; i <= count; ++i) {
+    if (i == count || i - first == IOV_MAX ||
+        pages[i].page_number() != pages[i - 1].page_number() + 1) {
+      writeAt(&buffers[first], i - first,
+              pagePosition(pages[first].page_number()));
+      first = i;
+    }
+  }
+
+  handle_->space_map_dirty_.resize(
+      handle_->space_map_dirty_.size() + new_map_pages, 0);
+  handle_->space_map_.resize(header.num_pages, 0);
+  for (std::uint32_t i = 0; i < count; ++i) {
+    setSpaceEntry(pages[i].page_number(), spaceEntryFor(pages[i]));
+  }
+  if (header.first_used_page == Page::INVALID_NUMBER ||
+      header.first_used_page > pages[0].page_number()) {
+    header.first_used_page = pages[0].page_number();
+  }
+  writeHeader(header);
 }
 
-Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
+Page PageFile::readPage(const PageId page_number) const {
   Page page;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(PageHeader));
-  stream_->read(reinterpret_cast<char*>(&page.data_[0]), Page::DATA_SIZE);
-  if (!allow_free && !page.isUsed()) {
+  readPageInto(page_number, &page);
+  return page;
+}
+
+void PageFile::readPageInto(const PageId page_number, Page* page) const {
+  SharedLatch latch(*handle_);
+  if (page_number >= readHeader().num_pages || spaceEntry(page_number) == 0) {
     throw InvalidPageException(page_number, filename_);
   }
 
-  return page;
+  struct iovec buffers[1] = {{page, Page::SIZE}};
+  readAt(buffers, 1, pagePosition(page_number));
+  if (!page->isUsed()) {
+    throw InvalidPageException(page_number, filename_);
+  }
+}
+
+void PageFile::checkRead(const PageId page_number, const Page& page) const {
+  SharedLatch latch(*handle_);
+  if (page_number >= readHeader().num_pages || spaceEntry(page_number) == 0 ||
+      !page.isUsed() || page.page_number() != page_number) {
+    throw InvalidPageException(page_number, filename_);
+  }
 }
 
 void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
-	PageHeader header = readPageHeader(new_page_number);
-	if (header.current_page_number == Page::INVALID_NUMBER)
+	SharedLatch latch(*handle_);
+	if (new_page_number >= readHeader().num_pages ||
+	    spaceEntry(new_page_number) == 0)
 	{
 		// Page has been deleted since it was read.
 		throw InvalidPageException(new_page_number, filename_);
 	}
-	// Page on disk may have had its next page pointer updated since it was read;
-	// we don't modify that, but we do keep all the other modifications to the
-	// page header.
-	const PageId next_page_number = header.next_page_number;
-	header = new_page.header_;
-	header.next_page_number = next_page_number;
-	writePage(new_page_number, header, new_page);
+	struct iovec buffers[1] = {{const_cast<Page*>(&new_page), Page::SIZE}};
+	writeAt(buffers, 1, pagePosition(new_page_number));
+	setSpaceEntry(new_page_number, spaceEntryFor(new_page));
+}
+
+bool PageFile::prepareWrite(IoRequest& request, const PageId page_number,
+                            const Page* page) const {
+  SharedLatch latch(*handle_);
+  if (page_number >= readHeader().num_pages || spaceEntry(page_number) == 0) {
+    return false;
+  }
+  setSpaceEntry(page_number, spaceEntryFor(*page));
+
+  request.fd = handle_->fd();
+  request.offset = pagePosition(page_number);
+  request.buffer.iov_base = const_cast<Page*>(page);
+  request.buffer.iov_len = Page::SIZE;
+  request.write = true;
+  return true;
 }
 
 void PageFile::deletePage(const PageId page_number) {
+  ExclusiveLatch latch(*handle_);
   FileHeader header = readHeader();
 
-  Page existing_page = readPage(page_number);
-  Page previous_page;
-  // If this page is the head of the used list, update the header to point to
-  // the next page in line.
-  if (page_number == header.first_used_page) {
-    header.first_used_page = existing_page.next_page_number();
-  } else {
-    // Walk the used list so we can update the page that points to this one.
-    for (FileIterator iter = begin(); iter != end(); ++iter) {
-      previous_page = *iter;
-      if (previous_page.next_page_number() == existing_page.page_number()) {
-        previous_page.set_next_page_number(existing_page.next_page_number());
-        break;
-      }
-    }
+  if (page_number >= header.num_pages || spaceEntry(page_number) == 0) {
+    throw InvalidPageException(page_number, filename_);
   }
-  // Clear the page and add it to the head of the free list.
-  existing_page.initialize();
-  existing_page.set_next_page_number(header.first_free_page);
-  header.first_free_page = page_number;
+
+  // Marking the page free in the space map is all it takes.
+  setSpaceEntry(page_number, 0);
   ++header.num_free_pages;
-  if (previous_page.isUsed()) {
-    writePage(previous_page.page_number(), previous_page.header_, previous_page);
+  if (header.first_free_page == Page::INVALID_NUMBER ||
+      header.first_free_page > page_number) {
+    header.first_free_page = page_number;
+  }
+  if (header.first_used_page == page_number) {
+    header.first_used_page = firstUsedPageFrom(page_number + 1);
   }
-  writePage(page_number, existing_page.header_, existing_page);
   writeHeader(header);
 }
 
+PageId PageFile::findPageWithSpace(const std::size_t bytes) const {
+  SharedLatch latch(*handle_);
+
+  // Entries round the free space down, so any page whose entry is at least
+  // this high has the room.
+  const std::size_t wanted = 1 + (bytes + SPACECLASSBYTES - 1) / SPACECLASSBYTES;
+  const std::vector<unsigned char>& space_map = handle_->space_map_;
+  for (PageId i = std::max<PageId>(readHeader().first_used_page, 1);
+       i < space_map.size(); ++i) {
+    if (spaceEntry(i) >= wanted) {
+      return i;
+    }
+  }
+  return Page::INVALID_NUMBER;
+}
+
+RecordId PageFile::insertRecord(const std::string& record_data) {
+  // Refuse a record no page can hold before a page is allocated for it.
+  const Page empty_page;
+  if (!empty_page.hasSpaceForRecord(record_data)) {
+    throw InsufficientSpaceException(Page::INVALID_NUMBER,
+                                     record_data.length(),
+                                     empty_page.getFreeSpace());
+  }
+
+  // Leave room for a new slot, as the page may have no free one.
+  PageId page_number =
+      findPageWithSpace(record_data.length() + sizeof(PageSlot));
+  Page page;
+  if (page_number == Page::INVALID_NUMBER) {
+    allocatePageInto(page_number, &page);
+  } else {
+    readPageInto(page_number, &page);
+  }
+  const RecordId record_id = page.insertRecord(record_data);
+  writePage(page_number, page);
+  return record_id;
+}
+
 FileIterator PageFile::begin() {
+  SharedLatch latch(*handle_);
   const FileHeader& header = readHeader();
   return FileIterator(this, header.first_used_page);
 }
@@ -313,19 +535,64 @@ FileIterator PageFile::end() {
   return FileIterator(this, Page::INVALID_NUMBER);
 }
 
-void PageFile::writePage(const PageId page_number, const PageHeader& header,
-                     const Page& new_page) {
-  stream_->seekp(pagePosition(page_number), std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
-  stream_->write(reinterpret_cast<const char*>(&new_page.data_[0]),
-                 Page::DATA_SIZE);
-  stream_->flush();
+void PageFile::loadSpaceMap() {
+  ExclusiveLatch latch(*handle_);
+  if (handle_->space_map_loaded_) {
+    return;
+  }
+
+  const PageId num_pages = readHeader().num_pages;
+  std::vector<unsigned char>& space_map = handle_->space_map_;
+  space_map.assign(num_pages, 0);
+  handle_->space_map_dirty_.clear();
+  for (PageId map_page = 1; map_page < num_pages;
+       map_page += SPACEMAPENTRIES + 1) {
+    handle_->space_map_dirty_.push_back(0);
+    if (map_page + 1 < num_pages) {
+      struct iovec buffers[1] = {
+          {&space_map[map_page + 1],
+           std::min<size_t>(SPACEMAPENTRIES, num_pages - map_page - 1)}};
+      readAt(buffers, 1, pagePosition(map_page));
+    }
+  }
+  handle_->space_map_loaded_ = true;
+}
+
+unsigned char PageFile::spaceEntry(const PageId page_number) const {
+  // Page writes update entries holding the latch shared.
+  return __atomic_load_n(&handle_->space_map_[page_number], __ATOMIC_RELAXED);
+}
+
+void PageFile::setSpaceEntry(const PageId page_number,
+                             const unsigned char entry) const {
+  const size_t map_index = (page_number - 1) / (SPACEMAPENTRIES + 1);
+  __atomic_store_n(&handle_->space_map_[page_number], entry, __ATOMIC_RELAXED);
+  __atomic_store_n(&handle_->space_map_dirty_[map_index], 1, __ATOMIC_RELAXED);
+}
+
+unsigned char PageFile::spaceEntryFor(const Page& page) {
+  return 1 + std::min<std::size_t>(page.getFreeSpace() / SPACECLASSBYTES, 254);
+}
+
+PageId PageFile::firstUsedPageFrom(const PageId page_number) const {
+  const std::vector<unsigned char>& space_map = handle_->space_map_;
+  for (PageId i = page_number; i < space_map.size(); ++i) {
+    if (spaceEntry(i) != 0) {
+      return i;
+    }
+  }
+  return Page::INVALID_NUMBER;
+}
+
+PageId PageFile::nextUsedPage(const PageId page_number) const {
+  SharedLatch latch(*handle_);
+  return firstUsedPageFrom(page_number + 1);
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
   PageHeader header;
-  stream_->seekg(pagePosition(page_number), std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(PageHeader));
+  struct iovec buffers[1] = {{&header, sizeof(PageHeader)}};
+  readAt(buffers, 1, pagePosition(page_number));
   return header;
 }
 
@@ -341,20 +608,23 @@ BlobFile BlobFile::open(const std::string& filename) {
 }
 
 BlobFile::BlobFile(const std::string& name, const bool create_new)
-: File(name, create_new) {
+: File(name, create_new), mapping_(NULL), mapped_pages_(0), mapping_length_(0) {
 }
 
 BlobFile::~BlobFile() {
+  unmap();
 }
 
 BlobFile::BlobFile(const BlobFile& other)
-: File(other.filename_, false /* create_new */)
+: File(other.filename_, false /* create_new */),
+  mapping_(NULL), mapped_pages_(0), mapping_length_(0)
 {
 }
 
 BlobFile& BlobFile::operator=(const BlobFile& rhs) {
   // This accounts for self-assignment and assignment of a File object for the
   // same file.
+  unmap();
   close();	//close my file and associate me with the new one
   filename_ = rhs.filename_;
   openIfNeeded(false /* create_new */);
@@ -362,8 +632,16 @@ BlobFile& BlobFile::operator=(const BlobFile& rhs) {
 }
 
 Page BlobFile::allocatePage(PageId &new_page_number) {
-  FileHeader header = readHeader();
 	Page new_page;
+	allocatePageInto(new_page_number, &new_page);
+	return new_page;
+}
+
+void BlobFile::allocatePageInto(PageId &new_page_number, Page* page) {
+  ExclusiveLatch latch(*handle_);
+  FileHeader header = readHeader();
+	Page& new_page = *page;
+	new_page.initialize();
 
 	new_page_number = header.num_pages;
 
@@ -375,21 +653,90 @@ Page BlobFile::allocatePage(PageId &new_page_number) {
 
 	writePage(new_page_number, new_page);
 	writeHeader(header);
-
-	return new_page;
 }
 
 Page BlobFile::readPage(const PageId page_number) const {
 	Page page;
-	stream_->seekg(pagePosition(page_number), std::ios::beg);
-	stream_->read(reinterpret_cast<char*>(&page), Page::SIZE);
+	readPageInto(page_number, &page);
 	return page;
 }
 
+void BlobFile::readPageInto(const PageId page_number, Page* page) const {
+	// Blob pages are read and written whole, without touching the header, so
+	// they need no latch.
+	struct iovec buffers[1] = {{page, Page::SIZE}};
+	readAt(buffers, 1, pagePosition(page_number));
+}
+
 void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
-	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
-	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
-	stream_->flush();
+	struct iovec buffers[1] = {{const_cast<Page*>(&new_page), Page::SIZE}};
+	writeAt(buffers, 1, pagePosition(new_page_number));
+}
+
+bool BlobFile::prepareWrite(IoRequest& request, const PageId page_number,
+                            const Page* page) const {
+  request.fd = handle_->fd();
+  request.offset = pagePosition(page_number);
+  request.buffer.iov_base = const_cast<Page*>(page);
+  request.buffer.iov_len = Page::SIZE;
+  request.write = true;
+  return true;
+}
+
+void BlobFile::map() {
+  unmap();
+
+  PageId num_pages;
+  {
+    SharedLatch latch(*handle_);
+    num_pages = readHeader().num_pages;
+  }
+  // Pages are written as they are allocated, so the file holds all of them.
+  const size_t length = pagePosition(num_pages);
+  void* mapping = ::mmap(NULL, length, PROT_READ, MAP_SHARED, handle_->fd(), 0);
+  if (mapping == MAP_FAILED) {
+    throw BadgerDbException("Could not map file " + filename_ + ": " +
+                            std::strerror(errno));
+  }
+  ::madvise(mapping, length, MADV_RANDOM);
+
+  mapping_ = mapping;
+  mapped_pages_ = num_pages;
+  mapping_length_ = length;
+}
+
+void BlobFile::unmap() {
+  if (mapping_ != NULL) {
+    ::munmap(mapping_, mapping_length_);
+    mapping_ = NULL;
+    mapped_pages_ = 0;
+    mapping_length_ = 0;
+  }
+}
+
+const Page* BlobFile::mappedPage(const PageId page_number) const {
+  if (mapping_ == NULL || page_number == Page::INVALID_NUMBER ||
+      page_number >= mapped_pages_) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  return reinterpret_cast<const Page*>(static_cast<const char*>(mapping_) +
+                                       pagePosition(page_number));
+}
+
+void BlobFile::adviseWillNeed(const PageId first_page,
+                              const PageId count) const {
+  if (mapping_ == NULL || first_page == Page::INVALID_NUMBER ||
+      first_page >= mapped_pages_) {
+    return;
+  }
+  const PageId end_page = std::min<PageId>(first_page + count, mapped_pages_);
+
+  // The advice has to start on a boundary of the system's pages.
+  const size_t system_page = ::sysconf(_SC_PAGESIZE);
+  size_t start = pagePosition(first_page);
+  const size_t end = pagePosition(end_page);
+  start -= start % system_page;
+  ::madvise(static_cast<char*>(mapping_) + start, end - start, MADV_WILLNEED);
 }
 
 //delePage should not be called for a blob_file, not supported
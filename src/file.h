@@ -7,16 +7,32 @@
 
 #pragma once
 
-#include <fstream>
 #include <string>
 #include <map>
 #include <memory>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #include "page.h"
 
 namespace badgerdb {
 
 class FileIterator;
+class IoRequest;
+
+/**
+ * @brief Number of pages of a PageFile described by each page of its space
+ *        map, one byte per page.
+ */
+const std::uint32_t SPACEMAPENTRIES = Page::SIZE;
+
+/**
+ * @brief Bytes of free space per free-space class recorded in the space map
+ *        of a PageFile.
+ */
+const std::uint32_t SPACECLASSBYTES = 64;
 
 /**
  * @brief Header metadata for files on disk which contain pages.
@@ -38,7 +54,8 @@ struct FileHeader {
   PageId num_free_pages;
 
   /**
-   * Page number of the first free (allocated but unused) page in the file.
+   * No page before this one is free (allocated but unused), so the search
+   * for a free page starts here.
    */
   PageId first_free_page;
 
@@ -56,19 +73,108 @@ struct FileHeader {
   }
 };
 
+/**
+ * @brief Descriptor of an open file on disk, shared by all File objects that
+ *        refer to the file and closed when the last of them goes away.
+ *
+ * Page reads and writes take the latch shared, so they run concurrently;
+ * allocating and deleting pages, which rewrite the file header and page
+ * lists, take it exclusively.  The header, and the space map of a PageFile,
+ * are kept here in memory and only written back when they are flushed or the
+ * file is closed.
+ */
+class FileHandle {
+ public:
+  /**
+   * Takes ownership of an open file descriptor.
+   *
+   * @param fd  Descriptor of the open file.
+   */
+  explicit FileHandle(const int fd);
+
+  /**
+   * Closes the file descriptor.
+   */
+  ~FileHandle();
+
+  /**
+   * Returns the file descriptor.
+   */
+  int fd() const { return fd_; }
+
+  /**
+   * Returns the latch ordering page I/O against changes to the page lists.
+   */
+  pthread_rwlock_t* latch() { return &latch_; }
+
+ private:
+  // A descriptor is closed exactly once, so handles are not copied
+  FileHandle(const FileHandle&);
+  FileHandle& operator=(const FileHandle&);
+
+  /**
+   * Descriptor of the open file.
+   */
+  int fd_;
+
+  /**
+   * Latch ordering page I/O against changes to the page lists.
+   */
+  pthread_rwlock_t latch_;
+
+  /**
+   * Header of the file, read when the file was opened and guarded by the
+   * latch.
+   */
+  FileHeader header_;
+
+  /**
+   * True if header_ changed since it was last written to the file.
+   */
+  bool header_dirty_;
+
+  /**
+   * Space map of a PageFile, one entry for every page number below
+   * num_pages: 0 for a page that is not in use, otherwise 1 plus the free
+   * space of the page in units of SPACECLASSBYTES.  Entries are changed with
+   * the latch held exclusively, or held shared by page writes.
+   */
+  std::vector<unsigned char> space_map_;
+
+  /**
+   * Non-zero for each page of the space map changed since it was last
+   * written to the file.
+   */
+  std::vector<unsigned char> space_map_dirty_;
+
+  /**
+   * True once the space map has been read from the file.
+   */
+  bool space_map_loaded_;
+
+  friend class File;
+  friend class PageFile;
+};
+
 /**
  * @brief Class which represents a file in the filesystem containing database
  *        pages.
  *
- * The File class wraps a stream to an underlying file on disk.  Files contain
- * fixed-sized pages, and they never deallocate space (though they do reuse
- * deleted pages if possible).  If multiple File objects refer to the same
- * underlying file, they will share the stream in memory.
+ * The File class wraps a descriptor of an underlying file on disk, which it
+ * reads and writes with pread and pwrite.  Files contain fixed-sized pages,
+ * and they never deallocate space (though they do reuse deleted pages if
+ * possible).  If multiple File objects refer to the same underlying file,
+ * they will share the descriptor.
  * If a file that has already been opened (possibly by another query), then the File class
- * detects this (by looking in the open_streams_ map) and just returns a file object with
- * the already created stream for the file without actually opening the UNIX file again. 
+ * detects this (by looking in the open_handles_ map) and just returns a file object with
+ * the already open descriptor for the file without actually opening the UNIX file again. 
+ *
+ * Writes go to the operating system as they are made, without being flushed
+ * to the disk.
  *
- * @warning This class is not threadsafe.
+ * @warning Reading, writing, allocating and deleting pages are threadsafe.
+ *          Opening and closing files, and iterating over the pages of a file
+ *          while pages are allocated or deleted, are not.
  */
 
 
@@ -124,6 +230,15 @@ class File {
    */
   virtual Page allocatePage(PageId &new_page_number) = 0;
 
+  /**
+   * Allocates a new page in the file, setting it up in the given page object
+   * instead of returning a copy of it.
+   *
+   * @param new_page_number   Number of the new page returned via this variable.
+   * @param page              Page object set up as the new page.
+   */
+  virtual void allocatePageInto(PageId &new_page_number, Page* page) = 0;
+
   /**
    * Reads an existing page from the file.
    *
@@ -135,8 +250,20 @@ class File {
   virtual Page readPage(const PageId page_number) const = 0;
 
   /**
-   * Writes a page into the file at the given page number.
-   * No bounds checking is performed.
+   * Reads an existing page from the file straight into the given page object,
+   * without a temporary page.  The object holds undefined contents if the
+   * read fails.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page object to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   */
+  virtual void readPageInto(const PageId page_number, Page* page) const = 0;
+
+  /**
+   * Writes a page into the file at the given page number, straight from the
+   * given page object.  No bounds checking is performed.
    *
    * @param page_number Number of page whose contents to replace.
    * @param new_page    Page to write.
@@ -150,6 +277,50 @@ class File {
    */
   virtual void deletePage(const PageId page_number) = 0;
 
+  /**
+   * Sets up a request for a PageIo engine to read the given page straight
+   * into the given page object.  No bounds checking is performed; the page
+   * read has to be checked with checkRead once the request completes.
+   *
+   * @param request     Request to set up.
+   * @param page_number Number of page to read.
+   * @param page        Page object to read into.
+   */
+  void prepareRead(IoRequest& request, const PageId page_number,
+                   Page* page) const;
+
+  /**
+   * Checks a page read through a PageIo engine the way readPage would.
+   *
+   * @param page_number Number of page that was read.
+   * @param page        Page that was read.
+   * @throws  InvalidPageException  If the page is not currently used.
+   */
+  virtual void checkRead(const PageId page_number, const Page& page) const {}
+
+  /**
+   * Sets up a request for a PageIo engine to write the given page object as
+   * the given page, if pages of this file can be written without reading
+   * anything from the file first.
+   *
+   * @param request     Request to set up.
+   * @param page_number Number of page whose contents to replace.
+   * @param page        Page to write, which must not change until the
+   *                    request completes.
+   * @return  False if the page has to be written with writePage instead.
+   */
+  virtual bool prepareWrite(IoRequest& request, const PageId page_number,
+                            const Page* page) const { return false; }
+
+  /**
+   * Writes the header of the file, and the space map of a PageFile, to disk
+   * if they changed since they were last written.  They are otherwise written
+   * back when the file is closed.
+   *
+   * @throws  BadgerDbException  If the write fails.
+   */
+  void flushHeader() const;
+
   /**
    * Returns the name of the file this object represents.
    *
@@ -172,14 +343,26 @@ class File {
    * @param page_number   Number of page.
    * @return  Position of page in file.
    */
-  static std::streampos pagePosition(const PageId page_number) {
+  static off_t pagePosition(const PageId page_number) {
     return sizeof(FileHeader) + ((page_number - 1) * Page::SIZE);
   }
 
+  /**
+   * Returns the number of the page of a PageFile's space map that describes
+   * the given page.  Each map page comes right before the SPACEMAPENTRIES
+   * pages it describes.
+   *
+   * @param page_number   Number of page.
+   * @return  Number of space map page.
+   */
+  static PageId spaceMapPage(const PageId page_number) {
+    return page_number - (page_number - 1) % (SPACEMAPENTRIES + 1);
+  }
+
   /**
    * Opens the underlying file named in filename_.
    * This method only opens the file if no other File objects exist that access
-   * the same filesystem file; otherwise, it reuses the existing stream.
+   * the same filesystem file; otherwise, it reuses the existing descriptor.
    *
    * @param create_new  Whether to create a new file.
    * @throws  FileExistsException     If the underlying file exists and
@@ -190,33 +373,60 @@ class File {
   void openIfNeeded(const bool create_new);
 
   /**
-   * Closes the underlying file stream in <stream_>.
+   * Closes the underlying file descriptor in <handle_>.
    * This method only closes the file if no other File objects exist that access
    * the same file.
    */
   void close();
 
   /**
-   * Reads the header for this file from disk.
+   * Returns the header for this file, which is kept in memory while the file
+   * is open.  The caller must hold the latch.
    *
    * @return  The file header.
    */
   FileHeader readHeader() const;
 
   /**
-   * Writes the given header to the disk as the header for this file.
+   * Sets the given header as the header for this file.  It reaches the disk
+   * with flushHeader() or when the file is closed.  The caller must hold the
+   * latch exclusively.
    *
    * @param header  File header to write.
    */
   void writeHeader(const FileHeader& header);
 
-  typedef std::map<std::string, std::shared_ptr<std::fstream> > StreamMap;
+  /**
+   * Reads from the file at the given position into the given buffers, with
+   * as few system calls as possible.  Bytes past the end of the file are read
+   * as zeros.  The buffer descriptors are used up in the process.
+   *
+   * @param buffers   Buffers to fill, in order.
+   * @param count     Number of buffers.
+   * @param position  Offset in the file to read from.
+   * @throws  BadgerDbException  If the read fails.
+   */
+  void readAt(struct iovec* buffers, int count, const off_t position) const;
+
+  /**
+   * Writes the given buffers to the file at the given position, with as few
+   * system calls as possible.  The buffer descriptors are used up in the
+   * process.
+   *
+   * @param buffers   Buffers to write, in order.
+   * @param count     Number of buffers.
+   * @param position  Offset in the file to write at.
+   * @throws  BadgerDbException  If the write fails.
+   */
+  void writeAt(struct iovec* buffers, int count, const off_t position) const;
+
+  typedef std::map<std::string, std::shared_ptr<FileHandle> > HandleMap;
   typedef std::map<std::string, int> CountMap;
 
   /**
-   * Streams for opened files.
+   * Descriptors of opened files.
    */
-  static StreamMap open_streams_;
+  static HandleMap open_handles_;
 
   /**
    * Counts for opened files.
@@ -229,13 +439,21 @@ class File {
   std::string filename_;
 
   /**
-   * Stream for underlying filesystem object.
+   * Descriptor of underlying filesystem object.
    */
-  std::shared_ptr<std::fstream> stream_;
+  std::shared_ptr<FileHandle> handle_;
 
   friend class FileIterator;
 };
 
+/**
+ * @brief File of pages holding records.
+ *
+ * The first of every SPACEMAPENTRIES + 1 pages belongs to the space map,
+ * which records for each page whether it is in use and how much free space
+ * it has.  Allocating, deleting and iterating over pages only look at the
+ * space map, which is kept in memory while the file is open.
+ */
 class PageFile : public File {
  public:
 
@@ -249,10 +467,10 @@ class PageFile : public File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
+	 * It first checks if the file is already open. If so, then the new File object created uses the same descriptor to read to or write fom
 	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the descriptor associated with this File object are inserted into the
+	 * open_handles_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -300,6 +518,24 @@ class PageFile : public File {
    */
   Page allocatePage(PageId &new_page_number);
 
+  /**
+   * Allocates a new page in the file, setting it up in the given page object.
+   *
+   * @param new_page_number   Number of the new page returned via this variable.
+   * @param page              Page object set up as the new page.
+   */
+  void allocatePageInto(PageId &new_page_number, Page* page);
+
+  /**
+   * Adds the given pages to the end of the file, giving each the next page
+   * number.  Consecutive pages go out in one vectored write and the header is
+   * updated once for all of them.  Free pages are not reused.
+   *
+   * @param pages   Pages to add, whose page numbers are set.
+   * @param count   Number of pages in <pages>.
+   */
+  void appendPages(Page* pages, const std::uint32_t count);
+
   /**
    * Reads an existing page from the file.
    *
@@ -311,21 +547,79 @@ class PageFile : public File {
   Page readPage(const PageId page_number) const;
 
   /**
-   * Writes a page into the file at the given page number.
-   * No bounds checking is performed.
+   * Reads an existing page from the file straight into the given page object.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page object to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   */
+  void readPageInto(const PageId page_number, Page* page) const;
+
+  /**
+   * Writes a page into the file at the given page number and records its
+   * free space in the space map.
    *
    * @param page_number Number of page whose contents to replace.
    * @param new_page    Page to write.
+   * @throws  InvalidPageException  If the page is not currently used.
    */
   void writePage(const PageId page_number, const Page& new_page);
 
   /**
-   * Deletes a page from the file.
+   * Deletes a page from the file.  Only the space map changes; the page is
+   * reused by a later allocatePage.
    *
    * @param page_number   Number of page to delete.
+   * @throws  InvalidPageException  If the page is not currently used.
    */
   void deletePage(const PageId page_number);
 
+  /**
+   * Checks a page read through a PageIo engine the way readPage would.
+   *
+   * @param page_number Number of page that was read.
+   * @param page        Page that was read.
+   * @throws  InvalidPageException  If the page is not currently used.
+   */
+  void checkRead(const PageId page_number, const Page& page) const;
+
+  /**
+   * Sets up a request for a PageIo engine to write the given page object as
+   * the given page, recording its free space in the space map.
+   *
+   * @param request     Request to set up.
+   * @param page_number Number of page whose contents to replace.
+   * @param page        Page to write, which must not change until the
+   *                    request completes.
+   * @return  False if the page is not in use, which writePage reports.
+   */
+  bool prepareWrite(IoRequest& request, const PageId page_number,
+                    const Page* page) const;
+
+  /**
+   * Returns the first used page with at least the given number of bytes of
+   * free space, as of the last time the page was written.  Only the space map
+   * is searched; no page is read.
+   *
+   * @param bytes   Free space wanted.
+   * @return  Number of page, or Page::INVALID_NUMBER if no page has the room.
+   */
+  PageId findPageWithSpace(const std::size_t bytes) const;
+
+  /**
+   * Inserts a record into the first page the space map says has room for it,
+   * allocating a page (possibly one freed by deletePage) if none has.  The page
+   * is read and written directly, so it must not be held dirty in a buffer
+   * pool at the same time.
+   *
+   * @param record_data  Bytes that compose the record.
+   * @return  ID of the newly inserted record.
+   * @throws  InsufficientSpaceException  If the record doesn't fit even in an
+   *                                      empty page.
+   */
+  RecordId insertRecord(const std::string& record_data);
+
   /**
    * Returns an iterator at the first page in the file.
    *
@@ -344,31 +638,54 @@ class PageFile : public File {
  private:
 
   /**
-   * Reads a page from the file.  If <allow_free> is not set, an exception
-   * will be thrown if the page read from disk is not currently in use.
+   * Reads the space map from the file, unless another File object of the
+   * file already did.
+   */
+  void loadSpaceMap();
+
+  /**
+   * Returns the space map entry of the given page.  The caller must hold the
+   * latch.
+   *
+   * @param page_number   Number of page.
+   * @return  0 if the page is not in use, otherwise 1 plus its free-space
+   *          class.
+   */
+  unsigned char spaceEntry(const PageId page_number) const;
+
+  /**
+   * Sets the space map entry of the given page and marks its map page dirty.
+   * The caller must hold the latch.
    *
-   * No bounds checking is performed; the underlying file stream will throw
-   * an exception if the page is past the end of the file.
+   * @param page_number   Number of page.
+   * @param entry         New entry.
+   */
+  void setSpaceEntry(const PageId page_number, const unsigned char entry) const;
+
+  /**
+   * Returns the space map entry recording the free space of a used page.
    *
-   * @param page_number   Number of page to read.
-   * @param allow_free    Whether to allow reading a free (unused) page.
-   * @return  The page.
-   * @throws  InvalidPageException  If the page is free (unused) and
-   *                                allow_free is false.
+   * @param page  Page in use.
+   * @return  Space map entry.
    */
-  Page readPage(const PageId page_number, const bool allow_free) const;
+  static unsigned char spaceEntryFor(const Page& page);
 
   /**
-   * Writes a page into the file at the given page number with the given header.
-   * This does not ensure that the number in the header equals the position on
-   * disk.  No bounds checking is performed.
+   * Returns the first used page from the given page on.  The caller must hold
+   * the latch.
    *
-   * @param page_number Number of page whose contents to replace.
-   * @param header      Header of page to write.
-   * @param new_page    Page to write.
+   * @param page_number   Number of page to start at.
+   * @return  Number of page, or Page::INVALID_NUMBER if there is none.
+   */
+  PageId firstUsedPageFrom(const PageId page_number) const;
+
+  /**
+   * Returns the used page after the given page, for FileIterator.
+   *
+   * @param page_number   Number of page.
+   * @return  Number of page, or Page::INVALID_NUMBER if there is none.
    */
-  void writePage(const PageId page_number, const PageHeader& header,
-                 const Page& new_page);
+  PageId nextUsedPage(const PageId page_number) const;
 
   /**
    * Reads only the header of the given page from disk (not the record data
@@ -395,10 +712,10 @@ class BlobFile : public File {
 
   /**
    * Opens the file named fileName and returns the corresponding File object.
-	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
+	 * It first checks if the file is already open. If so, then the new File object created uses the same descriptor to read to or write fom
 	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the descriptor associated with this File object are inserted into the
+	 * open_handles_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -448,6 +765,14 @@ class BlobFile : public File {
    */
   Page allocatePage(PageId &new_page_number);
 
+  /**
+   * Allocates a new page in the file, setting it up in the given page object.
+   *
+   * @param new_page_number   Number of the new page returned via this variable.
+   * @param page              Page object set up as the new page.
+   */
+  void allocatePageInto(PageId &new_page_number, Page* page);
+
   /**
    * Reads an existing page from the file.
    *
@@ -458,6 +783,16 @@ class BlobFile : public File {
    */
   Page readPage(const PageId page_number) const;
 
+  /**
+   * Reads an existing page from the file straight into the given page object.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page object to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   */
+  void readPageInto(const PageId page_number, Page* page) const;
+
   /**
    * Writes a page into the file at the given page number.
    * No bounds checking is performed.
@@ -473,6 +808,77 @@ class BlobFile : public File {
    * @param page_number   Number of page to delete.
    */
   void deletePage(const PageId page_number);
+
+  /**
+   * Sets up a request for a PageIo engine to write the given page object as
+   * the given page.  No bounds checking is performed.
+   *
+   * @param request     Request to set up.
+   * @param page_number Number of page whose contents to replace.
+   * @param page        Page to write, which must not change until the
+   *                    request completes.
+   * @return  True, blob pages are always written whole.
+   */
+  bool prepareWrite(IoRequest& request, const PageId page_number,
+                    const Page* page) const;
+
+  /**
+   * Maps every page of the file into memory read-only, so they can be read
+   * through mappedPage() without a system call or a copy.  Mapping a mapped
+   * file again picks up pages allocated since.  The mapping is advised for
+   * random access.
+   *
+   * @throws  BadgerDbException  If the file cannot be mapped.
+   */
+  void map();
+
+  /**
+   * Removes the mapping made by map(), if any.
+   */
+  void unmap();
+
+  /**
+   * @return  True if the file is mapped.
+   */
+  bool isMapped() const { return mapping_ != NULL; }
+
+  /**
+   * Returns the given page in the mapping.  Pages written after the file was
+   * mapped are seen through the mapping as well, but the page must not be
+   * used after unmap().
+   *
+   * @param page_number   Number of page.
+   * @return  The page, which must not be written through.
+   * @throws  InvalidPageException  If the file is not mapped or the page was
+   *                                not in the file when it was mapped.
+   */
+  const Page* mappedPage(const PageId page_number) const;
+
+  /**
+   * Advises the operating system that the given pages of the mapping will be
+   * read soon, so it starts reading them in.  Does nothing if the file is not
+   * mapped.
+   *
+   * @param first_page  Number of the first page.
+   * @param count       Number of consecutive pages.
+   */
+  void adviseWillNeed(const PageId first_page, const PageId count) const;
+
+ private:
+  /**
+   * Start of the mapping of the file, NULL if it is not mapped.
+   */
+  void* mapping_;
+
+  /**
+   * Number of pages in the file when it was mapped, including the header.
+   */
+  PageId mapped_pages_;
+
+  /**
+   * Length of the mapping in bytes.
+   */
+  size_t mapping_length_;
 };
 
 }
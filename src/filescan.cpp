@@ -5,18 +5,23 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
+#include <thread>
+#include <vector>
 #include "filescan.h"
 #include "exceptions/end_of_file_exception.h"
 
 namespace badgerdb { 
 
-FileScan::FileScan(const std::string &name, BufMgr *bufferMgr)
+FileScan::FileScan(const std::string &name, BufMgr *bufferMgr, const std::uint32_t ringFrames)
 {
   file = new PageFile(name, false);	//dont create new file
 	bufMgr = bufferMgr;
+  ring = ringFrames > 0 ? new BufRing(ringFrames) : NULL;
 	curDirtyFlag = false;
   curPage = NULL;
 	filePageIter = file->begin();
+  aheadPages = 0;
 }
 
 FileScan::~FileScan()
@@ -24,18 +29,29 @@ FileScan::~FileScan()
   // generally must unpin last page of the scan
   if (curPage != NULL)
   {
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
+    bufMgr->unPinPage(file, filePageIter.page_number(), curDirtyFlag);
     curPage = NULL;
 		curDirtyFlag = false;
     filePageIter = file->begin();
   }
   delete file;
+  delete ring;
 }
 
-void FileScan::scanNext(RecordId& outRid)
+void FileScan::flush()
 {
-  std::string rec;
+  if (curPage != NULL)
+  {
+    bufMgr->unPinPage(file, filePageIter.page_number(), curDirtyFlag);
+    curPage = NULL;
+		curDirtyFlag = false;
+  }
+  filePageIter = file->begin();
+	bufMgr->flushFile(file);
+}
 
+void FileScan::scanNext(RecordId& outRid)
+{
   if (filePageIter == file->end())
 	{
 		throw EndOfFileException();
@@ -52,17 +68,16 @@ void FileScan::scanNext(RecordId& outRid)
 		}
 	 
 		// read the first page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage); 
+    bufMgr->readPage(file, filePageIter.page_number(), curPage, ring); 
 		curDirtyFlag = false;
+    aheadPages = 0;
+    readAhead();
 
 		// get the first record off the page
     pageRecordIter = curPage->begin(); 
 
 		if(pageRecordIter != curPage->end()) 
 		{
-		  // get pointer to record
-		  rec = *pageRecordIter;
-
 			outRid = pageRecordIter.getCurrentRecord();
 			return;
 		}
@@ -75,11 +90,15 @@ void FileScan::scanNext(RecordId& outRid)
   while (pageRecordIter == curPage->end())
   {
     // unpin the current page
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
+    bufMgr->unPinPage(file, filePageIter.page_number(), curDirtyFlag);
     curPage = NULL;
     curDirtyFlag = false;
 
     filePageIter++;
+    if (aheadPages > 0)
+    {
+      aheadPages--;
+    }
     if (filePageIter == file->end())
     {
       curPage = NULL;
@@ -87,22 +106,50 @@ void FileScan::scanNext(RecordId& outRid)
     }
 
     // read the next page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage);
+    readAhead();
+    bufMgr->readPage(file, filePageIter.page_number(), curPage, ring);
 
     // get the first record off the page
     pageRecordIter = curPage->begin(); 
   }
 
-  // curRec points at a valid record
-  // see if the record satisfies the scan's predicate 
-  // get a pointer to the record
-  rec = *pageRecordIter;
-
+  // curRec points at a valid record, the caller reads it through getRecord or getRecordView
 	// return rid of the record
 	outRid = pageRecordIter.getCurrentRecord();
 	return;
 }
 
+void FileScan::readAhead()
+{
+  // leave the ring room for the page being scanned
+  std::uint32_t window = FILESCANREADAHEAD;
+  if (ring != NULL)
+  {
+    window = std::min(window, ring->size() / 2);
+  }
+  if (aheadPages > window / 2)
+  {
+    return;
+  }
+
+  if (aheadPages == 0)
+  {
+    aheadIter = filePageIter;
+    aheadIter++;
+  }
+
+  // the pages are found in the space map of the file, their reads are submitted together
+  std::vector<PageId> pageNos;
+  for (; aheadPages < window && aheadIter != file->end(); aheadIter++, aheadPages++)
+  {
+    pageNos.push_back(aheadIter.page_number());
+  }
+  if (!pageNos.empty())
+  {
+    bufMgr->prefetchPages(file, &pageNos[0], (std::uint32_t)pageNos.size(), ring);
+  }
+}
+
 // returns pointer to the current record.  page is left pinned
 // and the scan logic is required to unpin the page 
 std::string FileScan::getRecord()
@@ -110,10 +157,148 @@ std::string FileScan::getRecord()
   return *pageRecordIter;
 }
 
+// returns a view of the current record in the pinned page, no bytes are copied
+RecordView FileScan::getRecordView()
+{
+  return pageRecordIter.getRecordView();
+}
+
 // mark current page of scan dirty
 void FileScan::markDirty()
 {
   curDirtyFlag = true;
 }
 
+// -----------------------------------------------------------------------------
+// ParallelFileScan
+// -----------------------------------------------------------------------------
+
+ParallelFileScan::ParallelFileScan(const std::string &name, BufMgr *bufferMgr, const std::uint32_t ringFramesIn)
+  : nextMorsel(0), failed(false)
+{
+  file = new PageFile(name, false);	//dont create new file
+	bufMgr = bufferMgr;
+  ringFrames = ringFramesIn;
+}
+
+ParallelFileScan::~ParallelFileScan()
+{
+  delete file;
+}
+
+void ParallelFileScan::flush()
+{
+	bufMgr->flushFile(file);
+}
+
+std::uint32_t ParallelFileScan::readAheadWindow() const
+{
+  // leave the ring room for the page being scanned
+  if (ringFrames > 0)
+  {
+    return std::max<std::uint32_t>(std::min(FILESCANREADAHEAD, ringFrames / 2), 1);
+  }
+  return FILESCANREADAHEAD;
+}
+
+std::uint32_t ParallelFileScan::maxWorkers() const
+{
+  // a worker has its read-ahead claimed and the page it is scanning pinned
+  return std::max<std::uint32_t>(bufMgr->numFrames() / 2 / (readAheadWindow() + 1), 1);
+}
+
+std::uint32_t ParallelFileScan::defaultWorkers() const
+{
+  // hardware_concurrency is 0 when it cannot tell
+  return std::max<std::uint32_t>(std::min(std::thread::hardware_concurrency(), maxWorkers()), 1);
+}
+
+void ParallelFileScan::scan(const std::vector<ScanConsumer*>& consumers)
+{
+  // the used pages come from the space map of the file, no page is read
+  pageNos.clear();
+  for (FileIterator iter = file->begin(); iter != file->end(); iter++)
+  {
+    pageNos.push_back(iter.page_number());
+  }
+  nextMorsel = 0;
+  failed = false;
+
+  // more workers than the buffer pool has frames for would fail to get one
+  const std::size_t numWorkers = std::min<std::size_t>(consumers.size(), maxWorkers());
+  std::vector<std::exception_ptr> errors(numWorkers);
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < numWorkers; i++)
+  {
+    workers.push_back(std::thread(&ParallelFileScan::work, this, consumers[i], &errors[i]));
+  }
+  // the calling thread is the first worker
+  if (numWorkers > 0)
+  {
+    work(consumers[0], &errors[0]);
+  }
+  for (std::size_t i = 0; i < workers.size(); i++)
+  {
+    workers[i].join();
+  }
+
+  for (std::size_t i = 0; i < errors.size(); i++)
+  {
+    if (errors[i] != NULL)
+    {
+      std::rethrow_exception(errors[i]);
+    }
+  }
+}
+
+void ParallelFileScan::work(ScanConsumer* consumer, std::exception_ptr* error)
+{
+  BufRing* ring = ringFrames > 0 ? new BufRing(ringFrames) : NULL;
+  Page* page = NULL;
+  PageId pageNo = Page::INVALID_NUMBER;
+  try
+  {
+    while (!failed)
+    {
+      const std::size_t first = nextMorsel.fetch_add(1) * SCANMORSELPAGES;
+      if (first >= pageNos.size())
+      {
+        break;
+      }
+      const std::size_t last = std::min<std::size_t>(first + SCANMORSELPAGES, pageNos.size());
+
+      // the pages are read ahead in batches as in a FileScan, so that a worker holds no more frames than one
+      const std::size_t window = readAheadWindow();
+
+      std::size_t aheadEnd = first;
+      for (std::size_t i = first; i < last; i++)
+      {
+        if (i == aheadEnd)
+        {
+          aheadEnd = std::min(i + window, last);
+          bufMgr->prefetchPages(file, &pageNos[i], (std::uint32_t)(aheadEnd - i), ring);
+        }
+        pageNo = pageNos[i];
+        bufMgr->readPage(file, pageNo, page, ring);
+        for (PageIterator iter = page->begin(); iter != page->end(); iter++)
+        {
+          consumer->consume(iter.getCurrentRecord(), iter.getRecordView());
+        }
+        bufMgr->unPinPage(file, pageNo, false);
+        page = NULL;
+      }
+    }
+  }
+  catch (...)
+  {
+    *error = std::current_exception();
+    failed = true;
+    if (page != NULL)
+    {
+      bufMgr->unPinPage(file, pageNo, false);
+    }
+  }
+  delete ring;
+}
+
 }
@@ -8,7 +8,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <exception>
 #include <string>
+#include <vector>
 #include "types.h"
 #include "page.h"
 #include "buffer.h"
@@ -17,6 +20,16 @@
 
 namespace badgerdb {
 
+/**
+ * @brief Most pages a FileScan reads ahead of the page it is on.
+ */
+const std::uint32_t FILESCANREADAHEAD = 8;
+
+/**
+ * @brief Number of pages in a morsel, the share of a relation a ParallelFileScan worker takes at a time.
+ */
+const std::uint32_t SCANMORSELPAGES = 16;
+
 /**
  * @brief This class is used to sequentially scan records in a relation.
  */
@@ -24,19 +37,28 @@ class FileScan
 {
  public:
 
-  FileScan(const std::string &name, BufMgr *bufMgr);
+  //opens a scan of the named relation. With ringFrames > 0 the scan reads through a BufRing
+  //of that many frames instead of drawing frames from the whole buffer pool
+  FileScan(const std::string &name, BufMgr *bufMgr, const std::uint32_t ringFrames = 0);
 
   ~FileScan();
 
   //return RecordId of next record that satisfies the scan 
   void scanNext(RecordId& outRid);
 
-  //read current record, returning pointer and length
+  //read current record, returning a copy
   std::string getRecord();
 
+  //view of the current record without copying it, valid until the scan moves to the next page
+  RecordView getRecordView();
+
   //marks current page of scan dirty
   void markDirty();
 
+  //unpins the current page and writes out and drops the pages of the relation from the buffer pool,
+  //so that it can be removed or opened again. The scan starts over from the first record afterwards
+  void flush();
+
  private:
   /**
    * File which is being scanned.
@@ -48,6 +70,11 @@ class FileScan
    */
 	BufMgr				*bufMgr;
 
+  /**
+   * Ring of frames the scan recycles, NULL if it reads through the whole buffer pool.
+   */
+  BufRing       *ring;
+
   /**
    * Current page being scanned.
    */
@@ -56,10 +83,110 @@ class FileScan
   FileIterator  filePageIter;
   PageIterator  pageRecordIter;
 
+  /**
+   * Page after the last page read ahead.
+   */
+  FileIterator  aheadIter;
+
+  /**
+   * Number of pages after the current one that have been read ahead.
+   */
+  std::uint32_t aheadPages;
+
   /**
    * True if page has been updated
    */
   bool  	      curDirtyFlag;
+
+  //reads ahead the pages after the current one, in a batch once half of
+  //those read ahead have been scanned
+  void readAhead();
+};
+
+/**
+ * @brief Receives the records a ParallelFileScan worker finds. Each worker has its own consumer, which is only
+ * called from that worker's thread.
+ */
+class ScanConsumer
+{
+ public:
+  virtual ~ScanConsumer() {}
+
+  //called for every record in the relation, the view is only valid until the call returns
+  virtual void consume(const RecordId& rid, const RecordView& record) = 0;
+};
+
+/**
+ * @brief This class is used to scan all records in a relation with several threads. The relation is split into
+ * morsels of SCANMORSELPAGES pages that the workers take in turn through the buffer manager, so the order in which
+ * records are handed out is not fixed.
+ */
+class ParallelFileScan
+{
+ public:
+
+  //opens a scan of the named relation. With ringFrames > 0 every worker reads through a BufRing
+  //of that many frames instead of drawing frames from the whole buffer pool
+  ParallelFileScan(const std::string &name, BufMgr *bufMgr, const std::uint32_t ringFrames = 0);
+
+  ~ParallelFileScan();
+
+  //scans the relation with one worker thread per consumer and returns once all of them are done.
+  //no more than maxWorkers() workers run, the consumers after those are handed no records.
+  //an exception thrown by a worker stops the others and is rethrown here
+  void scan(const std::vector<ScanConsumer*>& consumers);
+
+  //most workers the buffer pool has frames for, each holding as many as a FileScan while leaving
+  //half of the pool to others
+  std::uint32_t maxWorkers() const;
+
+  //number of workers to use for a scan, one per core up to maxWorkers()
+  std::uint32_t defaultWorkers() const;
+
+  //writes out and drops the pages of the relation from the buffer pool once the scan is done,
+  //so that it can be removed or opened again
+  void flush();
+
+ private:
+  /**
+   * File which is being scanned.
+   */
+  PageFile      *file;
+
+  /**
+   * Buffer Manager instance used to read pages into the buffer pool.
+   */
+	BufMgr				*bufMgr;
+
+  /**
+   * Frames in the ring of each worker, 0 to read through the whole buffer pool.
+   */
+  std::uint32_t ringFrames;
+
+  /**
+   * Used pages of the file, in order, the morsels being runs of them.
+   */
+  std::vector<PageId> pageNos;
+
+  /**
+   * Next morsel to be taken by a worker.
+   */
+  std::atomic<std::size_t> nextMorsel;
+
+  /**
+   * Set when a worker fails, so that the others stop taking morsels.
+   */
+  std::atomic<bool> failed;
+
+  //pages a worker reads ahead at a time
+  std::uint32_t readAheadWindow() const;
+
+  //takes morsels until there are none left, handing their records to the consumer
+  void work(ScanConsumer* consumer, std::exception_ptr* error);
+
+  // Scans are not copied
+  ParallelFileScan(const ParallelFileScan&);
+  ParallelFileScan& operator=(const ParallelFileScan&);
 };
 
 }
@@ -5,12 +5,14 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <thread>
 #include <vector>
 #include "btree.h"
 #include "page.h"
 #include "filescan.h"
 #include "page_iterator.h"
 #include "file_iterator.h"
+#include "record_appender.h"
 #include "exceptions/insufficient_space_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
@@ -19,6 +21,8 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/badgerdb_exception.h"
+#include "exceptions/invalid_record_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -68,15 +72,23 @@ void createRelationForward();
 void createRelationBackward();
 void createRelationRandom();
 void intTests();
+void intBulkLoadTests();
+void intDeleteTests();
+void intCursorTests();
+int cursorCount(IndexCursor& cursor);
 int intScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
 void indexTests();
 void doubleTests();
 int doubleScan(BTreeIndex *index, double lowVal, Operator lowOp, double highVal, Operator highOp);
 void stringTests();
 int stringScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+void pageTests();
+void spaceMapTests();
+void parallelScanTests();
 void test1();
 void test2();
 void test3();
+void policyTests();
 void errorTests();
 void deleteRelation();
 
@@ -147,9 +159,8 @@ int main(int argc, char **argv)
 			{
 				fscan.scanNext(scanRid);
 				//Assuming RECORD.i is our key, lets extract the key, which we know is INTEGER and whose byte offset is also know inside the record. 
-				std::string recordStr = fscan.getRecord();
-				const char *record = recordStr.c_str();
-				int key = *((int *)(record + offsetof (RECORD, i)));
+				RecordView record = fscan.getRecordView();
+				int key = *((int *)(record.data() + offsetof (RECORD, i)));
 				std::cout << "Extracted : " << key << std::endl;
 			}
 		}
@@ -157,19 +168,240 @@ int main(int argc, char **argv)
 		{
 			std::cout << "Read all records" << std::endl;
 		}
+		fscan.flush();
 	}
 	// filescan goes out of scope here, so relation file gets closed.
 
 	File::remove(relationName);
 
+	pageTests();
+	spaceMapTests();
 	test1();
 	test2();
 	test3();
+	policyTests();
 	errorTests();
 
   return 1;
 }
 
+// -----------------------------------------------------------------------------
+// pageTests
+// -----------------------------------------------------------------------------
+
+// Count the records of the page, and those whose key is not the one they were inserted with
+int pageRecordCount(Page& page, const std::vector<int>& slotKeys, int& wrongKeys)
+{
+	int numRecords = 0;
+	wrongKeys = 0;
+	for(PageIterator iter = page.begin(); iter != page.end(); iter++)
+	{
+		RecordView record = iter.getRecordView();
+		if(*((int *)(record.data() + offsetof (RECORD, i))) != slotKeys[iter.getCurrentRecord().slot_number])
+		{
+			wrongKeys++;
+		}
+		numRecords++;
+	}
+	return numRecords;
+}
+
+void pageTests()
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "Delete records from a page in a batch and fill it again" << std::endl;
+	Page page;
+	memset(record1.s, ' ', sizeof(record1.s));
+	std::vector<int> slotKeys(1, -1);
+	std::vector<RecordId> rids;
+
+	// Fill the page
+	for(int i = 0; ; i++)
+	{
+		record1.i = i;
+		std::string data(reinterpret_cast<char*>(&record1), sizeof(record1));
+		if(!page.hasSpaceForRecord(data))
+		{
+			break;
+		}
+		rids.push_back(page.insertRecord(data));
+		slotKeys.push_back(i);
+	}
+	const int numSlots = (int)rids.size();
+
+	// A repeated ID fails the whole batch
+	RecordId repeated[3] = {rids[0], rids[1], rids[0]};
+	try
+	{
+		page.deleteRecords(repeated, 3);
+		std::cout << "Repeated record ID was not rejected" << std::endl;
+		exit(1);
+	}
+	catch(InvalidRecordException e)
+	{
+		std::cout << "Repeated record ID rejected" << std::endl;
+	}
+	int wrongKeys;
+	checkPassFail(pageRecordCount(page, slotKeys, wrongKeys), numSlots)
+
+	// Delete every other record, the rest keep their data
+	std::vector<RecordId> deleted;
+	for(int i = 0; i < numSlots; i += 2)
+	{
+		deleted.push_back(rids[i]);
+	}
+	page.deleteRecords(&deleted[0], deleted.size());
+	checkPassFail(pageRecordCount(page, slotKeys, wrongKeys), numSlots - (int)deleted.size())
+	checkPassFail(wrongKeys, 0)
+
+	// The space is reclaimed by compacting the page and the freed slots are reused
+	int maxSlot = 0;
+	for(int i = 0; i < (int)deleted.size(); i++)
+	{
+		record1.i = numSlots + i;
+		RecordId rid = page.insertRecord(std::string(reinterpret_cast<char*>(&record1), sizeof(record1)));
+		slotKeys[rid.slot_number] = record1.i;
+		maxSlot = std::max<int>(maxSlot, rid.slot_number);
+	}
+	checkPassFail(maxSlot, numSlots)
+	checkPassFail(pageRecordCount(page, slotKeys, wrongKeys), numSlots)
+	checkPassFail(wrongKeys, 0)
+}
+
+// -----------------------------------------------------------------------------
+// spaceMapTests
+// -----------------------------------------------------------------------------
+
+void spaceMapTests()
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "Insert records where the space map finds room" << std::endl;
+	const std::size_t recordSpace = sizeof(RECORD) + sizeof(PageSlot);
+	{
+		PageFile file = PageFile::create(relationName);
+		memset(record1.s, ' ', sizeof(record1.s));
+		std::vector<PageId> pageNos;
+		for(int i = 0; i < 300; i++)
+		{
+			sprintf(record1.s, "%05d string record", i);
+			record1.i = i;
+			record1.d = (double)i;
+			RecordId rid = file.insertRecord(std::string(reinterpret_cast<char*>(&record1), sizeof(record1)));
+			if(pageNos.empty() || pageNos.back() != rid.page_number)
+			{
+				pageNos.push_back(rid.page_number);
+			}
+		}
+
+		// Pages are filled in turn, only the last one has room left
+		int numRecords = 0;
+		for(FileIterator iter = file.begin(); iter != file.end(); iter++)
+		{
+			Page page = *iter;
+			for(PageIterator pageIter = page.begin(); pageIter != page.end(); pageIter++)
+			{
+				numRecords++;
+			}
+		}
+		checkPassFail(numRecords, 300)
+		checkPassFail(file.findPageWithSpace(recordSpace), pageNos.back())
+
+		// A deleted page is the next one allocated
+		file.deletePage(pageNos[1]);
+		PageId newPageNo;
+		file.allocatePage(newPageNo);
+		checkPassFail(newPageNo, pageNos[1])
+
+		// Room made by a delete is found ahead of the pages after it
+		Page firstPage = file.readPage(pageNos[0]);
+		RecordId firstRid = {pageNos[0], 1};
+		firstPage.deleteRecord(firstRid);
+		file.writePage(pageNos[0], firstPage);
+		checkPassFail(file.findPageWithSpace(recordSpace), pageNos[0])
+		RecordId rid = file.insertRecord(std::string(reinterpret_cast<char*>(&record1), sizeof(record1)));
+		checkPassFail(rid.page_number, pageNos[0])
+		checkPassFail(file.findPageWithSpace(recordSpace), newPageNo)
+	}
+	File::remove(relationName);
+}
+
+// -----------------------------------------------------------------------------
+// parallelScanTests
+// -----------------------------------------------------------------------------
+
+// Counts the times each key is handed to one worker of a parallel scan
+class KeyCounter : public ScanConsumer
+{
+ public:
+	std::vector<int> counts;
+
+	KeyCounter() : counts(relationSize, 0) {}
+
+	void consume(const RecordId& rid, const RecordView& record)
+	{
+		counts[*((int *)(record.data() + offsetof (RECORD, i)))]++;
+	}
+};
+
+void parallelScanTests()
+{
+	// Many more consumers than cores or than the buffer pool has frames for, only as many workers as fit run
+	std::cout << "Scan the relation with a parallel scan given more consumers than cores" << std::endl;
+	const int numConsumers = 4 * std::max<int>(std::thread::hardware_concurrency(), 1) + 32;
+	std::vector<KeyCounter> counters(numConsumers);
+	std::vector<ScanConsumer*> consumers;
+	for(int i = 0; i < numConsumers; i++)
+	{
+		consumers.push_back(&counters[i]);
+	}
+
+	ParallelFileScan scan(relationName, bufMgr, BUFRINGSIZE);
+	scan.scan(consumers);
+	scan.flush();
+
+	// Every key is seen exactly once
+	int keysSeenOnce = 0;
+	for(int key = 0; key < relationSize; key++)
+	{
+		int count = 0;
+		for(int i = 0; i < numConsumers; i++)
+		{
+			count += counters[i].counts[key];
+		}
+		if(count == 1)
+		{
+			keysSeenOnce++;
+		}
+	}
+	checkPassFail(keysSeenOnce, relationSize)
+	checkPassFail((scan.maxWorkers() < (std::uint32_t)numConsumers), true)
+}
+
+// -----------------------------------------------------------------------------
+// policyTests
+// -----------------------------------------------------------------------------
+
+void policyTests()
+{
+	// Run the index tests again with the buffer pool under each of the other replacement policies
+	const BufPolicy policies[] = {POLICY_LRU2, POLICY_2Q, POLICY_ARC};
+	const char* names[] = {"LRU-2", "2Q", "ARC"};
+
+	for(int i = 0; i < 3; i++)
+	{
+		std::cout << "---------------------" << std::endl;
+		std::cout << "Replacement policy " << names[i] << std::endl;
+		delete bufMgr;
+		bufMgr = new BufMgr(100, policies[i]);
+		test1();
+		test2();
+		test3();
+	}
+
+	delete bufMgr;
+	bufMgr = new BufMgr(100);
+}
+
 void test1()
 {
 	// Create a relation with tuples valued 0 to relationSize and perform index tests 
@@ -177,6 +409,7 @@ void test1()
 	std::cout << "---------------------" << std::endl;
 	std::cout << "createRelationForward" << std::endl;
 	createRelationForward();
+	parallelScanTests();
 	indexTests();
 	deleteRelation();
 }
@@ -223,8 +456,7 @@ void createRelationForward()
 
   // initialize all of record1.s to keep purify happy
   memset(record1.s, ' ', sizeof(record1.s));
-	PageId new_page_number;
-  Page new_page = file1->allocatePage(new_page_number);
+	RecordAppender appender(file1);
 
   // Insert a bunch of tuples into the relation.
   for(int i = 0; i < relationSize; i++ )
@@ -234,22 +466,10 @@ void createRelationForward()
     record1.d = (double)i;
     std::string new_data(reinterpret_cast<char*>(&record1), sizeof(record1));
 
-		while(1)
-		{
-			try
-			{
-    		new_page.insertRecord(new_data);
-				break;
-			}
-			catch(InsufficientSpaceException e)
-			{
-				file1->writePage(new_page_number, new_page);
-  			new_page = file1->allocatePage(new_page_number);
-			}
-		}
+		appender.append(new_data);
   }
 
-	file1->writePage(new_page_number, new_page);
+	appender.flush();
 }
 
 // -----------------------------------------------------------------------------
@@ -270,8 +490,7 @@ void createRelationBackward()
 
   // initialize all of record1.s to keep purify happy
   memset(record1.s, ' ', sizeof(record1.s));
-	PageId new_page_number;
-  Page new_page = file1->allocatePage(new_page_number);
+	RecordAppender appender(file1);
 
   // Insert a bunch of tuples into the relation.
   for(int i = relationSize - 1; i >= 0; i-- )
@@ -282,22 +501,10 @@ void createRelationBackward()
 
     std::string new_data(reinterpret_cast<char*>(&record1), sizeof(RECORD));
 
-		while(1)
-		{
-			try
-			{
-    		new_page.insertRecord(new_data);
-				break;
-			}
-			catch(InsufficientSpaceException e)
-			{
-				file1->writePage(new_page_number, new_page);
-  			new_page = file1->allocatePage(new_page_number);
-			}
-		}
+		appender.append(new_data);
   }
 
-	file1->writePage(new_page_number, new_page);
+	appender.flush();
 }
 
 // -----------------------------------------------------------------------------
@@ -318,8 +525,7 @@ void createRelationRandom()
 
   // initialize all of record1.s to keep purify happy
   memset(record1.s, ' ', sizeof(record1.s));
-	PageId new_page_number;
-  Page new_page = file1->allocatePage(new_page_number);
+	RecordAppender appender(file1);
 
   // insert records in random order
 
@@ -342,19 +548,7 @@ void createRelationRandom()
 
     std::string new_data(reinterpret_cast<char*>(&record1), sizeof(RECORD));
 
-		while(1)
-		{
-			try
-			{
-    		new_page.insertRecord(new_data);
-				break;
-			}
-			catch(InsufficientSpaceException e)
-			{
-      	file1->writePage(new_page_number, new_page);
-  			new_page = file1->allocatePage(new_page_number);
-			}
-		}
+		appender.append(new_data);
 
 		int temp = intvec[relationSize-1-i];
 		intvec[relationSize-1-i] = intvec[pos];
@@ -362,7 +556,7 @@ void createRelationRandom()
 		i++;
   }
   
-	file1->writePage(new_page_number, new_page);
+	appender.flush();
 }
 
 // -----------------------------------------------------------------------------
@@ -381,6 +575,33 @@ void indexTests()
   	catch(FileNotFoundException e)
   	{
   	}
+
+    intBulkLoadTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    intDeleteTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
+
+    intCursorTests();
+		try
+		{
+			File::remove(intIndexName);
+		}
+  	catch(FileNotFoundException e)
+  	{
+  	}
   }
   else if(testNum == 2)
   {
@@ -425,6 +646,203 @@ void intTests()
 	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
 }
 
+void intBulkLoadTests()
+{
+  // A tiny fill factor builds a tree several levels deep, and a small run size makes the
+  // bulk loader spill and merge sorted runs
+  std::cout << "Bulk load a B+ Tree index on the integer field with a 0.01 fill factor and runs of 1000 entries" << std::endl;
+  BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.01, 1000);
+
+	checkPassFail(intScan(&index,25,GT,40,LT), 14)
+	checkPassFail(intScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(intScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(intScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(intScan(&index,0,GT,1,LT), 0)
+	checkPassFail(intScan(&index,300,GT,400,LT), 99)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+  // Read the deep tree straight from a mapping of the index file, which takes no inserts
+  std::cout << "Scan the integer index read-only through a mapping of the index file" << std::endl;
+	index.setReadOnly(true);
+	checkPassFail(intScan(&index,25,GT,40,LT), 14)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+	bool readOnlyInsert = false;
+	int key = relationSize;
+	try
+	{
+		index.insertEntry(&key, rid);
+	}
+	catch(BadgerDbException e)
+	{
+		readOnlyInsert = true;
+	}
+	checkPassFail(readOnlyInsert, true)
+
+	index.setReadOnly(false);
+	checkPassFail(intScan(&index,300,GT,400,LT), 99)
+}
+
+void intDeleteTests()
+{
+  // The small fill factor gives a deep tree, so deletes exercise merges and redistribution on every level
+  std::cout << "Delete entries from a B+ Tree index on the integer field" << std::endl;
+  BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.01);
+
+	std::vector<std::pair<int, RecordId> > entries;
+	{
+		FileScan fscan(relationName, bufMgr);
+		try
+		{
+			RecordId scanRid;
+			while(1)
+			{
+				fscan.scanNext(scanRid);
+				std::string recordStr = fscan.getRecord();
+				int key = *((int *)(recordStr.c_str() + offsetof (RECORD, i)));
+				entries.push_back(std::make_pair(key, scanRid));
+			}
+		}
+		catch(EndOfFileException e)
+		{
+		}
+		fscan.flush();
+	}
+
+	// Remove the even keys below 3000
+	for(size_t j = 0; j < entries.size(); j++)
+	{
+		if(entries[j].first < 3000 && entries[j].first % 2 == 0)
+			index.deleteEntry(&entries[j].first, entries[j].second);
+	}
+
+	checkPassFail(intScan(&index,25,GT,40,LT), 7)
+	checkPassFail(intScan(&index,300,GT,400,LT), 50)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+
+	std::cout << "Delete an entry that was already deleted" << std::endl;
+	int deletedKey = 2;
+	RecordId deletedRid;
+	for(size_t j = 0; j < entries.size(); j++)
+	{
+		if(entries[j].first == deletedKey)
+			deletedRid = entries[j].second;
+	}
+	try
+	{
+		index.deleteEntry(&deletedKey, deletedRid);
+		std::cout << "Test FAILS: deleting a missing entry did not throw" << std::endl;
+		exit(1);
+	}
+	catch(NoSuchKeyFoundException e)
+	{
+		std::cout << "NoSuchKeyFoundException thrown" << std::endl;
+	}
+
+	// Remove everything that is left, then insert it all again into the freed pages
+	for(size_t j = 0; j < entries.size(); j++)
+	{
+		if(entries[j].first >= 3000 || entries[j].first % 2 != 0)
+			index.deleteEntry(&entries[j].first, entries[j].second);
+	}
+
+	checkPassFail(intScan(&index,-3,GT,5000,LT), 0)
+
+	for(size_t j = 0; j < entries.size(); j++)
+	{
+		index.insertEntry(&entries[j].first, entries[j].second);
+	}
+
+	checkPassFail(intScan(&index,25,GT,40,LT), 14)
+	checkPassFail(intScan(&index,300,GT,400,LT), 99)
+	checkPassFail(intScan(&index,3000,GTE,4000,LT), 1000)
+}
+
+void intCursorTests()
+{
+  std::cout << "Run several scans at once over a B+ Tree index on the integer field" << std::endl;
+  BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER, 0.01);
+
+	// Two cursors and the scan of the index itself advanced in turn
+	int lowA = 25, highA = 40, lowB = 300, highB = 400, lowC = 3000, highC = 4000;
+	IndexCursor cursorA(&index);
+	IndexCursor cursorB(&index);
+	cursorA.startScan(&lowA, GT, &highA, LT);
+	cursorB.startScan(&lowB, GT, &highB, LT);
+	index.startScan(&lowC, GTE, &highC, LT);
+
+	int countA = 0, countB = 0, countC = 0;
+	bool doneA = false, doneB = false, doneC = false;
+	RecordId scanRid;
+	while(!doneA || !doneB || !doneC)
+	{
+		try { if(!doneA) { cursorA.scanNext(scanRid); countA++; } } catch(IndexScanCompletedException e) { doneA = true; }
+		try { if(!doneB) { cursorB.scanNext(scanRid); countB++; } } catch(IndexScanCompletedException e) { doneB = true; }
+		try { if(!doneC) { index.scanNext(scanRid); countC++; } } catch(IndexScanCompletedException e) { doneC = true; }
+	}
+	// cursorB is left open, its destructor ends the scan
+	cursorA.endScan();
+	index.endScan();
+
+	checkPassFail(countA, 14)
+	checkPassFail(countB, 99)
+	checkPassFail(countC, 1000)
+
+	// Nested loop over the same index
+	int outerLow = 0, outerHigh = 5, innerLow = 0, innerHigh = 10, count = 0;
+	IndexCursor outer(&index);
+	outer.startScan(&outerLow, GTE, &outerHigh, LT);
+	try
+	{
+		while(1)
+		{
+			outer.scanNext(scanRid);
+			IndexCursor inner(&index);
+			inner.startScan(&innerLow, GTE, &innerHigh, LT);
+			count += cursorCount(inner);
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	outer.endScan();
+
+	checkPassFail(count, 50)
+
+	// Batches of 64 record ids, the end of the scan is an empty batch
+	RecordId batchRids[64];
+	int batchCount = 0;
+	size_t batchSize;
+	IndexCursor batch(&index);
+	batch.startScan(&lowC, GTE, &highC, LT);
+	while((batchSize = batch.scanNextBatch(batchRids, 64)) > 0)
+	{
+		batchCount += batchSize;
+	}
+	checkPassFail(batchCount, 1000)
+	checkPassFail(batch.scanNextBatch(batchRids, 64), 0)
+	batch.endScan();
+}
+
+int cursorCount(IndexCursor& cursor)
+{
+	RecordId scanRid;
+	int count = 0;
+	try
+	{
+		while(1)
+		{
+			cursor.scanNext(scanRid);
+			count++;
+		}
+	}
+	catch(IndexScanCompletedException e)
+	{
+	}
+	cursor.endScan();
+	return count;
+}
+
 int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
 {
   RecordId scanRid;
@@ -454,7 +872,7 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 		{
 			index->scanNext(scanRid);
 			bufMgr->readPage(file1, scanRid.page_number, curPage);
-			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecordView(scanRid).data()));
 			bufMgr->unPinPage(file1, scanRid.page_number, false);
 
 			if( numResults < 5 )
@@ -533,7 +951,7 @@ int doubleScan(BTreeIndex * index, double lowVal, Operator lowOp, double highVal
 		{
 			index->scanNext(scanRid);
 			bufMgr->readPage(file1, scanRid.page_number, curPage);
-			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecordView(scanRid).data()));
 			bufMgr->unPinPage(file1, scanRid.page_number, false);
 
 			if( numResults < 5 )
@@ -617,7 +1035,7 @@ int stringScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Oper
 		{
 			index->scanNext(scanRid);
 			bufMgr->readPage(file1, scanRid.page_number, curPage);
-			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
+			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecordView(scanRid).data()));
 			bufMgr->unPinPage(file1, scanRid.page_number, false);
 
 			if( numResults < 5 )
@@ -5,6 +5,7 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
 #include <cassert>
 
 #include <iostream>
@@ -27,6 +28,8 @@ void Page::initialize() {
   header_.free_space_upper_bound = DATA_SIZE;
   header_.num_slots = 0;
   header_.num_free_slots = 0;
+  header_.first_free_slot = INVALID_SLOT;
+  header_.fragmented_bytes = 0;
   header_.current_page_number = INVALID_NUMBER;
   header_.next_page_number = INVALID_NUMBER;
   //data_.assign(DATA_SIZE, char());
@@ -38,17 +41,24 @@ RecordId Page::insertRecord(const std::string& record_data) {
     throw InsufficientSpaceException(
         page_number(), record_data.length(), getFreeSpace());
   }
+  std::size_t record_size = record_data.length();
+  if (header_.num_free_slots == 0) {
+    record_size += sizeof(PageSlot);
+  }
+  reserveContiguousSpace(record_size);
   const SlotId slot_number = getAvailableSlot();
   insertRecordInSlot(slot_number, record_data);
   return {page_number(), slot_number};
 }
 
 std::string Page::getRecord(const RecordId& record_id) const {
+  return getRecordView(record_id).str();
+}
+
+RecordView Page::getRecordView(const RecordId& record_id) const {
   validateRecordId(record_id);
   const PageSlot& slot = getSlot(record_id.slot_number);
-	std::string retStr = std::string(data_, DATA_SIZE).substr(slot.item_offset, slot.item_length);
-
-	return retStr;
+  return RecordView(data_ + slot.item_offset, slot.item_length);
 }
 
 void Page::updateRecord(const RecordId& record_id,
@@ -74,64 +84,107 @@ void Page::deleteRecord(const RecordId& record_id) {
 
 void Page::deleteRecord(const RecordId& record_id,
                         const bool allow_slot_compaction) {
+  freeRecordSlot(record_id);
+  if (allow_slot_compaction && record_id.slot_number == header_.num_slots) {
+    compactSlots();
+  }
+}
+
+void Page::deleteRecords(const RecordId* record_ids, const std::size_t count) {
+  // Check every ID before freeing any.  Slots are marked unused as they are
+  // checked so that a repeated ID fails too, and marked used again after.
+  std::size_t checked = 0;
+  try {
+    for (; checked < count; ++checked) {
+      validateRecordId(record_ids[checked]);
+      getSlot(record_ids[checked].slot_number)->used = false;
+    }
+  } catch (const InvalidRecordException&) {
+    for (std::size_t i = 0; i < checked; ++i) {
+      getSlot(record_ids[i].slot_number)->used = true;
+    }
+    throw;
+  }
+
+  for (std::size_t i = 0; i < count; ++i) {
+    getSlot(record_ids[i].slot_number)->used = true;
+    freeRecordSlot(record_ids[i]);
+  }
+  compactSlots();
+}
+
+void Page::freeRecordSlot(const RecordId& record_id) {
   validateRecordId(record_id);
   PageSlot* slot = getSlot(record_id.slot_number);
 
-	for(int i = 0; i < slot->item_length; i++)
-		data_[i + slot->item_offset] = '\0';
+  // The data is left in place; only a record at the edge of the free space
+  // can be given back without moving others.
+  if (slot->item_offset == header_.free_space_upper_bound) {
+    header_.free_space_upper_bound += slot->item_length;
+  } else {
+    header_.fragmented_bytes += slot->item_length;
+  }
 
-  //data_.replace(slot->item_offset, slot->item_length, slot->item_length, '\0');
+  pushFreeSlot(record_id.slot_number);
+  ++header_.num_free_slots;
+}
 
-  // Compact the data by removing the hole left by this record (if necessary).
-  std::uint16_t move_offset = slot->item_offset; 
-  std::size_t move_bytes = 0;
-  for (SlotId i = 1; i <= header_.num_slots; ++i) {
-    PageSlot* other_slot = getSlot(i);
-    if (other_slot->used && other_slot->item_offset < slot->item_offset) {
-      if (other_slot->item_offset < move_offset) {
-        move_offset = other_slot->item_offset;
-      }
-      move_bytes += other_slot->item_length;
-      // Update the slot for the other data to reflect the soon-to-be-new
-      // location.
-      other_slot->item_offset += slot->item_length;
-    }
+void Page::compactSlots() {
+  // Free any unused slots that are at the end of the slot list.  We can't move
+  // used slots without affecting record IDs.
+  while (header_.num_slots > 0 && !getSlot(header_.num_slots)->used) {
+    unlinkFreeSlot(header_.num_slots);
+    --header_.num_slots;
+    --header_.num_free_slots;
   }
-  // If we have data to move, shift it to the right.
-  if (move_bytes > 0) {
-    const std::string& data_to_move = std::string(data_, DATA_SIZE).substr(move_offset, move_bytes);
+  header_.free_space_lower_bound = sizeof(PageSlot) * header_.num_slots;
+}
 
-		for(std::uint16_t i = 0; i < move_bytes; i++)
-			data_[i + move_offset + slot->item_length] = data_to_move[i];
+namespace {
 
-    //data_.replace(move_offset + slot->item_length, move_bytes, data_to_move);
+// Orders slots by the offset of their data, last in the page first.
+struct SlotOffsetGreater {
+  SlotOffsetGreater(const PageSlot* slots) : slots_(slots) {}
+
+  bool operator()(const SlotId a, const SlotId b) const {
+    return slots_[a - 1].item_offset > slots_[b - 1].item_offset;
   }
-  header_.free_space_upper_bound += slot->item_length;
 
-  // Mark slot as unused.
-  slot->used = false;
-  slot->item_offset = 0;
-  slot->item_length = 0;
-  ++header_.num_free_slots;
+  const PageSlot* slots_;
+};
 
-  if (allow_slot_compaction && record_id.slot_number == header_.num_slots) {
-    // Last slot in the list, so we need to free any unused slots that are at
-    // the end of the slot list.
-    int num_slots_to_delete = 1;
-    for (SlotId i = 1; i < header_.num_slots; ++i) {
-      // Traverse list backwards, looking for unused slots.
-      const PageSlot* other_slot = getSlot(header_.num_slots - i);
-      if (!other_slot->used) {
-        ++num_slots_to_delete;
-      } else {
-        // Stop at the first used slot we find, since we can't move used slots
-        // without affecting record IDs.
-        break;
-      }
+}
+
+void Page::compactData() {
+  SlotId used_slots[DATA_SIZE / sizeof(PageSlot)];
+  std::size_t num_used = 0;
+  for (SlotId i = 1; i <= header_.num_slots; ++i) {
+    if (getSlot(i)->used) {
+      used_slots[num_used++] = i;
     }
-    header_.num_slots -= num_slots_to_delete;
-    header_.num_free_slots -= num_slots_to_delete;
-    header_.free_space_lower_bound -= sizeof(PageSlot) * num_slots_to_delete;
+  }
+  std::sort(used_slots, used_slots + num_used,
+            SlotOffsetGreater(getSlot(1)));
+
+  // Records only move towards the end of the page, so taking them last first
+  // never overwrites one not yet moved.
+  std::uint16_t upper_bound = DATA_SIZE;
+  for (std::size_t i = 0; i < num_used; ++i) {
+    PageSlot* slot = getSlot(used_slots[i]);
+    upper_bound -= slot->item_length;
+    if (slot->item_offset != upper_bound) {
+      memmove(&data_[upper_bound], &data_[slot->item_offset],
+              slot->item_length);
+      slot->item_offset = upper_bound;
+    }
+  }
+  header_.free_space_upper_bound = upper_bound;
+  header_.fragmented_bytes = 0;
+}
+
+void Page::reserveContiguousSpace(const std::size_t bytes) {
+  if (getContiguousFreeSpace() < bytes && header_.fragmented_bytes > 0) {
+    compactData();
   }
 }
 
@@ -152,27 +205,44 @@ const PageSlot& Page::getSlot(const SlotId slot_number) const {
 }
 
 SlotId Page::getAvailableSlot() {
-  SlotId slot_number = INVALID_SLOT;
-  if (header_.num_free_slots > 0) {
-    // Have an allocated but unused slot that we can reuse.
-    for (SlotId i = 1; i <= header_.num_slots; ++i) {
-      const PageSlot* slot = getSlot(i);
-      if (!slot->used) {
-        // We don't decrement the number of free slots until someone actually
-        // puts data in the slot.
-        slot_number = i;
-        break;
-      }
-    }
-  } else {
-    // Have to allocate a new slot.
-    slot_number = header_.num_slots + 1;
+  if (header_.num_free_slots == 0) {
+    // Have to allocate a new slot.  It may cover bytes left behind by records
+    // that have since moved, so it is marked unused explicitly.
     ++header_.num_slots;
     ++header_.num_free_slots;
     header_.free_space_lower_bound = sizeof(PageSlot) * header_.num_slots;
+    pushFreeSlot(header_.num_slots);
   }
+  // We don't decrement the number of free slots until someone actually puts
+  // data in the slot.
+  const SlotId slot_number = header_.first_free_slot;
   assert(slot_number != INVALID_SLOT);
-  return static_cast<SlotId>(slot_number);
+  return slot_number;
+}
+
+void Page::pushFreeSlot(const SlotId slot_number) {
+  PageSlot* slot = getSlot(slot_number);
+  slot->used = false;
+  slot->item_offset = header_.first_free_slot;
+  slot->item_length = INVALID_SLOT;
+  if (header_.first_free_slot != INVALID_SLOT) {
+    getSlot(header_.first_free_slot)->item_length = slot_number;
+  }
+  header_.first_free_slot = slot_number;
+}
+
+void Page::unlinkFreeSlot(const SlotId slot_number) {
+  const PageSlot* slot = getSlot(slot_number);
+  const SlotId next = slot->item_offset;
+  const SlotId prev = slot->item_length;
+  if (prev == INVALID_SLOT) {
+    header_.first_free_slot = next;
+  } else {
+    getSlot(prev)->item_offset = next;
+  }
+  if (next != INVALID_SLOT) {
+    getSlot(next)->item_length = prev;
+  }
 }
 
 void Page::insertRecordInSlot(const SlotId slot_number,
@@ -186,6 +256,8 @@ void Page::insertRecordInSlot(const SlotId slot_number,
     throw SlotInUseException(page_number(), slot_number);
   }
   const int record_length = record_data.length();
+  reserveContiguousSpace(record_length);
+  unlinkFreeSlot(slot_number);
   slot->used = true;
   slot->item_length = record_length;
   slot->item_offset = header_.free_space_upper_bound - record_length;
@@ -199,7 +271,9 @@ void Page::insertRecordInSlot(const SlotId slot_number,
 }
 
 void Page::validateRecordId(const RecordId& record_id) const {
-  if (record_id.page_number != page_number()) {
+  if (record_id.page_number != page_number() ||
+      record_id.slot_number == INVALID_SLOT ||
+      record_id.slot_number > header_.num_slots) {
     throw InvalidRecordException(record_id, page_number());
   }
   const PageSlot& slot = getSlot(record_id.slot_number);
@@ -48,6 +48,18 @@ struct PageHeader {
    */
   SlotId num_free_slots;
 
+  /**
+   * First slot of the list of allocated but unused slots, or
+   * Page::INVALID_SLOT if there are none.
+   */
+  SlotId first_free_slot;
+
+  /**
+   * Bytes held by deleted records between the free space upper bound and the
+   * end of the page.  They are reclaimed when the page is compacted.
+   */
+  std::uint16_t fragmented_bytes;
+
   /**
    * Number of the page within the file.
    */
@@ -83,18 +95,74 @@ struct PageSlot {
   bool used;
 
   /**
-   * Offset of the data item in the page.
+   * Offset of the data item in the page.  In an unused slot, the number of the
+   * next unused slot.
    */
   std::uint16_t item_offset;
 
   /**
-   * Length of the data item in this slot.
+   * Length of the data item in this slot.  In an unused slot, the number of the
+   * previous unused slot.
    */
   std::uint16_t item_length;
 };
 
 class PageIterator;
 
+/**
+ * @brief Non-owning view of the bytes of a record in a page.
+ *
+ * Points straight into the page, so it is only valid while the page is pinned
+ * in the buffer pool and the record is neither updated nor deleted.
+ */
+class RecordView {
+ public:
+  /**
+   * Constructs an empty view.
+   */
+  RecordView()
+      : data_(NULL),
+        size_(0) {
+  }
+
+  /**
+   * Constructs a view of the given bytes.
+   *
+   * @param data  First byte of the record.
+   * @param size  Length of the record in bytes.
+   */
+  RecordView(const char* data, const std::size_t size)
+      : data_(data),
+        size_(size) {
+  }
+
+  /**
+   * Returns the first byte of the record.
+   */
+  const char* data() const { return data_; }
+
+  /**
+   * Returns the length of the record in bytes.
+   */
+  std::size_t size() const { return size_; }
+
+  /**
+   * Returns a copy of the record which stays valid after the page is unpinned.
+   */
+  std::string str() const { return std::string(data_, size_); }
+
+ private:
+  /**
+   * First byte of the record.
+   */
+  const char* data_;
+
+  /**
+   * Length of the record in bytes.
+   */
+  std::size_t size_;
+};
+
 /**
  * @brief Class which represents a fixed-size database page containing records.
  *
@@ -151,6 +219,17 @@ class Page {
    */
   std::string getRecord(const RecordId& record_id) const;
 
+  /**
+   * Returns a view of the record with the given ID without copying it.  The
+   * view points into the page and is invalidated when the page is unpinned or
+   * the record is changed.
+   *
+   * @see getRecord
+   * @param record_id  ID of the record to return.
+   * @return  View of the record.
+   */
+  RecordView getRecordView(const RecordId& record_id) const;
+
   /**
    * Updates the record with the given ID, replacing its data with a new
    * version.  This is equivalent to deleting the old record and inserting a
@@ -162,14 +241,28 @@ class Page {
   void updateRecord(const RecordId& record_id, const std::string& record_data);
 
   /**
-   * Deletes the record with the given ID.  Page is compacted upon delete to
-   * ensure that data of all records is contiguous.  Slot array is compacted if
-   * the slot deleted is at the end of the slot array.
+   * Deletes the record with the given ID.  Only the slot is freed; the bytes
+   * of the record stay where they are until an insert needs them and the page
+   * is compacted.  Slot array is compacted if the slot deleted is at the end of
+   * the slot array.
    *
    * @param record_id   ID of the record to delete.
    */
   void deleteRecord(const RecordId& record_id);
 
+  /**
+   * Deletes the records with the given IDs, compacting the slot array once
+   * after all of them are freed.  Every ID is checked first, so if one is
+   * invalid or repeated no record is deleted.
+   *
+   * @see deleteRecord
+   * @param record_ids  IDs of the records to delete.
+   * @param count       Number of IDs in <record_ids>.
+   * @throws  InvalidRecordException  Thrown if an ID has a bad page or slot
+   *                                  number or appears more than once.
+   */
+  void deleteRecords(const RecordId* record_ids, const std::size_t count);
+
   /**
    * Returns true if the page has enough free space to hold the given data.
    *
@@ -179,12 +272,13 @@ class Page {
   bool hasSpaceForRecord(const std::string& record_data) const;
 
   /**
-   * Returns this page's free space in bytes.
+   * Returns this page's free space in bytes, including the bytes of deleted
+   * records not yet reclaimed.
    *
    * @return  Free space in bytes.
    */
-  std::uint16_t getFreeSpace() const { return header_.free_space_upper_bound -
-                                              header_.free_space_lower_bound; }
+  std::uint16_t getFreeSpace() const { return getContiguousFreeSpace() +
+                                              header_.fragmented_bytes; }
 
   /**
    * Returns this page's number in its file.
@@ -240,10 +334,9 @@ class Page {
   }
 
   /**
-   * Deletes the record with the given ID.  Page is compacted upon delete to
-   * ensure that data of all records is contiguous.  Slot array is compacted if
-   * the slot deleted is at the end of the slot array and
-   * <allow_slot_compaction> is set.
+   * Deletes the record with the given ID.  Slot array is compacted if the slot
+   * deleted is at the end of the slot array and <allow_slot_compaction> is
+   * set.
    *
    * @param record_id             ID of the record to delete.
    * @param allow_slot_compaction If true, the slot array will be compacted if
@@ -252,6 +345,58 @@ class Page {
   void deleteRecord(const RecordId& record_id,
                     const bool allow_slot_compaction);
 
+  /**
+   * Frees the slot of the record with the given ID without compacting the slot
+   * array.  The record's bytes are counted as fragmented unless they sit at the
+   * free space upper bound, in which case the bound moves past them.
+   *
+   * @param record_id   ID of the record to free.
+   */
+  void freeRecordSlot(const RecordId& record_id);
+
+  /**
+   * Frees the unused slots at the end of the slot array.
+   */
+  void compactSlots();
+
+  /**
+   * Moves the data of all records to the end of the page so that the bytes of
+   * deleted records join the contiguous free space.  Record IDs don't change.
+   */
+  void compactData();
+
+  /**
+   * Compacts the data if the contiguous free space is smaller than the given
+   * number of bytes.
+   *
+   * @param bytes   Contiguous bytes needed.
+   */
+  void reserveContiguousSpace(const std::size_t bytes);
+
+  /**
+   * Returns the free space between the slot array and the first record.
+   *
+   * @return  Contiguous free space in bytes.
+   */
+  std::uint16_t getContiguousFreeSpace() const {
+    return header_.free_space_upper_bound - header_.free_space_lower_bound;
+  }
+
+  /**
+   * Marks the given slot unused and puts it at the head of the list of unused
+   * slots.
+   *
+   * @param slot_number   Number of slot to free.
+   */
+  void pushFreeSlot(const SlotId slot_number);
+
+  /**
+   * Takes the given unused slot out of the list of unused slots.
+   *
+   * @param slot_number   Number of unused slot.
+   */
+  void unlinkFreeSlot(const SlotId slot_number);
+
   /**
    * Returns the slot with the given number.  This method will return
    * unallocated slots if requested; it is up to the caller to ensure they
@@ -0,0 +1,410 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "pageIo.h"
+#include "exceptions/badgerdb_exception.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define BADGERDB_IO_URING 1
+#endif
+#endif
+#endif
+
+// The kernel hands io_uring requests from the submitting thread to the reaper, which ThreadSanitizer cannot see
+#if defined(__SANITIZE_THREAD__)
+extern "C" void __tsan_acquire(void* addr);
+extern "C" void __tsan_release(void* addr);
+#define IO_HANDOFF_RELEASE(request) __tsan_release(request)
+#define IO_HANDOFF_ACQUIRE(request) __tsan_acquire(request)
+#else
+#define IO_HANDOFF_RELEASE(request)
+#define IO_HANDOFF_ACQUIRE(request)
+#endif
+
+namespace badgerdb {
+
+namespace {
+
+// -----------------------------------------------------------------------------
+// Thread pool
+// -----------------------------------------------------------------------------
+
+class ThreadPoolIo : public PageIo
+{
+ public:
+  ThreadPoolIo(const std::uint32_t depth)
+    : PageIo(depth), stop(false)
+  {
+    for (std::uint32_t i = 0; i < std::min(depth, IOTHREADS); i++)
+      workers.push_back(std::thread(&ThreadPoolIo::work, this));
+  }
+
+  ~ThreadPoolIo()
+  {
+    drain();
+    {
+      std::lock_guard<std::mutex> guard(queueLatch);
+      stop = true;
+    }
+    wake.notify_all();
+    for (std::size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  }
+
+  const char* name() const { return "threads"; }
+
+  void submit(IoRequest* const* requests, const std::uint32_t count)
+  {
+    for (std::uint32_t first = 0; first < count; first += depth)
+    {
+      std::uint32_t n = std::min(depth, count - first);
+      started(n);
+      {
+        std::lock_guard<std::mutex> guard(queueLatch);
+        queue.insert(queue.end(), requests + first, requests + first + n);
+      }
+      wake.notify_all();
+    }
+  }
+
+ private:
+  void work()
+  {
+    std::unique_lock<std::mutex> lock(queueLatch);
+    while (true)
+    {
+      while (!stop && queue.empty())
+        wake.wait(lock);
+      if (queue.empty())
+        return;
+      IoRequest* request = queue.front();
+      queue.pop_front();
+      lock.unlock();
+      finished(request, transfer(request));
+      lock.lock();
+    }
+  }
+
+  // Do the whole read or write, returning the bytes transferred or a negated errno value
+  static ssize_t transfer(IoRequest* request)
+  {
+    char* buffer = static_cast<char*>(request->buffer.iov_base);
+    std::size_t total = 0;
+    while (total < request->buffer.iov_len)
+    {
+      ssize_t done = request->write
+        ? ::pwrite(request->fd, buffer + total, request->buffer.iov_len - total, request->offset + total)
+        : ::pread(request->fd, buffer + total, request->buffer.iov_len - total, request->offset + total);
+      if (done < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        return -errno;
+      }
+      if (done == 0)
+        break;
+      total += done;
+    }
+    return total;
+  }
+
+  std::mutex queueLatch;
+  std::condition_variable wake;
+  std::deque<IoRequest*> queue;
+  std::vector<std::thread> workers;
+  bool stop;
+};
+
+// -----------------------------------------------------------------------------
+// io_uring
+// -----------------------------------------------------------------------------
+
+#ifdef BADGERDB_IO_URING
+
+// Driven through the system calls directly, one submission queue entry per request and a thread reaping completions
+class UringIo : public PageIo
+{
+ public:
+  UringIo(const std::uint32_t depth)
+    : PageIo(depth), ringFd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(MAP_FAILED), sqSize(0), cqSize(0),
+      sqesSize(0)
+  {
+  }
+
+  ~UringIo()
+  {
+    if (reaper.joinable())
+    {
+      drain();
+
+      // a request without a user pointer tells the reaper to stop
+      {
+        std::lock_guard<std::mutex> guard(submitLatch);
+        io_uring_sqe* sqe = nextEntry();
+        sqe->opcode = IORING_OP_NOP;
+        push(1);
+      }
+      reaper.join();
+    }
+
+    if (sqes != MAP_FAILED)
+      ::munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+      ::munmap(cqRing, cqSize);
+    if (sqRing != MAP_FAILED)
+      ::munmap(sqRing, sqSize);
+    if (ringFd >= 0)
+      ::close(ringFd);
+  }
+
+  // Set up the ring, false if the kernel does not allow it
+  bool open()
+  {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ringFd = (int)::syscall(__NR_io_uring_setup, depth, &params);
+    if (ringFd < 0)
+      return false;
+
+    sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      sqSize = cqSize = std::max(sqSize, cqSize);
+
+    sqRing = ::mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+      return false;
+    cqRing = single ? sqRing
+      : ::mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED)
+      return false;
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = ::mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+      return false;
+
+    char* sq = static_cast<char*>(sqRing);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // no more than depth requests are in flight, so the queues never fill up
+    depth = std::min(depth, params.sq_entries);
+    sqPending = *sqTail;
+    reaper = std::thread(&UringIo::reap, this);
+    return true;
+  }
+
+  const char* name() const { return "io_uring"; }
+
+  void submit(IoRequest* const* requests, const std::uint32_t count)
+  {
+    int error = 0;
+    for (std::uint32_t first = 0; first < count; first += depth)
+    {
+      std::uint32_t n = std::min(depth, count - first);
+      started(n);
+
+      std::uint32_t submitted = 0;
+      if (error == 0)
+      {
+        std::lock_guard<std::mutex> guard(submitLatch);
+        for (std::uint32_t i = first; i < first + n; i++)
+        {
+          IoRequest* request = requests[i];
+          io_uring_sqe* sqe = nextEntry();
+          sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+          sqe->fd = request->fd;
+          sqe->off = request->offset;
+          sqe->addr = (unsigned long)&request->buffer;
+          sqe->len = 1;
+          sqe->user_data = (unsigned long)request;
+          IO_HANDOFF_RELEASE(request);
+        }
+        submitted = push(n);
+        if (submitted < n)
+          error = errno;
+      }
+
+      // once the kernel refuses requests, the rest are completed with its error so nobody waits on them
+      for (std::uint32_t i = first + submitted; i < first + n; i++)
+        finished(requests[i], -error);
+    }
+
+    if (error != 0)
+      throw BadgerDbException(std::string("Could not submit page I/O: ") + std::strerror(error));
+  }
+
+ private:
+  // Clear the next free submission queue entry and put it in the array, not yet visible to the kernel
+  io_uring_sqe* nextEntry()
+  {
+    unsigned index = sqPending++ & *sqMask;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes) + index;
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    sqArray[index] = index;
+    return sqe;
+  }
+
+  // Publish the last n entries and have the kernel start them, returning how many it took. On an error the
+  // entries it did not take are withdrawn from the queue again and errno is left set.
+  std::uint32_t push(const std::uint32_t n)
+  {
+    __atomic_store_n(sqTail, sqPending, __ATOMIC_RELEASE);
+    std::uint32_t submitted = 0;
+    while (submitted < n)
+    {
+      int done = (int)::syscall(__NR_io_uring_enter, ringFd, n - submitted, 0, 0, NULL, 0);
+      if (done < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        {
+          std::this_thread::yield();
+          continue;
+        }
+        int error = errno;
+        sqPending -= n - submitted;
+        __atomic_store_n(sqTail, sqPending, __ATOMIC_RELEASE);
+        errno = error;
+        return submitted;
+      }
+      submitted += done;
+    }
+    return submitted;
+  }
+
+  void reap()
+  {
+    while (true)
+    {
+      unsigned head = *cqHead;
+      if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+      {
+        ::syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        continue;
+      }
+
+      io_uring_cqe* cqe = &cqes[head & *cqMask];
+      IoRequest* request = reinterpret_cast<IoRequest*>(cqe->user_data);
+      ssize_t result = cqe->res;
+      __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+      if (request == NULL)
+        return;
+      IO_HANDOFF_ACQUIRE(request);
+      finished(request, result);
+    }
+  }
+
+  int ringFd;
+  void* sqRing;
+  void* cqRing;
+  void* sqes;
+  std::size_t sqSize;
+  std::size_t cqSize;
+  std::size_t sqesSize;
+
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  io_uring_cqe* cqes;
+
+  // Tail of the submission queue including entries not yet published, guarded by submitLatch
+  unsigned sqPending;
+  std::mutex submitLatch;
+  std::thread reaper;
+};
+
+#endif
+
+}
+
+// -----------------------------------------------------------------------------
+// PageIo
+// -----------------------------------------------------------------------------
+
+PageIo* PageIo::create(const std::uint32_t depth, const bool useUring)
+{
+#ifdef BADGERDB_IO_URING
+  if (useUring)
+  {
+    UringIo* io = new UringIo(std::max<std::uint32_t>(depth, 1));
+    if (io->open())
+      return io;
+    delete io;
+  }
+#endif
+  return new ThreadPoolIo(std::max<std::uint32_t>(depth, 1));
+}
+
+PageIo::PageIo(const std::uint32_t depthIn)
+  : depth(depthIn), inFlight(0)
+{
+}
+
+void PageIo::drain()
+{
+  std::unique_lock<std::mutex> lock(latch);
+  while (inFlight > 0)
+    done.wait(lock);
+}
+
+void PageIo::started(const std::uint32_t count)
+{
+  std::unique_lock<std::mutex> lock(latch);
+  while (inFlight + count > depth)
+    done.wait(lock);
+  inFlight += count;
+}
+
+void PageIo::finished(IoRequest* request, const ssize_t result)
+{
+  int error = 0;
+  if (result < 0)
+  {
+    error = (int)-result;
+  }
+  else if ((std::size_t)result < request->buffer.iov_len)
+  {
+    // a read past the end of the file, a short write is an error
+    if (request->write)
+      error = EIO;
+    else
+      std::memset(static_cast<char*>(request->buffer.iov_base) + result, 0, request->buffer.iov_len - result);
+  }
+
+  // the request may be reused as soon as it is completed
+  request->complete(error);
+  {
+    std::lock_guard<std::mutex> guard(latch);
+    inFlight--;
+  }
+  done.notify_all();
+}
+
+}
@@ -0,0 +1,156 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace badgerdb {
+
+/**
+ * @brief Most page reads and writes a PageIo engine of a buffer pool keeps in flight.
+ */
+const std::uint32_t IODEPTH = 64;
+
+/**
+ * @brief Number of threads of the PageIo engine used when io_uring is not available.
+ */
+const std::uint32_t IOTHREADS = 8;
+
+/**
+* @brief A read or write of one page, submitted to a PageIo engine. File::prepareRead and File::prepareWrite fill it
+* in. When the I/O is done the engine calls complete() from one of its own threads.
+*/
+class IoRequest
+{
+ public:
+	/**
+   * Descriptor of the file
+	 */
+  int fd;
+
+	/**
+   * Offset of the page in the file
+	 */
+  off_t offset;
+
+	/**
+   * Memory the page is read into or written from
+	 */
+  struct iovec buffer;
+
+	/**
+   * True for a write, false for a read
+	 */
+  bool write;
+
+	/**
+   * Constructor of IoRequest class
+	 */
+  IoRequest()
+		: fd(-1), offset(0), write(false)
+  {
+		buffer.iov_base = NULL;
+		buffer.iov_len = 0;
+  }
+
+  virtual ~IoRequest() {}
+
+	/**
+   * Called once the I/O is done. A read that ends past the end of the file has the rest of its buffer zeroed.
+	 *
+	 * @param error		0 on success, otherwise an errno value
+	 */
+  virtual void complete(const int error) = 0;
+};
+
+/**
+* @brief Engine doing page reads and writes asynchronously, with many of them in flight at once. It uses io_uring
+* where the kernel allows it, and otherwise hands the requests to a pool of threads doing pread and pwrite. All of its
+* methods can be called from many threads at once.
+*/
+class PageIo
+{
+ public:
+	/**
+   * Create an engine, using io_uring if it is available.
+	 *
+	 * @param depth		Most requests in flight at once
+	 * @param useUring	False to use the thread pool even if io_uring is available
+	 */
+  static PageIo* create(const std::uint32_t depth = IODEPTH, const bool useUring = true);
+
+	/**
+   * Destructor of PageIo class. Waits for the requests in flight.
+	 */
+  virtual ~PageIo() {}
+
+	/**
+   * Name of the engine, as recorded in BufStats
+	 */
+  virtual const char* name() const = 0;
+
+	/**
+   * Start the requests and return, waiting only while the engine has depth requests in flight already. A request
+	 * must stay alive and untouched until it is completed. If the engine cannot take the requests, those it did not
+	 * start are completed with the error and BadgerDbException is thrown.
+	 *
+	 * @param requests	Requests to start
+	 * @param count		Number of requests
+	 */
+  virtual void submit(IoRequest* const* requests, const std::uint32_t count) = 0;
+
+	/**
+   * Wait until every request submitted so far has completed.
+	 */
+  void drain();
+
+ protected:
+	/**
+   * Constructor of PageIo class
+	 *
+	 * @param depth		Most requests in flight at once
+	 */
+  PageIo(const std::uint32_t depth);
+
+	/**
+   * Wait for room for count more requests and count them as in flight.
+	 */
+  void started(const std::uint32_t count);
+
+	/**
+   * Complete the request with the result of its system call, a byte count or a negated errno value.
+	 */
+  void finished(IoRequest* request, const ssize_t result);
+
+	/**
+   * Most requests in flight at once
+	 */
+  std::uint32_t depth;
+
+ private:
+	/**
+   * Number of requests in flight
+	 */
+  std::uint32_t inFlight;
+
+	/**
+   * Protects inFlight
+	 */
+  std::mutex latch;
+
+	/**
+   * Signalled whenever a request completes
+	 */
+  std::condition_variable done;
+};
+
+}
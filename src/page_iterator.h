@@ -101,6 +101,16 @@ class PageIterator {
 		return page_->getRecord(current_record_); 
 	}
 
+  /**
+   * Returns a view of the current record in the page, valid while the page
+   * stays pinned.
+   *
+   * @return  View of the record in page.
+   */
+  inline RecordView getRecordView() const {
+    return page_->getRecordView(current_record_);
+  }
+
   /**
    * Returns the next used slot in the page after the given slot or
    * Page::INVALID_SLOT if no slots are used after the given slot.
@@ -0,0 +1,50 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include "record_appender.h"
+#include "exceptions/badgerdb_exception.h"
+
+namespace badgerdb {
+
+RecordAppender::RecordAppender(PageFile* file,
+                               const std::uint32_t extent_pages)
+    : file_(file),
+      pages_(std::max<std::uint32_t>(extent_pages, 1)),
+      num_pages_(0) {
+}
+
+RecordAppender::~RecordAppender() {
+  try {
+    flush();
+  } catch (BadgerDbException&) {
+  }
+}
+
+void RecordAppender::append(const std::string& record_data) {
+  if (num_pages_ > 0 &&
+      pages_[num_pages_ - 1].hasSpaceForRecord(record_data)) {
+    pages_[num_pages_ - 1].insertRecord(record_data);
+    return;
+  }
+  if (num_pages_ == pages_.size()) {
+    flush();
+  }
+  // The new page only counts once the record is on it.
+  pages_[num_pages_] = Page();
+  pages_[num_pages_].insertRecord(record_data);
+  ++num_pages_;
+}
+
+void RecordAppender::flush() {
+  // The pages are kept until they are written, so a failed flush can be
+  // retried.
+  file_->appendPages(&pages_[0], num_pages_);
+  num_pages_ = 0;
+}
+
+}
@@ -0,0 +1,82 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "file.h"
+#include "page.h"
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Most pages a RecordAppender fills in memory before writing them out.
+ */
+const std::uint32_t APPENDEXTENTPAGES = 64;
+
+/**
+ * @brief Loads records into a file a whole extent of pages at a time.
+ *
+ * Records are packed into pages held in memory.  When the extent is full the
+ * pages are added to the end of the file together with PageFile::appendPages,
+ * so the file is written sequentially and its header changes once per extent.
+ *
+ * @warning This class is not threadsafe.
+ */
+class RecordAppender {
+ public:
+  /**
+   * Constructs an appender adding pages to the end of the given file.
+   *
+   * @param file          File to load.
+   * @param extent_pages  Number of pages filled before they are written.
+   */
+  RecordAppender(PageFile* file,
+                 const std::uint32_t extent_pages = APPENDEXTENTPAGES);
+
+  /**
+   * Writes out the pages not yet written.  An error here is lost, so call
+   * flush first to see it.
+   */
+  ~RecordAppender();
+
+  /**
+   * Adds a record to the page being filled, starting a new page if it doesn't
+   * fit.  The record's page number is only known once the page is written.
+   *
+   * @param record_data  Bytes that compose the record.
+   * @throws  InsufficientSpaceException  If the record doesn't fit even in an
+   *                                      empty page.
+   */
+  void append(const std::string& record_data);
+
+  /**
+   * Adds the filled pages to the end of the file.  The page being filled is
+   * written too, so the next record starts a new page.
+   */
+  void flush();
+
+ private:
+  /**
+   * File being loaded.
+   */
+  PageFile* file_;
+
+  /**
+   * Pages of the extent being filled.
+   */
+  std::vector<Page> pages_;
+
+  /**
+   * Number of pages of the extent in use, the last one being filled.
+   */
+  std::uint32_t num_pages_;
+};
+
+}